@@ -12,5 +12,6 @@ using tcp = boost::asio::ip::tcp;
 using udp = boost::asio::ip::udp;
 using ssl_stream = ssl::stream<tcp::socket>;
 using secure_websocket = boost::beast::websocket::stream<ssl_stream>;
+using plain_websocket = boost::beast::websocket::stream<tcp::socket>;
 
 #endif
@@ -0,0 +1,28 @@
+#ifndef AUDIO_AVIO_INPUT_H
+#define AUDIO_AVIO_INPUT_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Bytes that libavformat reads through avio_context's read and seek callbacks
+struct avio_input {
+    virtual ~avio_input() = default;
+
+    // Copy up to buf_size bytes into buf, returns the number copied or an AVERROR code
+    virtual int read(uint8_t *buf, int buf_size) = 0;
+
+    // Same contract as the AVIO seek callback (SEEK_SET/SEEK_CUR/SEEK_END/AVSEEK_SIZE), returns the
+    // new position or a negative value if the position cannot be reached
+    virtual int64_t seek(int64_t offset, int whence) = 0;
+
+    // Whether libavformat may seek freely, e.g. to look for an index at the end of the file
+    virtual bool seekable() const = 0;
+
+    // Bytes that can be read right now without waiting
+    virtual size_t readable() const = 0;
+
+    // Whether every byte of the input has arrived
+    virtual bool complete() const = 0;
+};
+
+#endif
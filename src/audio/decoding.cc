@@ -3,6 +3,7 @@
 #include <exception>
 #include <iostream>
 #include <memory>
+#include <opus/opus.h>
 #include <vector>
 
 #include "decoding.h"
@@ -11,35 +12,16 @@
 static int read_packet(void *opaque, uint8_t *buf, int buf_size)
 {
     assert(opaque);
-    auto bd = reinterpret_cast<buffer_data *>(opaque);
-    buf_size = std::min<int>(buf_size, bd->data.size() - bd->loc);
-    if (buf_size < 0)
-        return 0;
-    memcpy(buf, &bd->data[bd->loc], buf_size);
-    bd->loc += buf_size;
-    return buf_size;
+    return reinterpret_cast<avio_input *>(opaque)->read(buf, buf_size);
 }
 
-#if 0
 static int64_t seek(void *opaque, int64_t offset, int whence)
 {
     assert(opaque);
-    auto bd = reinterpret_cast<buffer_data *>(opaque);
-    switch (whence) {
-        case SEEK_SET:
-            return bd->loc = offset;
-        case SEEK_CUR:
-            return bd->loc += offset;
-        case SEEK_END:
-            return bd->loc = bd->data.size() + offset;
-        case AVSEEK_SIZE:
-            return bd->data.size();
-    }
-    return -1;
+    return reinterpret_cast<avio_input *>(opaque)->seek(offset, whence);
 }
-#endif
 
-avio_context::avio_context(std::vector<uint8_t> &audio_data) : audio_file_data{audio_data, 0}
+avio_context::avio_context(avio_input &input)
 {
     avio_buf_len = 8192;
     avio_buf = reinterpret_cast<uint8_t *>(av_malloc(avio_buf_len));
@@ -48,10 +30,12 @@ avio_context::avio_context(std::vector<uint8_t> &audio_data) : audio_file_data{a
 
     // Instead of using avformat_open_input and passing path, we're going to use AVIO
     // which allows us to point to an already allocated area of memory that contains the media
-    avio_ctx = avio_alloc_context(avio_buf, avio_buf_len, 0, &audio_file_data, &read_packet,
-                                  nullptr, nullptr);
+    avio_ctx = avio_alloc_context(avio_buf, avio_buf_len, 0, &input, &read_packet, nullptr, &seek);
     if (!avio_ctx)
         throw std::runtime_error{"Could not allocate AVIO context"};
+
+    // Inputs that aren't seekable still take short seeks within what they hold through the callback
+    avio_ctx->seekable = input.seekable() ? AVIO_SEEKABLE_NORMAL : 0;
 }
 
 avio_context::~avio_context()
@@ -72,6 +56,7 @@ audio_decoder::audio_decoder()
     , do_output{true}
     , flushed{false}
     , eof{false}
+    , reuse_packet{false}
 {
     if (!frame)
         throw std::runtime_error{"Unable to allocate audio frame"};
@@ -93,7 +78,7 @@ audio_decoder::~audio_decoder()
         av_packet_unref(&packet);
 }
 
-void audio_decoder::open_input(avio_context &av)
+void audio_decoder::open_input(avio_context &av, int64_t probe_size)
 {
     format_context = avformat_alloc_context();
     if (!format_context)
@@ -102,6 +87,10 @@ void audio_decoder::open_input(avio_context &av)
     // Use the AVIO context
     format_context->pb = av.avio_ctx;
 
+    // Limits how much is read while probing the format and stream info
+    if (probe_size > 0)
+        format_context->probesize = std::max<int64_t>(probe_size, 32);
+
     // Open the file, read the header, export information into format_context
     // Frees format_context on failure
     if (avformat_open_input(&format_context, "audio-stream", nullptr, nullptr) != 0)
@@ -152,20 +141,50 @@ void audio_decoder::open_decoder()
         throw std::runtime_error{"Failed to open decoder for stream"};
 }
 
-void audio_decoder::read_packet()
+// Read the next packet of the audio stream, returns false at the end of the stream
+bool audio_decoder::demux_packet()
 {
-    auto error = 0;
     av_init_packet(&packet);
-    while ((error = av_read_frame(format_context, &packet)) == 0) {
+    while (av_read_frame(format_context, &packet) == 0) {
         if (packet.stream_index != stream_index)
             av_packet_unref(&packet);
         else
-            break;
+            return true;
     }
-    if (error)
+    return false;
+}
+
+void audio_decoder::read_packet()
+{
+    if (!demux_packet())
         flush_decoder();
 }
 
+const AVPacket *audio_decoder::next_packet()
+{
+    if (reuse_packet) {
+        reuse_packet = false;
+        return &packet;
+    }
+    if (packet.buf)
+        av_packet_unref(&packet);
+    return demux_packet() ? &packet : nullptr;
+}
+
+void audio_decoder::unread_packet()
+{
+    reuse_packet = true;
+    do_read = false;
+    do_feed = true;
+}
+
+bool audio_decoder::is_opus_48k() const
+{
+    auto params = format_context->streams[stream_index]->codecpar;
+    return params->codec_id == AV_CODEC_ID_OPUS && params->sample_rate == 48000 &&
+           (params->channels == 1 || params->channels == 2);
+}
+
 // Feed the decoder the next packet from the demuxer
 void audio_decoder::feed_decoder()
 {
@@ -176,6 +195,7 @@ void audio_decoder::feed_decoder()
         case 0:
             // successfully sent packet to decoder
             av_packet_unref(&packet);
+            reuse_packet = false;
             break;
         case AVERROR_EOF:
             // Decoder has been flushed. No new packets can be sent
@@ -250,6 +270,45 @@ audio_frame audio_decoder::next_frame()
     return {frame, eof};
 }
 
+bool audio_decoder::seek(int64_t timestamp)
+{
+    if (!format_context || !decoder_context || stream_index < 0)
+        return false;
+
+    // Land on the last packet at or before the timestamp, the caller trims the difference
+    if (av_seek_frame(format_context, stream_index, timestamp, AVSEEK_FLAG_BACKWARD) < 0)
+        return false;
+
+    avcodec_flush_buffers(decoder_context);
+    if (packet.buf)
+        av_packet_unref(&packet);
+
+    // Reaching EOF frees the frame, a seek back from there needs a new one
+    if (!frame)
+        frame = av_frame_alloc();
+    if (!frame)
+        throw std::runtime_error{"Unable to allocate audio frame"};
+
+    do_read = true;
+    do_feed = true;
+    do_output = true;
+    flushed = false;
+    eof = false;
+    reuse_packet = false;
+    return true;
+}
+
+AVRational audio_decoder::time_base() const
+{
+    return format_context->streams[stream_index]->time_base;
+}
+
+int64_t audio_decoder::start_time() const
+{
+    auto start = format_context->streams[stream_index]->start_time;
+    return start == AV_NOPTS_VALUE ? 0 : start;
+}
+
 template<typename T, AVSampleFormat format, int sample_rate, int channels>
 audio_resampler<T, format, sample_rate, channels>::audio_resampler(audio_decoder &decoder)
     : swr{swr_alloc()}, frame_buf{nullptr}, current_alloc{960}
@@ -344,23 +403,46 @@ int audio_resampler<T, format, sample_rate, channels>::delayed_samples()
 }
 
 template<typename T, AVSampleFormat format, int sample_rate, int channels>
-simple_audio_decoder<T, format, sample_rate, channels>::simple_audio_decoder()
-    : avio{input_buffer}, state{decoder_state::start}
+void audio_resampler<T, format, sample_rate, channels>::drop(int samples)
+{
+    assert(swr);
+    if (samples > 0)
+        swr_drop_output(swr, samples);
+}
+
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+void audio_resampler<T, format, sample_rate, channels>::reset()
+{
+    assert(swr);
+    // Reinitializing keeps the options but drops any buffered input and delay
+    if (swr_init(swr) < 0)
+        std::cerr << "[audio resampler] error resetting\n";
+}
+
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+simple_audio_decoder<T, format, sample_rate, channels>::simple_audio_decoder(avio_input &input)
+    : input{input}
+    , avio{input}
+    , seek_target{AV_NOPTS_VALUE}
+    , pass_through{false}
+    , state{decoder_state::start}
 {
     static_assert(sample_rate > 0);
     static_assert(channels > 0);
 }
 
 template<typename T, AVSampleFormat format, int sample_rate, int channels>
-void simple_audio_decoder<T, format, sample_rate, channels>::feed(const uint8_t *data, size_t bytes)
+int simple_audio_decoder<T, format, sample_rate, channels>::read(T *data, int samples)
 {
-    if (data && bytes > 0) {
-        input_buffer.insert(input_buffer.end(), data, data + bytes);
-    }
+    // Playback caught up with input that is still arriving, give it time to get ahead again
+    if (!input.complete() && input.readable() < input_low_watermark)
+        return 0;
+
+    return decode(data, samples);
 }
 
 template<typename T, AVSampleFormat format, int sample_rate, int channels>
-int simple_audio_decoder<T, format, sample_rate, channels>::read(T *data, int samples)
+int simple_audio_decoder<T, format, sample_rate, channels>::decode(T *data, int samples)
 {
     assert(data);
     assert(samples > 0);
@@ -368,6 +450,7 @@ int simple_audio_decoder<T, format, sample_rate, channels>::read(T *data, int sa
     if (state != decoder_state::eof) {
         auto avf = decoder.next_frame();
         if (avf.data) {
+            trim_to_seek_target(avf.data);
             resampler->feed(&avf);
         }
         if (avf.eof) {
@@ -385,14 +468,10 @@ int simple_audio_decoder<T, format, sample_rate, channels>::read(T *data, int sa
         if (state != decoder_state::eof && audio.frame_count < samples) {
             // try to read the remaining samples
             return audio.frame_count +
-                   read(data + audio.frame_count * channels, samples - audio.frame_count);
+                   decode(data + audio.frame_count * channels, samples - audio.frame_count);
         }
     }
 
-    if (audio.frame_count <= 0 && state == decoder_state::eof) {
-        // decoder gave eof and resampler isn't giving more data... completely done
-        input_buffer.clear();
-    }
     return audio.frame_count;
 }
 
@@ -423,7 +502,8 @@ void simple_audio_decoder<T, format, sample_rate, channels>::check_stream()
         switch (state) {
             // yes, fall through
             case decoder_state::start:
-                decoder.open_input(avio);
+                // If the input is still arriving, probe only within what is already buffered
+                decoder.open_input(avio, input.complete() ? 0 : input.readable() / 2);
                 state = decoder_state::opened_input;
             case decoder_state::opened_input:
                 decoder.find_stream_info();
@@ -436,6 +516,7 @@ void simple_audio_decoder<T, format, sample_rate, channels>::check_stream()
                 state = decoder_state::opened_decoder;
             case decoder_state::opened_decoder:
                 resampler = std::make_unique<resampler_type>(decoder);
+                pass_through = check_passthrough();
                 state = decoder_state::ready;
             default:
                 break;
@@ -445,6 +526,118 @@ void simple_audio_decoder<T, format, sample_rate, channels>::check_stream()
     }
 }
 
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+bool simple_audio_decoder<T, format, sample_rate, channels>::seek(
+    std::chrono::milliseconds position)
+{
+    if (state != decoder_state::ready && state != decoder_state::eof)
+        return false;
+
+    auto target = av_rescale_q(position.count(), AVRational{1, 1000}, decoder.time_base()) +
+                  decoder.start_time();
+    if (!decoder.seek(target))
+        return false;
+
+    resampler->reset();
+    seek_target = target;
+    state = decoder_state::ready;
+    return true;
+}
+
+// The demuxer lands on a packet at or before the seek target, drop the samples decoded ahead of
+// the target so playback resumes on the exact sample asked for
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+void simple_audio_decoder<T, format, sample_rate, channels>::trim_to_seek_target(
+    const AVFrame *frame)
+{
+    if (seek_target == AV_NOPTS_VALUE)
+        return;
+
+    auto pts = frame->best_effort_timestamp;
+    if (pts != AV_NOPTS_VALUE && pts < seek_target) {
+        auto early =
+            av_rescale_q(seek_target - pts, decoder.time_base(), AVRational{1, sample_rate});
+        resampler->drop(static_cast<int>(early));
+    }
+    seek_target = AV_NOPTS_VALUE;
+}
+
+// Discord takes Opus at 48 kHz in 20 ms frames. A stream that is already that (YouTube's WebM
+// formats usually are) skips decoding, resampling and encoding, saving the CPU and the quality
+// lost to transcoding. The channel bitrate is not applied to these streams
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+bool simple_audio_decoder<T, format, sample_rate, channels>::check_passthrough()
+{
+    if (sample_rate != 48000 || !decoder.is_opus_48k())
+        return false;
+
+    auto packet = decoder.next_packet();
+    if (!packet)
+        return false;
+
+    auto samples = opus_packet_get_nb_samples(packet->data, packet->size, sample_rate);
+
+    // Either way the packet is played, as a passthrough packet or decoded as usual
+    decoder.unread_packet();
+    if (samples != sample_rate / 50)
+        return false;
+
+    std::cout << "[audio decoder] passing Opus stream through without transcoding\n";
+    return true;
+}
+
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+bool simple_audio_decoder<T, format, sample_rate, channels>::passthrough() const
+{
+    return pass_through;
+}
+
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+int simple_audio_decoder<T, format, sample_rate, channels>::read_packet(uint8_t *data, int size,
+                                                                        int &frame_count)
+{
+    assert(data);
+    assert(pass_through);
+
+    if (state != decoder_state::ready)
+        return 0;
+
+    // Playback caught up with input that is still arriving, give it time to get ahead again
+    if (!input.complete() && input.readable() < input_low_watermark)
+        return 0;
+
+    while (auto packet = decoder.next_packet()) {
+        // Packets are the finest position after a seek, skip those that end before the target
+        if (seek_target != AV_NOPTS_VALUE) {
+            if (packet->pts != AV_NOPTS_VALUE &&
+                packet->pts + std::max<int64_t>(packet->duration, 1) <= seek_target)
+                continue;
+            seek_target = AV_NOPTS_VALUE;
+        }
+
+        frame_count = opus_packet_get_nb_samples(packet->data, packet->size, sample_rate);
+        if (frame_count <= 0) {
+            std::cerr << "[audio decoder] skipping invalid Opus packet\n";
+            continue;
+        }
+        // Only the first packet was checked, one tick can't send longer ones. The rest of the
+        // track is decoded and encoded again from this packet on
+        if (frame_count != sample_rate / 50 || packet->size > size) {
+            std::cerr << "[audio decoder] Opus packet of " << frame_count << " samples, "
+                      << packet->size << " bytes, transcoding the rest of the stream\n";
+            decoder.unread_packet();
+            pass_through = false;
+            frame_count = 0;
+            return 0;
+        }
+        std::copy(packet->data, packet->data + packet->size, data);
+        return packet->size;
+    }
+
+    state = decoder_state::eof;
+    return 0;
+}
+
 // explicit instantiation
 template class simple_audio_decoder<float, AV_SAMPLE_FMT_FLT, 48000, 2>;
 template class simple_audio_decoder<int16_t, AV_SAMPLE_FMT_S16, 48000, 2>;
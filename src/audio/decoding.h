@@ -2,8 +2,11 @@
 #define DECODING_H
 
 #include <boost/circular_buffer.hpp>
+#include <chrono>
 #include <vector>
 
+#include "audio/avio_input.h"
+
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
@@ -14,11 +17,6 @@ extern "C" {
 
 class audio_decoder;
 
-struct buffer_data {
-    std::vector<uint8_t> &data;
-    size_t loc;
-};
-
 struct audio_frame {
     AVFrame *data;
     bool eof;
@@ -33,13 +31,12 @@ struct audio_samples {
 class avio_context
 {
 public:
-    avio_context(std::vector<uint8_t> &audio_data);
+    avio_context(avio_input &input);
     ~avio_context();
 
 private:
     AVIOContext *avio_ctx;
     uint8_t *avio_buf;
-    buffer_data audio_file_data;
     size_t avio_buf_len;
 
     friend class audio_decoder;
@@ -61,6 +58,8 @@ public:
     void feed(audio_frame *frame);
     audio_samples<T> read(int samples);
     int delayed_samples();
+    void drop(int samples);  // Discard the next samples of output
+    void reset();            // Discard everything buffered, e.g. after a seek
 };
 
 using float_resampler = audio_resampler<float, AV_SAMPLE_FMT_FLT, 48000, 2>;
@@ -71,12 +70,25 @@ class audio_decoder
 public:
     audio_decoder();
     ~audio_decoder();
-    void open_input(avio_context &av);
+    void open_input(avio_context &av, int64_t probe_size = 0);
     void find_stream_info();
     void find_best_stream();
     void open_decoder();
     audio_frame next_frame();  // Get next frame from the audio stream
 
+    // Demuxed packets of the audio stream, for streams that are sent without decoding. The packet
+    // stays valid until the next call, nullptr at the end of the stream
+    const AVPacket *next_packet();
+    // The last packet from next_packet() is handed out again, by next_packet() or next_frame()
+    void unread_packet();
+    // Stream is already 48 kHz Opus, the format Discord takes
+    bool is_opus_48k() const;
+
+    // Reposition the demuxer at or before timestamp (in time_base units) and flush the decoder
+    bool seek(int64_t timestamp);
+    AVRational time_base() const;
+    int64_t start_time() const;
+
 private:
     friend float_resampler;
     friend s16_resampler;
@@ -92,7 +104,9 @@ private:
     bool do_output;
     bool flushed;
     bool eof;
+    bool reuse_packet;
 
+    bool demux_packet();
     void read_packet();
     void feed_decoder();
     void flush_decoder();
@@ -103,24 +117,40 @@ template<typename T, AVSampleFormat format, int sample_rate, int channels>
 class simple_audio_decoder
 {
 public:
-    simple_audio_decoder();
+    explicit simple_audio_decoder(avio_input &input);
     ~simple_audio_decoder() = default;
-    void feed(const uint8_t *data, size_t bytes);
     int read(T *data, int samples);
     int available();
     bool ready();
     bool done();
     void check_stream();
 
+    // When the stream is Opus in 20 ms frames its packets are passed through as they are, read with
+    // read_packet() instead of read(). Returns the packet size, 0 if no packet is ready yet. A
+    // packet that isn't 20 ms ends passthrough, it and the rest are then read with read()
+    bool passthrough() const;
+    int read_packet(uint8_t *data, int size, int &frame_count);
+
+    // Jump to position in the track. The first samples out afterwards are the ones at position
+    bool seek(std::chrono::milliseconds position);
+
 private:
     using resampler_type = audio_resampler<T, format, sample_rate, channels>;
 
-    std::vector<uint8_t> input_buffer;
+    // While the input is still arriving, hold off decoding whenever less than this is buffered
+    // so the demuxer never has to wait on the thread that feeds it
+    static constexpr size_t input_low_watermark = 64 * 1024;
+
+    avio_input &input;
 
     avio_context avio;
     audio_decoder decoder;
     std::unique_ptr<resampler_type> resampler;
 
+    // Timestamp a seek was asked for. Output is trimmed up to it once decoding resumes
+    int64_t seek_target;
+    bool pass_through;
+
     enum class decoder_state {
         start,
         opened_input,
@@ -130,6 +160,10 @@ private:
         ready,
         eof
     } state;
+
+    int decode(T *data, int samples);
+    void trim_to_seek_target(const AVFrame *frame);
+    bool check_passthrough();
 };
 
 using float_audio_decoder = simple_audio_decoder<float, AV_SAMPLE_FMT_FLT, 48000, 2>;
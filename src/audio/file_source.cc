@@ -1,40 +1,88 @@
 #include <boost/asio/post.hpp>
 #include <fstream>
 #include <iostream>
+#include <utility>
 
 #include "audio/file_source.h"
 
-file_source::file_source(discord::voice_context &voice_context, const std::string &file_path)
-    : voice_context{voice_context}, file_path{file_path}
+file_source::file_source(discord::voice_context &voice_context, std::string file_path)
+    : ctx{voice_context.get_io_context()}
+    , voice_context{voice_context.weak_from_this()}
+    , encoder{voice_context.get_encoder()}
+    , input_buffer_bytes{voice_context.get_options().input_buffer_bytes}
+    , file_path{std::move(file_path)}
+    , bytes_read{0}
 {
-    std::cout << "[file source] playing " << file_path << "\n";
+    std::cout << "[file source] playing " << this->file_path << "\n";
 }
 
-opus_frame file_source::next()
+void file_source::next(opus_frame &frame)
 {
-    return next_frame(decoder, voice_context.get_encoder(), buffer.data(), buffer.size());
+    next_frame(*decoder, *encoder, buffer.data(), buffer.size(), frame);
+}
+
+bool file_source::seek(std::chrono::milliseconds position)
+{
+    return decoder && decoder->seek(position);
 }
 
 void file_source::prepare()
 {
-    auto read = 0;
-    auto ifs = std::ifstream{file_path};
     auto error = boost::system::error_code{};
-    if (!ifs) {
+    try {
+        mapping.open(file_path);
+        decoder = std::make_unique<float_audio_decoder>(mapping);
+    } catch (std::exception &e) {
+        std::cerr << "[file source] " << e.what() << ", reading it as a stream\n";
+        if (!open_stream()) {
+            error = make_error_code(boost::system::errc::io_error);
+            if (auto context = voice_context.lock())
+                context->notify_audio_source_ready(error);
+            return;
+        }
+    }
+
+    decoder->check_stream();
+    if (!decoder->ready())
         error = make_error_code(boost::system::errc::io_error);
-        voice_context.notify_audio_source_ready(error);
-        return;
+
+    if (auto context = voice_context.lock())
+        context->notify_audio_source_ready(error);
+}
+
+bool file_source::open_stream()
+{
+    file.open(file_path, std::ios::binary);
+    if (!file)
+        return false;
+
+    stream = std::make_unique<stream_buffer>(input_buffer_bytes);
+    decoder = std::make_unique<float_audio_decoder>(*stream);
+
+    // Fills the input ring (or reads the whole file if it is small enough) to open the decoder on
+    read_file();
+    return true;
+}
+
+// Read the file into the input ring until it is full, then continue when there is room
+void file_source::read_file()
+{
+    while (file.good() && stream->writable() >= file_buffer.size()) {
+        file.read(file_buffer.data(), file_buffer.size());
+        bytes_read += file.gcount();
+        stream->write(reinterpret_cast<uint8_t *>(file_buffer.data()), file.gcount());
     }
-    auto buf = std::array<char, 4096>{};
-    while (ifs.good()) {
-        ifs.read(buf.data(), buf.size());
-        read += ifs.gcount();
-        decoder.feed(reinterpret_cast<uint8_t *>(buf.data()), ifs.gcount());
+
+    if (!file.good()) {
+        std::cout << "[file source] read " << bytes_read << " bytes\n";
+        stream->finish();
+        return;
     }
-    std::cout << "[file source] read " << read << " bytes\n";
-    decoder.check_stream();
-    if (!decoder.ready())
-        error = make_error_code(boost::system::errc::io_error);
 
-    voice_context.notify_audio_source_ready(error);
+    stream->when_writable(file_buffer.size(), [weak = weak_from_this(), &ctx = ctx]() {
+        boost::asio::post(ctx, [weak]() {
+            if (auto self = weak.lock())
+                self->read_file();
+        });
+    });
 }
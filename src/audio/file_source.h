@@ -2,29 +2,51 @@
 #define AUDIO_FILE_SOURCE_H
 
 #include <boost/asio/io_context.hpp>
+#include <fstream>
+#include <memory>
 #include <string>
 
 #include "audio/decoding.h"
+#include "audio/mapped_file.h"
 #include "audio/opus_encoder.h"
 #include "audio/source.h"
+#include "audio/stream_buffer.h"
 #include "callbacks.h"
 #include "discord.h"
 #include "voice/voice_connector.h"
 
-class file_source : public audio_source
+// Plays a local file from a memory mapping. Files that can't be mapped (pipes, devices) are read
+// through an input ring instead
+class file_source : public audio_source, public std::enable_shared_from_this<file_source>
 {
 public:
-    file_source(discord::voice_context &voice_context, const std::string &file_path);
+    file_source(discord::voice_context &voice_context, std::string file_path);
     virtual ~file_source() = default;
-    virtual opus_frame next();
+    virtual void next(opus_frame &frame);
     virtual void prepare();
+    virtual bool seek(std::chrono::milliseconds position);
 
 private:
-    discord::voice_context &voice_context;
-    const std::string &file_path;
+    // Outlives voice_context, which a worker still encoding from this can't rely on
+    boost::asio::io_context &ctx;
+    std::weak_ptr<discord::voice_context> voice_context;
+    std::shared_ptr<discord::opus_encoder> encoder;
+    size_t input_buffer_bytes;
+    const std::string file_path;
 
-    float_audio_decoder decoder;
+    mapped_file mapping;
+
+    // Only used when the file could not be mapped
+    std::ifstream file;
+    std::unique_ptr<stream_buffer> stream;
+    std::array<char, 8192> file_buffer;
+    size_t bytes_read;
+
+    std::unique_ptr<float_audio_decoder> decoder;
     std::array<uint8_t, 8192> buffer;
+
+    bool open_stream();
+    void read_file();
 };
 
 #endif
@@ -0,0 +1,99 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include "audio/mapped_file.h"
+
+mapped_file::mapped_file() : data{nullptr}, size{0}, loc{0} {}
+
+mapped_file::~mapped_file()
+{
+    if (data)
+        munmap(const_cast<uint8_t *>(data), size);
+}
+
+void mapped_file::open(const std::string &path)
+{
+    auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error{"could not open " + path + ": " + std::strerror(errno)};
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        throw std::runtime_error{path + " is not a regular, non-empty file"};
+    }
+
+    auto addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // the mapping keeps the file alive
+    if (addr == MAP_FAILED)
+        throw std::runtime_error{"could not map " + path + ": " + std::strerror(errno)};
+
+    // Playback reads front to back, let the kernel read ahead without blocking us
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    madvise(addr, st.st_size, MADV_WILLNEED);
+
+    data = static_cast<const uint8_t *>(addr);
+    size = static_cast<size_t>(st.st_size);
+    loc = 0;
+}
+
+int mapped_file::read(uint8_t *buf, int buf_size)
+{
+    auto len = std::min<size_t>(buf_size, size - loc);
+    if (len == 0)
+        return AVERROR_EOF;
+
+    std::memcpy(buf, data + loc, len);
+    loc += len;
+    return static_cast<int>(len);
+}
+
+int64_t mapped_file::seek(int64_t offset, int whence)
+{
+    auto pos = int64_t{0};
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = static_cast<int64_t>(loc) + offset;
+            break;
+        case SEEK_END:
+            pos = static_cast<int64_t>(size) + offset;
+            break;
+        case AVSEEK_SIZE:
+            return static_cast<int64_t>(size);
+        default:
+            return -1;
+    }
+    if (pos < 0 || pos > static_cast<int64_t>(size))
+        return -1;
+
+    loc = static_cast<size_t>(pos);
+    return pos;
+}
+
+bool mapped_file::seekable() const
+{
+    return true;
+}
+
+size_t mapped_file::readable() const
+{
+    return size - loc;
+}
+
+bool mapped_file::complete() const
+{
+    return true;
+}
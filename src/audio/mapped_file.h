@@ -0,0 +1,34 @@
+#ifndef AUDIO_MAPPED_FILE_H
+#define AUDIO_MAPPED_FILE_H
+
+#include <string>
+
+#include "audio/avio_input.h"
+
+// Serves a file to libavformat straight from a read-only memory mapping. Opening is constant
+// time, nothing is copied up front, and every guild playing the same file shares its pages in the
+// page cache
+class mapped_file : public avio_input
+{
+public:
+    mapped_file();
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+    ~mapped_file();
+
+    // Throws std::runtime_error if the file cannot be opened or mapped, e.g. it isn't a regular file
+    void open(const std::string &path);
+
+    int read(uint8_t *buf, int buf_size) override;
+    int64_t seek(int64_t offset, int whence) override;
+    bool seekable() const override;
+    size_t readable() const override;
+    bool complete() const override;
+
+private:
+    const uint8_t *data;
+    size_t size;
+    size_t loc;
+};
+
+#endif
@@ -3,13 +3,14 @@
 #include "audio/opus_encoder.h"
 
 discord::opus_encoder::opus_encoder(int channels, int sample_rate)
+    : bitrate{64000}, applied_bitrate{64000}
 {
     int error = 0;
     encoder = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_AUDIO, &error);
     if (error)
         throw std::runtime_error("Could not create opus encoder");
 
-    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(64000));
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(applied_bitrate));
     opus_encoder_ctl(encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_MUSIC));
 }
 
@@ -22,12 +23,14 @@ discord::opus_encoder::~opus_encoder()
 int32_t discord::opus_encoder::encode(const int16_t *src, int frame_size, unsigned char *dest,
                                       int dest_size)
 {
+    apply_bitrate();
     return opus_encode(encoder, src, frame_size, dest, dest_size);
 }
 
 int32_t discord::opus_encoder::encode(const float *src, int frame_size, unsigned char *dest,
                                       int dest_size)
 {
+    apply_bitrate();
     return opus_encode_float(encoder, src, frame_size, dest, dest_size);
 }
 
@@ -37,5 +40,15 @@ void discord::opus_encoder::set_bitrate(int bitrate)
         bitrate = 8000;
     if (bitrate > 128000)
         bitrate = 128000;
-    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate));
+    this->bitrate = bitrate;
+}
+
+// The encoder itself is only touched by the thread encoding with it
+void discord::opus_encoder::apply_bitrate()
+{
+    auto wanted = bitrate.load(std::memory_order_relaxed);
+    if (wanted != applied_bitrate) {
+        opus_encoder_ctl(encoder, OPUS_SET_BITRATE(wanted));
+        applied_bitrate = wanted;
+    }
 }
@@ -1,6 +1,7 @@
 #ifndef DISCORD_OPUS_ENCODER_H
 #define DISCORD_OPUS_ENCODER_H
 
+#include <atomic>
 #include <cstdint>
 
 #include <opus/opus.h>
@@ -15,10 +16,16 @@ public:
 
     int32_t encode(const int16_t *src, int frame_size, unsigned char *dest, int dest_size);
     int32_t encode(const float *src, int frame_size, unsigned char *dest, int dest_size);
+
+    // Safe to call from any thread, the new bitrate is applied on the next encode
     void set_bitrate(int bitrate);
 
 private:
     OpusEncoder *encoder;
+    std::atomic<int> bitrate;
+    int applied_bitrate;
+
+    void apply_bitrate();
 };
 }  // namespace discord
 
@@ -1,41 +1,53 @@
-#include <array>
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 
 #include "audio/source.h"
 
-opus_frame next_frame(float_audio_decoder &decoder, discord::opus_encoder &encoder, uint8_t *buffer,
-                      size_t buf_size)
+void next_frame(float_audio_decoder &decoder, discord::opus_encoder &encoder, uint8_t *buffer,
+                size_t buf_size, opus_frame &frame)
 {
     const auto channels = 2;
     const auto frames_wanted = 960;
-    auto frame = opus_frame{};
+    frame.clear();
 
-    if (buf_size < frames_wanted * channels)
+    if (buf_size < frames_wanted * channels * sizeof(float))
         throw std::runtime_error{"buffer is too small to read " + std::to_string(frames_wanted) +
                                  " samples"};
 
+    if (decoder.passthrough()) {
+        // The stream is already Opus packets Discord can take, send them as they are
+        auto len = decoder.read_packet(frame.payload(), frame.max_payload, frame.frame_count);
+        if (len > 0) {
+            frame.size = len;
+            return;
+        }
+        // Unless the stream stopped being one it can pass through, then it is decoded from here
+        if (decoder.passthrough()) {
+            frame.end_of_source = decoder.done();
+            return;
+        }
+    }
+
     auto float_buf = reinterpret_cast<float *>(buffer);
     auto read = decoder.read(float_buf, frames_wanted);
     if (read < frames_wanted) {
         if (!decoder.done())
-            return {};
+            return;
 
         frame.end_of_source = true;
 
         // Want to clear the remaining frames to 0
-        auto start = buffer + read * channels;
-        auto end = buffer + frames_wanted * channels;
+        auto start = float_buf + read * channels;
+        auto end = float_buf + frames_wanted * channels;
         std::fill(start, end, 0.0f);
     }
     if (read > 0) {
-        auto buf = std::array<uint8_t, 512>{};
-        auto encoded_len = encoder.encode(float_buf, frames_wanted, buf.data(), buf.size());
-        if (encoded_len > 0) {
-            frame.data.reserve(encoded_len);
-            frame.data.insert(std::begin(frame.data), buf.data(), buf.data() + encoded_len);
-        }
+        // Straight into the packet it will be sent in
+        auto encoded_len =
+            encoder.encode(float_buf, frames_wanted, frame.payload(), frame.max_payload);
+        if (encoded_len > 0)
+            frame.size = encoded_len;
     }
     frame.frame_count = frames_wanted;
-    return frame;
 }
@@ -1,29 +1,67 @@
 #ifndef AUDIO_SOURCE_H
 #define AUDIO_SOURCE_H
 
+#include <array>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
-#include <vector>
 
 #include "audio/decoding.h"
 #include "audio/opus_encoder.h"
 
+// One Opus packet, kept in the buffer it is sent from. The payload starts after room for the RTP
+// header and leaves room behind it for what encryption adds, so the packet is sealed in place
+// rather than copied
 struct opus_frame {
-    std::vector<uint8_t> data;
-    int frame_count;
-    bool end_of_source;
+    static constexpr size_t header_room = 12;
+    static constexpr size_t max_payload = 1275;  // largest possible Opus packet
+    static constexpr size_t trailer_room = 64;
+
+    std::array<uint8_t, header_room + max_payload + trailer_room> packet;
+    size_t size = 0;  // payload bytes
+    int frame_count = 0;
+    bool end_of_source = false;
+
+    uint8_t *payload()
+    {
+        return packet.data() + header_room;
+    }
+
+    const uint8_t *payload() const
+    {
+        return packet.data() + header_room;
+    }
+
+    bool empty() const
+    {
+        return size == 0;
+    }
+
+    void clear()
+    {
+        size = 0;
+        frame_count = 0;
+        end_of_source = false;
+    }
 };
 
-opus_frame next_frame(float_audio_decoder &decoder, discord::opus_encoder &encoder, uint8_t *buffer,
-                      size_t buf_size);
+// Encodes the next 20 ms of decoder into frame, using buffer as room for the decoded samples
+void next_frame(float_audio_decoder &decoder, discord::opus_encoder &encoder, uint8_t *buffer,
+                size_t buf_size, opus_frame &frame);
 
 struct audio_source {
     virtual ~audio_source() = default;
-    virtual opus_frame next() = 0;
+
+    // Fills in frame, which is left empty if no audio is ready yet
+    virtual void next(opus_frame &frame) = 0;
 
     // The audio source might need some preparation that can't be done in the constructor.
     // E.g. youtube_dl_source needs to create a child process and begin reading from async_pipe,
     // but it cannot retrieve a weak_ptr to itself until after the constructor has finished.
     virtual void prepare() = 0;
+
+    // Continue playback from position in the source. Returns false if it cannot get there
+    virtual bool seek(std::chrono::milliseconds position) = 0;
 };
 
 #endif
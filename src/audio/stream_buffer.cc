@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include "audio/stream_buffer.h"
+
+stream_buffer::stream_buffer(size_t capacity)
+    : ring{new uint8_t[capacity]}
+    , size{capacity}
+    , read_offset{0}
+    , write_offset{0}
+    , peak_buffered{0}
+    , eof{false}
+    , space_wanted{0}
+{
+}
+
+size_t stream_buffer::write(const uint8_t *data, size_t bytes)
+{
+    if (!data || bytes == 0)
+        return 0;
+
+    {
+        auto lock = std::lock_guard<std::mutex>{mutex};
+        if (!ring)
+            return 0;  // cleared
+        bytes = std::min<size_t>(bytes, size - (write_offset - read_offset));
+        if (bytes == 0)
+            return 0;
+
+        // Copy in at most two pieces, wrapping around the end of the ring
+        auto start = write_offset % size;
+        auto first = std::min(bytes, size - start);
+        std::memcpy(&ring[start], data, first);
+        std::memcpy(&ring[0], data + first, bytes - first);
+
+        write_offset += bytes;
+        peak_buffered = std::max<size_t>(peak_buffered, write_offset - read_offset);
+    }
+    data_ready.notify_all();
+    return bytes;
+}
+
+size_t stream_buffer::writable() const
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return size - (write_offset - read_offset);
+}
+
+void stream_buffer::when_writable(size_t bytes, std::function<void()> cb)
+{
+    {
+        auto lock = std::lock_guard<std::mutex>{mutex};
+        if (size - (write_offset - read_offset) < bytes) {
+            space_wanted = bytes;
+            space_cb = std::move(cb);
+            return;
+        }
+    }
+    cb();
+}
+
+void stream_buffer::finish()
+{
+    {
+        auto lock = std::lock_guard<std::mutex>{mutex};
+        eof = true;
+    }
+    data_ready.notify_all();
+}
+
+int stream_buffer::read(uint8_t *buf, int buf_size)
+{
+    auto cb = std::function<void()>{};
+    auto len = size_t{0};
+    {
+        auto lock = std::unique_lock<std::mutex>{mutex};
+
+        // The producer is behind the decoder, wait for it to catch up
+        auto has_data = [this] { return read_offset < write_offset || eof; };
+        if (!data_ready.wait_for(lock, stall_timeout, has_data)) {
+            std::cerr << "[stream buffer] stalled waiting for data, ending stream\n";
+            return AVERROR_EOF;
+        }
+
+        len = std::min<size_t>(buf_size, write_offset - read_offset);
+        if (len == 0)
+            return AVERROR_EOF;
+
+        auto start = read_offset % size;
+        auto first = std::min(len, size - start);
+        std::memcpy(buf, &ring[start], first);
+        std::memcpy(buf + first, &ring[0], len - first);
+        read_offset += len;
+
+        // Reading freed up enough room for a producer waiting on a full ring
+        if (space_cb && size - (write_offset - read_offset) >= space_wanted) {
+            cb = std::move(space_cb);
+            space_cb = nullptr;
+        }
+    }
+    if (cb)
+        cb();
+    return static_cast<int>(len);
+}
+
+int64_t stream_buffer::seek(int64_t offset, int whence)
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    auto pos = int64_t{0};
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = static_cast<int64_t>(read_offset) + offset;
+            break;
+        case SEEK_END:
+            if (!eof)
+                return -1;
+            pos = static_cast<int64_t>(write_offset) + offset;
+            break;
+        case AVSEEK_SIZE:
+            return eof ? static_cast<int64_t>(write_offset) : -1;
+        default:
+            return -1;
+    }
+
+    // Reachable are bytes that haven't been overwritten yet, read or not, up to what was written
+    auto oldest = write_offset > size ? write_offset - size : 0;
+    if (pos < static_cast<int64_t>(oldest) || pos > static_cast<int64_t>(write_offset))
+        return -1;
+
+    read_offset = static_cast<uint64_t>(pos);
+    return pos;
+}
+
+bool stream_buffer::seekable() const
+{
+    // Only part of the stream is ever held, don't let demuxers go looking for an index at the end
+    return false;
+}
+
+void stream_buffer::clear()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    ring.reset();
+    size = 0;
+    read_offset = write_offset = 0;
+    space_cb = nullptr;
+}
+
+size_t stream_buffer::capacity() const
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return size;
+}
+
+size_t stream_buffer::readable() const
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return write_offset - read_offset;
+}
+
+size_t stream_buffer::peak() const
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return peak_buffered;
+}
+
+bool stream_buffer::complete() const
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return eof;
+}
@@ -0,0 +1,62 @@
+#ifndef AUDIO_STREAM_BUFFER_H
+#define AUDIO_STREAM_BUFFER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "audio/avio_input.h"
+
+// Fixed-capacity ring holding the bytes of a source that is still being read in while libavformat
+// consumes it. Space is reclaimed as soon as the demuxer has read past it, so memory stays bounded
+// however long the track is. The producer must not write more than writable() bytes; when the
+// ring is full it registers a callback with when_writable() and stops producing until then.
+//
+// A read that catches up with the producer waits for more data rather than reporting EOF, so EOF
+// is only seen once the producer calls finish(). Seeks can reach anything still held in the ring.
+class stream_buffer : public avio_input
+{
+public:
+    explicit stream_buffer(size_t capacity);
+
+    // Producer side
+    size_t write(const uint8_t *data, size_t bytes);
+    size_t writable() const;
+    void when_writable(size_t bytes, std::function<void()> cb);
+    void finish();
+
+    // Consumer side
+    int read(uint8_t *buf, int buf_size) override;
+    int64_t seek(int64_t offset, int whence) override;
+    bool seekable() const override;
+    size_t readable() const override;  // bytes written but not yet read
+    bool complete() const override;    // finish() was called
+    void clear();
+
+    size_t capacity() const;
+    size_t peak() const;  // most bytes ever waiting to be read
+
+private:
+    // A reader that waits this long for data is treated as having hit the end of the stream
+    static constexpr auto stall_timeout = std::chrono::seconds(5);
+
+    mutable std::mutex mutex;
+    std::condition_variable data_ready;
+    std::unique_ptr<uint8_t[]> ring;
+    size_t size;
+
+    // Absolute stream offsets, the ring index is offset % size
+    uint64_t read_offset;
+    uint64_t write_offset;
+
+    size_t peak_buffered;
+    bool eof;
+
+    size_t space_wanted;
+    std::function<void()> space_cb;
+};
+
+#endif
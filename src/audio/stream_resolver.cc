@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <boost/asio/buffers_iterator.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/process/async_pipe.hpp>
+#include <boost/process/child.hpp>
+#include <boost/process/error.hpp>
+#include <boost/process/io.hpp>
+#include <iostream>
+#include <iterator>
+#include <json.hpp>
+#include <utility>
+
+#include "audio/stream_resolver.h"
+
+struct stream_resolver::worker {
+    explicit worker(boost::asio::io_context &ctx) : to{ctx}, from{ctx}, deadline{ctx} {}
+
+    boost::process::async_pipe to;
+    boost::process::async_pipe from;
+    boost::process::child child;
+    boost::asio::streambuf replies;
+    boost::asio::steady_timer deadline;
+    std::string request;
+    std::string page_url;  // being resolved, empty while idle
+    bool retired = false;  // stopped, handlers still pending on it do nothing
+};
+
+stream_resolver::stream_resolver(std::string command, size_t processes,
+                                 std::chrono::seconds ttl, std::chrono::milliseconds timeout)
+    : command{std::move(command)}
+    , ttl{ttl}
+    , timeout{timeout}
+    , work{boost::asio::make_work_guard(ctx)}
+    , workers(processes)
+    , stopping{false}
+    , hits{0}
+    , resolved{0}
+{
+    // Started right away, the interpreter's startup is what requests shouldn't wait for
+    boost::asio::post(ctx, [this] {
+        for (auto &w : workers)
+            w = start();
+    });
+    thread = std::thread{[this] { ctx.run(); }};
+    std::cout << "[resolver] starting " << processes << " processes of " << this->command << "\n";
+}
+
+stream_resolver::~stream_resolver()
+{
+    boost::asio::post(ctx, [this] {
+        stopping = true;
+        for (auto &w : workers)
+            if (w)
+                stop(*w);
+    });
+    work.reset();
+    thread.join();
+}
+
+void stream_resolver::resolve(const std::string &page_url, boost::asio::io_context &reply_ctx,
+                              resolve_cb c)
+{
+    boost::asio::post(ctx, [this, page_url, &reply_ctx, c = std::move(c)]() mutable {
+        if (auto it = cache.find(page_url); it != cache.end()) {
+            if (clock::now() < it->second.expires) {
+                ++hits;
+                boost::asio::post(reply_ctx, [c = std::move(c), s = it->second.resolved] {
+                    c({}, s);
+                });
+                return;
+            }
+            cache.erase(it);
+        }
+
+        // Asked for again while being resolved, it waits for the same answer
+        auto &waiters = waiting[page_url];
+        waiters.push_back({&reply_ctx, std::move(c)});
+        if (waiters.size() == 1) {
+            queue.push_back(page_url);
+            dispatch();
+        }
+    });
+}
+
+void stream_resolver::forget(const std::string &page_url)
+{
+    boost::asio::post(ctx, [this, page_url] { cache.erase(page_url); });
+}
+
+size_t stream_resolver::cache_hits() const
+{
+    return hits;
+}
+
+size_t stream_resolver::resolutions() const
+{
+    return resolved;
+}
+
+std::shared_ptr<stream_resolver::worker> stream_resolver::start()
+{
+    namespace bp = boost::process;
+    auto w = std::make_shared<worker>(ctx);
+    try {
+        // Its stderr is the bot's, where youtube-dl explains why it can't start
+        w->child = bp::child{command, bp::std_in<w->to, bp::std_out> w->from};
+    } catch (const bp::process_error &e) {
+        std::cerr << "[resolver] could not start " << command << ": " << e.what() << "\n";
+        w->retired = true;
+        return w;
+    }
+    read_reply(w);
+    return w;
+}
+
+// Idle processes take the pages queued, dead ones are replaced first
+void stream_resolver::dispatch()
+{
+    for (auto &w : workers) {
+        if (queue.empty() || stopping)
+            return;
+        if (!w || w->retired)
+            w = start();
+        if (w->retired) {
+            // Could not start, the command won't work any better for the rest of the queue
+            auto page_url = std::move(queue.front());
+            queue.pop_front();
+            finish(page_url, make_error_code(boost::system::errc::no_such_file_or_directory), {});
+            continue;
+        }
+        if (!w->page_url.empty())
+            continue;
+
+        w->page_url = std::move(queue.front());
+        queue.pop_front();
+        send(w);
+    }
+}
+
+void stream_resolver::send(const std::shared_ptr<worker> &w)
+{
+    ++resolved;
+    w->request = nlohmann::json{{"url", w->page_url}}.dump() + "\n";
+    boost::asio::async_write(w->to, boost::asio::buffer(w->request),
+                             [this, w](const auto &ec, size_t) {
+                                 if (ec && !w->retired)
+                                     fail(*w, ec);
+                             });
+
+    w->deadline.expires_after(timeout);
+    w->deadline.async_wait([this, w](const auto &ec) {
+        if (!ec && !w->retired) {
+            std::cerr << "[resolver] no answer for " << w->page_url << " in " << timeout.count()
+                      << " ms, restarting the process\n";
+            fail(*w, boost::asio::error::timed_out);
+        }
+    });
+}
+
+// Always pending while the process runs, so one that dies while idle is replaced too
+void stream_resolver::read_reply(const std::shared_ptr<worker> &w)
+{
+    boost::asio::async_read_until(w->from, w->replies, '\n',
+                                  [this, w](const auto &ec, size_t length) {
+                                      on_reply(w, ec, length);
+                                  });
+}
+
+void stream_resolver::on_reply(const std::shared_ptr<worker> &w,
+                               const boost::system::error_code &ec, size_t length)
+{
+    if (w->retired)
+        return;
+    if (ec) {
+        // Closing its output is normally the process exiting, give it a moment to finish that
+        auto se = std::error_code{};
+        if (w->child.wait_for(std::chrono::milliseconds(100), se) && !se)
+            std::cerr << "[resolver] process exited with status " << w->child.exit_code() << "\n";
+        else
+            std::cerr << "[resolver] process closed its output: " << ec.message() << "\n";
+        fail(*w, ec);
+        return;
+    }
+
+    auto data = w->replies.data();
+    auto line = std::string{boost::asio::buffers_begin(data),
+                            boost::asio::buffers_begin(data) + length};
+    w->replies.consume(length);
+    read_reply(w);
+    // Nothing was asked, a process shouldn't say anything then
+    if (w->page_url.empty())
+        return;
+    w->deadline.cancel();
+    auto page_url = std::exchange(w->page_url, {});
+
+    try {
+        auto reply = nlohmann::json::parse(line);
+        if (auto error = reply.find("error"); error != reply.end()) {
+            std::cerr << "[resolver] " << page_url << ": " << error->dump() << "\n";
+            finish(page_url, make_error_code(boost::system::errc::invalid_argument), {});
+        } else if (auto protocol = reply.value("protocol", "https");
+                   protocol != "http" && protocol != "https") {
+            std::cerr << "[resolver] " << page_url << ": can't fetch " << protocol << "\n";
+            finish(page_url, make_error_code(boost::system::errc::protocol_not_supported), {});
+        } else {
+            auto s = stream{reply.at("url").get<std::string>(), reply.value("format", ""),
+                            reply.value("headers", std::map<std::string, std::string>{})};
+            remember(page_url, s);
+            finish(page_url, {}, s);
+        }
+    } catch (const nlohmann::json::exception &e) {
+        std::cerr << "[resolver] bad answer for " << page_url << ": " << e.what() << "\n";
+        finish(page_url, make_error_code(boost::system::errc::bad_message), {});
+    }
+    dispatch();
+}
+
+// The process is gone or stuck, what it was resolving fails and the next dispatch replaces it
+void stream_resolver::fail(worker &w, const boost::system::error_code &ec)
+{
+    auto page_url = std::exchange(w.page_url, {});
+    stop(w);
+    if (!page_url.empty())
+        finish(page_url, ec, {});
+    dispatch();
+}
+
+void stream_resolver::stop(worker &w)
+{
+    w.retired = true;
+    w.deadline.cancel();
+    auto ec = boost::system::error_code{};
+    w.to.close(ec);
+    w.from.close(ec);
+    auto se = std::error_code{};
+    if (w.child.valid() && w.child.running(se))
+        w.child.terminate(se);
+}
+
+void stream_resolver::remember(const std::string &page_url, const stream &s)
+{
+    auto now = clock::now();
+    if (cache.size() >= cache_limit) {
+        for (auto it = cache.begin(); it != cache.end();)
+            it = it->second.expires <= now ? cache.erase(it) : std::next(it);
+    }
+    if (cache.size() >= cache_limit) {
+        auto soonest = std::min_element(cache.begin(), cache.end(), [](auto &a, auto &b) {
+            return a.second.expires < b.second.expires;
+        });
+        cache.erase(soonest);
+    }
+    cache[page_url] = {s, now + ttl};
+}
+
+void stream_resolver::finish(const std::string &page_url, const boost::system::error_code &ec,
+                             const stream &s)
+{
+    auto found = waiting.find(page_url);
+    if (found == waiting.end())
+        return;
+    auto waiters = std::move(found->second);
+    waiting.erase(found);
+    for (auto &w : waiters)
+        boost::asio::post(*w.ctx, [cb = std::move(w.cb), ec, s] { cb(ec, s); });
+}
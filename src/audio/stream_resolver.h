@@ -0,0 +1,103 @@
+#ifndef AUDIO_STREAM_RESOLVER_H
+#define AUDIO_STREAM_RESOLVER_H
+
+#include <atomic>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/system/error_code.hpp>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Long-lived processes turning page URLs (e.g. a YouTube video) into the URL of the media itself,
+// so a track doesn't wait for a youtube-dl to start up before it can be fetched. Each process
+// reads requests, {"url": ...} one per line on stdin, and answers each with a line on stdout,
+// {"url": ..., "format": ..., "protocol": ..., "headers": {...}} or {"error": ...}. Only media
+// fetched over plain HTTP(S) is accepted, not e.g. a DASH manifest.
+//
+// Answers are cached for a while, a track played again or asked for by several guilds at once is
+// resolved only once. Everything runs on a thread of its own, requests come from any thread and
+// get their answer on the io_context they name
+class stream_resolver
+{
+public:
+    struct stream {
+        std::string url;
+        std::string format;                         // youtube-dl's format id
+        std::map<std::string, std::string> headers;  // to send with the request for url
+    };
+    using resolve_cb = std::function<void(const boost::system::error_code &ec, const stream &s)>;
+
+    // Starts processes instances of command. A result is kept for ttl, a process taking longer
+    // than timeout to answer is killed and replaced
+    stream_resolver(std::string command, size_t processes, std::chrono::seconds ttl,
+                    std::chrono::milliseconds timeout = std::chrono::seconds(60));
+    ~stream_resolver();
+    stream_resolver(const stream_resolver &) = delete;
+    stream_resolver &operator=(const stream_resolver &) = delete;
+
+    // c runs on reply_ctx, with an error if the page could not be resolved
+    void resolve(const std::string &page_url, boost::asio::io_context &reply_ctx, resolve_cb c);
+
+    // Drops what is cached for page_url, e.g. a media URL that no longer works
+    void forget(const std::string &page_url);
+
+    // Requests answered from the cache, and ones a process had to resolve
+    size_t cache_hits() const;
+    size_t resolutions() const;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    // More than any bot plays within a TTL, a full cache drops what expires soonest
+    static constexpr size_t cache_limit = 4096;
+
+    struct worker;
+    struct waiter {
+        boost::asio::io_context *ctx;
+        resolve_cb cb;
+    };
+    struct cached {
+        stream resolved;
+        clock::time_point expires;
+    };
+
+    const std::string command;
+    const std::chrono::seconds ttl;
+    const std::chrono::milliseconds timeout;
+
+    // Declared before what runs on it, so the workers' pipes and timers go before it does
+    boost::asio::io_context ctx;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
+
+    // Resolver thread only
+    std::vector<std::shared_ptr<worker>> workers;
+    std::unordered_map<std::string, cached> cache;
+    std::map<std::string, std::vector<waiter>> waiting;  // queued or being resolved, by page
+    std::deque<std::string> queue;                       // pages no process has taken yet
+    bool stopping;
+
+    std::atomic<size_t> hits;
+    std::atomic<size_t> resolved;
+
+    std::thread thread;
+
+    std::shared_ptr<worker> start();
+    void dispatch();
+    void send(const std::shared_ptr<worker> &w);
+    void read_reply(const std::shared_ptr<worker> &w);
+    void on_reply(const std::shared_ptr<worker> &w, const boost::system::error_code &ec,
+                  size_t length);
+    void fail(worker &w, const boost::system::error_code &ec);
+    void stop(worker &w);
+    void remember(const std::string &page_url, const stream &s);
+    void finish(const std::string &page_url, const boost::system::error_code &ec, const stream &s);
+};
+
+#endif
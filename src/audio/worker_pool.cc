@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <boost/asio/post.hpp>
+#include <cassert>
+#include <iostream>
+
+#include "audio/worker_pool.h"
+
+audio_stream::audio_stream(std::shared_ptr<audio_source> source, boost::asio::io_context &ctx)
+    : source{std::move(source)}
+    , ctx{ctx}
+    , generation{0}
+    , seek_position{0}
+    , cancelled{false}
+    , handed_out{0}
+    , produced_generation{0}
+    , finished{false}
+{
+}
+
+opus_frame *audio_stream::next()
+{
+    auto current = generation.load(std::memory_order_relaxed);
+    while (auto *queued = frames.at(handed_out)) {
+        handed_out++;
+        if (queued->generation == current)
+            return &queued->frame;
+
+        // Encoded before a seek, given back without being sent
+        release(&queued->frame);
+    }
+    return nullptr;
+}
+
+void audio_stream::release(opus_frame *frame)
+{
+    auto *queued = reinterpret_cast<queued_frame *>(frame);
+    assert(!queued->released);
+    queued->released = true;
+
+    // Slots go back to the worker in queue order, a send still in flight holds up those behind it
+    while (handed_out > 0 && frames.front()->released) {
+        frames.pop();
+        handed_out--;
+    }
+}
+
+void audio_stream::unget(opus_frame *frame)
+{
+    assert(handed_out > 0 && &frames.at(handed_out - 1)->frame == frame);
+    (void) frame;
+    handed_out--;
+}
+
+void audio_stream::seek(std::chrono::milliseconds position)
+{
+    // The worker seeks the source itself the next time it looks at this stream, everything encoded
+    // before that is dropped by next()
+    auto lock = std::lock_guard<std::mutex>{seek_mutex};
+    seek_position = position;
+    generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+void audio_stream::cancel()
+{
+    cancelled = true;
+    // Anything still queued is dropped unsent
+    generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t audio_stream::buffered() const
+{
+    return frames.size();
+}
+
+// Encodes frames until the queue is full or the source has nothing more yet. Returns whether any
+// frame was queued
+bool audio_stream::produce()
+{
+    if (cancelled)
+        return false;
+
+    if (generation.load(std::memory_order_relaxed) != produced_generation) {
+        auto position = std::chrono::milliseconds{};
+        {
+            auto seek_lock = std::lock_guard<std::mutex>{seek_mutex};
+            position = seek_position;
+            produced_generation = generation.load(std::memory_order_relaxed);
+        }
+        finished = false;
+        if (source->seek(position))
+            std::cout << "[audio worker] seeked to " << position.count() << " ms\n";
+        else
+            std::cerr << "[audio worker] could not seek to " << position.count() << " ms\n";
+    }
+
+    auto produced = false;
+    while (!finished && !cancelled) {
+        auto *slot = frames.acquire();
+        if (!slot)
+            break;
+
+        auto &frame = slot->frame;
+        try {
+            source->next(frame);
+        } catch (std::exception &e) {
+            std::cerr << "[audio worker] error reading source: " << e.what() << "\n";
+            frame.clear();
+            frame.end_of_source = true;
+        }
+
+        // Cancelled while the source was read, which can take a while for a stream, nobody takes
+        // this frame any more
+        if (cancelled)
+            break;
+
+        // Data from the source not yet available, try again on the next pass
+        if (frame.empty() && !frame.end_of_source)
+            break;
+
+        slot->generation = produced_generation;
+        slot->released = false;
+        finished = frame.end_of_source;
+        frames.publish();
+        produced = true;
+    }
+    return produced;
+}
+
+void audio_stream::release_source()
+{
+    // Sources own io objects like youtube-dl's pipe, destroy them on the io thread
+    boost::asio::post(ctx, [source = std::move(source)] {});
+}
+
+audio_worker_pool::audio_worker_pool(size_t threads) : stopping{false}
+{
+    // By default, one worker for every core not taken by the io thread
+    if (threads == 0)
+        threads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+    for (auto i = size_t{0}; i < threads; ++i)
+        workers.push_back(std::make_unique<worker>());
+    for (auto i = size_t{0}; i < threads; ++i)
+        workers[i]->thread = std::thread{[this, i] { run(i); }};
+
+    std::cout << "[audio worker] started " << threads << " worker threads\n";
+}
+
+audio_worker_pool::~audio_worker_pool()
+{
+    stopping = true;
+    for (auto &w : workers) {
+        {
+            auto lock = std::lock_guard<std::mutex>{w->mutex};
+        }
+        w->wake.notify_one();
+    }
+    for (auto &w : workers)
+        w->thread.join();
+}
+
+std::shared_ptr<audio_stream> audio_worker_pool::attach(std::shared_ptr<audio_source> source,
+                                                        boost::asio::io_context &ctx)
+{
+    auto stream = std::make_shared<audio_stream>(std::move(source), ctx);
+
+    // Least busy over the last second. Loads within 1% of each other count as equal and the worker
+    // with fewer streams wins, which also spreads streams attached within the same second
+    auto least_loaded = [](const auto &a, const auto &b) {
+        auto load_a = a->load_permille.load() / 10;
+        auto load_b = b->load_permille.load() / 10;
+        if (load_a != load_b)
+            return load_a < load_b;
+        return a->stream_count.load() < b->stream_count.load();
+    };
+    auto &w = **std::min_element(workers.begin(), workers.end(), least_loaded);
+
+    w.stream_count++;
+    {
+        auto lock = std::lock_guard<std::mutex>{w.mutex};
+        w.incoming.push_back(stream);
+    }
+    w.wake.notify_one();
+    return stream;
+}
+
+std::vector<double> audio_worker_pool::utilization() const
+{
+    auto result = std::vector<double>{};
+    for (auto &w : workers)
+        result.push_back(w->load_permille.load() / 1000.0);
+    return result;
+}
+
+void audio_worker_pool::run(size_t index)
+{
+    using namespace std::chrono;
+    auto &w = *workers[index];
+    auto window_start = steady_clock::now();
+    auto last_report = window_start;
+    auto busy = steady_clock::duration{0};
+
+    for (;;) {
+        {
+            auto lock = std::lock_guard<std::mutex>{w.mutex};
+            if (stopping)
+                return;
+            std::move(w.incoming.begin(), w.incoming.end(), std::back_inserter(w.streams));
+            w.incoming.clear();
+        }
+
+        auto start = steady_clock::now();
+        auto produced = false;
+        for (auto &stream : w.streams)
+            produced |= stream->produce();
+        auto end = steady_clock::now();
+        busy += end - start;
+
+        // Streams the voice context is done with
+        auto done = std::remove_if(w.streams.begin(), w.streams.end(), [](auto &stream) {
+            if (!stream->cancelled)
+                return false;
+            stream->release_source();
+            return true;
+        });
+        w.stream_count -= std::distance(done, w.streams.end());
+        w.streams.erase(done, w.streams.end());
+
+        if (end - window_start >= load_window) {
+            w.load_permille = static_cast<uint32_t>(busy * 1000 / (end - window_start));
+            busy = busy.zero();
+            window_start = end;
+
+            if (end - last_report >= report_interval && !w.streams.empty()) {
+                std::cout << "[audio worker " << index << "] " << w.streams.size() << " streams, "
+                          << w.load_permille / 10.0 << "% busy\n";
+                last_report = end;
+            }
+        }
+
+        // Every queue is full or waiting on its source, check back shortly
+        if (!produced) {
+            auto lock = std::unique_lock<std::mutex>{w.mutex};
+            w.wake.wait_for(lock, idle_wait, [&] { return stopping || !w.incoming.empty(); });
+        }
+    }
+}
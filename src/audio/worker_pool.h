@@ -0,0 +1,117 @@
+#ifndef AUDIO_WORKER_POOL_H
+#define AUDIO_WORKER_POOL_H
+
+#include <atomic>
+#include <boost/asio/io_context.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "audio/source.h"
+#include "spsc_queue.h"
+
+// Frames of one playing source, encoded ahead of time by a worker thread. The worker is the only
+// producer and the io thread sending the frames the only consumer
+class audio_stream
+{
+public:
+    // Frames encoded ahead of playback, 8 frames are 160 ms of audio
+    static constexpr size_t lookahead = 8;
+
+    audio_stream(std::shared_ptr<audio_source> source, boost::asio::io_context &ctx);
+
+    // io thread side. next() hands out the next frame to send, nullptr if the worker has not
+    // caught up yet. The frame's slot belongs to the caller, who sends the packet straight from
+    // it, until release(frame). Frames may be released in any order; a slot is reused once it and
+    // every slot before it are released
+    opus_frame *next();
+    void release(opus_frame *frame);
+
+    // Puts back the frame next() handed out last, unreleased and unchanged, next() hands it out
+    // again
+    void unget(opus_frame *frame);
+    void seek(std::chrono::milliseconds position);
+
+    // Doesn't wait for the worker, which drops the source the next time it looks at this stream.
+    // A frame being encoded meanwhile still uses the source, so sources share what they need
+    // instead of referring to their voice context
+    void cancel();
+    size_t buffered() const;
+
+private:
+    friend class audio_worker_pool;
+
+    struct queued_frame {
+        opus_frame frame;
+        uint32_t generation;
+        bool released;  // handed out and given back, io thread side
+    };
+
+    std::shared_ptr<audio_source> source;
+    boost::asio::io_context &ctx;
+    discord::spsc_queue<queued_frame, lookahead> frames;
+
+    // Bumped by every seek, frames encoded for an older generation are dropped unsent
+    std::atomic<uint32_t> generation;
+    std::mutex seek_mutex;
+    std::chrono::milliseconds seek_position;
+
+    std::atomic<bool> cancelled;
+
+    // io thread side, slots at the front of the queue handed out by next(), released or not
+    size_t handed_out;
+
+    // Worker side
+    uint32_t produced_generation;
+    bool finished;
+
+    bool produce();
+    void release_source();
+};
+
+// Threads that decode, resample and encode for every playing guild, so the io thread only has to
+// send finished frames and one slow source can't hold up another guild's timer. Each stream stays
+// on one worker, new streams go to the least loaded one
+class audio_worker_pool
+{
+public:
+    explicit audio_worker_pool(size_t threads);
+    ~audio_worker_pool();
+    audio_worker_pool(const audio_worker_pool &) = delete;
+    audio_worker_pool &operator=(const audio_worker_pool &) = delete;
+
+    std::shared_ptr<audio_stream> attach(std::shared_ptr<audio_source> source,
+                                         boost::asio::io_context &ctx);
+
+    // Fraction of the last second each worker spent producing frames, in [0, 1]
+    std::vector<double> utilization() const;
+
+private:
+    // How long an idle worker sleeps before checking its streams again. Well below the 20 ms a
+    // frame lasts, so a queue that was full has room again by the time the worker looks
+    static constexpr auto idle_wait = std::chrono::milliseconds(5);
+    static constexpr auto load_window = std::chrono::seconds(1);
+    static constexpr auto report_interval = std::chrono::seconds(60);
+
+    struct worker {
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::vector<std::shared_ptr<audio_stream>> incoming;  // guarded by mutex
+
+        std::vector<std::shared_ptr<audio_stream>> streams;  // worker thread only
+        std::atomic<size_t> stream_count{0};
+        std::atomic<uint32_t> load_permille{0};
+    };
+
+    std::vector<std::unique_ptr<worker>> workers;
+    std::atomic<bool> stopping;
+
+    void run(size_t index);
+};
+
+#endif
@@ -1,65 +1,238 @@
+#include <algorithm>
 #include <boost/asio/post.hpp>
 #include <boost/asio/read.hpp>
+#include <boost/process/args.hpp>
 #include <boost/process/io.hpp>
+#include <boost/process/search_path.hpp>
 #include <iostream>
+#include <utility>
 
 #include "audio/youtube_dl.h"
 
 static const auto channels = 2;
 
-youtube_dl_source::youtube_dl_source(discord::voice_context &voice_context, const std::string &url)
-    : voice_context{voice_context}, pipe{voice_context.get_io_context()}, url{url}
+youtube_dl_source::youtube_dl_source(discord::voice_context &voice_context, std::string url)
+    : ctx{voice_context.get_io_context()}
+    , voice_context{voice_context.weak_from_this()}
+    , resolver{voice_context.get_resolver()}
+    , encoder{voice_context.get_encoder()}
+    , pipe{ctx}
+    , download{0}
+    , input_buffer_bytes{voice_context.get_options().input_buffer_bytes}
+    , input{std::make_unique<stream_buffer>(input_buffer_bytes)}
+    , decoder{std::make_unique<float_audio_decoder>(*input)}
+    , restart{restart_state::none}
+    , seek_position{0}
+    , seek_pending{false}
+    , url{std::move(url)}
+    , fetching_resolved{false}
 {
+    // Playback has to start before the input ring fills up, or the download would stall
+    const auto &opts = voice_context.get_options();
+    prebuffer_size = std::min(opts.prebuffer_bytes, opts.input_buffer_bytes - buffer.size());
 }
 
-opus_frame youtube_dl_source::next()
+void youtube_dl_source::next(opus_frame &frame)
 {
-    return next_frame(decoder, voice_context.get_encoder(), buffer.data(), buffer.size());
+    using namespace std::chrono;
+    auto state = restart.load(std::memory_order_acquire);
+    if (state == restart_state::restarting) {
+        // Nothing to play until the new download is open, the worker tries again later
+        frame.clear();
+        return;
+    }
+    if (seek_pending && state == restart_state::none) {
+        // Reads through the new download up to the position, waiting on it as it arrives
+        seek_pending = false;
+        if (!decoder->seek(seek_position)) {
+            std::cerr << "[youtube-dl source] could not seek to " << seek_position.count()
+                      << " ms\n";
+            state = restart_state::failed;
+        }
+    }
+    if (state == restart_state::failed) {
+        frame.clear();
+        frame.end_of_source = true;
+    } else {
+        next_frame(*decoder, *encoder, buffer.data(), buffer.size(), frame);
+    }
+
+    if (!first_audio && !frame.empty()) {
+        first_audio = true;
+        auto ms = duration_cast<milliseconds>(steady_clock::now() - start_time).count();
+        std::cout << "[youtube-dl source] time to first audio " << ms << " ms ("
+                  << bytes_sent_to_decoder / 1024 << " KiB downloaded)\n";
+    }
+    if (frame.end_of_source) {
+        std::cout << "[youtube-dl source] peak buffer size " << input->peak() / 1024 << " KiB\n";
+        // The ring is written on the io thread, which stops reading the pipe before freeing it
+        boost::asio::post(ctx, [weak = weak_from_this()] {
+            if (auto self = weak.lock()) {
+                auto be = boost::system::error_code{};
+                self->pipe.close(be);
+                self->input->clear();
+            }
+        });
+    }
+}
+
+bool youtube_dl_source::seek(std::chrono::milliseconds position)
+{
+    auto state = restart.load(std::memory_order_acquire);
+    if (state == restart_state::none && decoder->seek(position))
+        return true;
+
+    // Further back than the input ring still reaches, or the download is starting over already
+    seek_position = position;
+    seek_pending = true;
+    if (state != restart_state::restarting) {
+        std::cout << "[youtube-dl source] " << position.count()
+                  << " ms is not buffered any more, starting the download over\n";
+        restart.store(restart_state::restarting, std::memory_order_release);
+        boost::asio::post(ctx, [weak = weak_from_this()] {
+            if (auto self = weak.lock())
+                self->restart_download();
+        });
+    }
+    return true;
 }
 
 void youtube_dl_source::prepare()
 {
-    make_process(url);
+    start_time = std::chrono::steady_clock::now();
+    if (!resolver) {
+        fall_back_to_youtube_dl();
+        return;
+    }
+    resolver->resolve(url, ctx,
+                      [weak = weak_from_this()](const auto &ec, const auto &s) {
+                          if (auto self = weak.lock())
+                              self->on_resolved(ec, s);
+                      });
 }
 
-void youtube_dl_source::make_process(const std::string &url)
+// The media URL is fetched as it is, the resolver already did what youtube-dl would have
+void youtube_dl_source::on_resolved(const boost::system::error_code &ec,
+                                    const stream_resolver::stream &s)
 {
-    namespace bp = boost::process;
+    if (ec) {
+        std::cerr << "[youtube-dl source] could not resolve " << url << ": " << ec.message()
+                  << "\n";
+        fall_back_to_youtube_dl();
+        return;
+    }
+    std::cout << "[youtube-dl source] resolved " << url << " to format " << s.format << "\n";
+    fetching_resolved = true;
+    auto args = std::vector<std::string>{"-sfL"};
+    for (auto &[name, value] : s.headers) {
+        args.push_back("-H");
+        args.push_back(name + ": " + value);
+    }
+    args.push_back(s.url);
+    make_process("curl", args);
+}
+
+void youtube_dl_source::fall_back_to_youtube_dl()
+{
+    fetching_resolved = false;
     // Formats at https://github.com/rg3/youtube-dl/blob/master/youtube_dl/extractor/youtube.py
     // Prefer opus, vorbis, aac
-    child = bp::child{"youtube-dl -f 250/251/249/171/172 -o - " + url,
+    make_process("youtube-dl", {"-f", "250/251/249/171/172", "-o", "-", url});
+}
+
+// The arguments are passed as they are, none of them goes through a shell or gets split
+void youtube_dl_source::make_process(std::string program, std::vector<std::string> args)
+{
+    namespace bp = boost::process;
+    this->program = std::move(program);
+    this->args = std::move(args);
+    // A fallback or a restart runs after a process that already used the pipe up
+    pipe = bp::async_pipe{ctx};
+    child = bp::child{bp::search_path(this->program), bp::args(this->args),
                       bp::std_in<bp::null, bp::std_err> bp::null, bp::std_out > pipe};
+    download++;
     notified = false;
+    first_audio = false;
     bytes_sent_to_decoder = 0;
 
     std::cout << "[youtube-dl source] created process for " << url << "\n";
-    read_from_pipe({}, 0);
+    read_from_pipe(download, {}, 0);
+}
+
+// Runs the last process again from the start of the track, into a new input ring and decoder
+void youtube_dl_source::restart_download()
+{
+    auto be = boost::system::error_code{};
+    auto se = std::error_code{};
+    pipe.close(be);
+    child.terminate(se);
+
+    // The decoder reads from the ring, it goes first
+    decoder.reset();
+    input = std::make_unique<stream_buffer>(input_buffer_bytes);
+    decoder = std::make_unique<float_audio_decoder>(*input);
+    start_time = std::chrono::steady_clock::now();
+    make_process(program, args);
 }
 
-void youtube_dl_source::read_from_pipe(const boost::system::error_code &e, size_t transferred)
+// Opens the decoder on what has been buffered so far and tells the voice context it can start
+// pulling frames. Returns false if the stream could not be opened
+bool youtube_dl_source::start_playback()
 {
+    decoder->check_stream();
+    notified = true;
+    auto error = decoder->ready() ? boost::system::error_code{}
+                                  : make_error_code(boost::system::errc::io_error);
+    if (restart.load(std::memory_order_relaxed) == restart_state::restarting) {
+        // Playing already, the worker takes the new decoder over from here
+        restart.store(error ? restart_state::failed : restart_state::none,
+                      std::memory_order_release);
+        return !error;
+    }
+    if (auto context = voice_context.lock())
+        context->notify_audio_source_ready(error);
+    return !error;
+}
+
+void youtube_dl_source::read_from_pipe(uint32_t from, const boost::system::error_code &e,
+                                       size_t transferred)
+{
+    // Playback ended and closed the pipe, the ring is gone. Or a restart replaced both
+    if (e == boost::asio::error::operation_aborted || from != download)
+        return;
+
     if (transferred > 0) {
-        // Commit any transferred data to the audio_file_data vector
-        decoder.feed(buffer.data(), transferred);
+        // Commit any transferred data to the decoder's input ring
+        input->write(buffer.data(), transferred);
         bytes_sent_to_decoder += transferred;
     }
-#if 0
-    if (!notified) {
-        if (bytes_sent_to_decoder >= 256 * 1024) {
-            decoder.check_stream();
-        }
-        if (decoder.ready()) {
-            notified = true;
-            voice_context.notify_audio_source_ready({});
+
+    // Enough is buffered to start playing, the rest of the download continues behind playback
+    if (!e && !notified && bytes_sent_to_decoder >= prebuffer_size) {
+        if (!start_playback()) {
+            auto be = boost::system::error_code{};
+            pipe.close(be);
+            return;
         }
     }
-#endif
+
     if (!e) {
-        auto pipe_read_cb = [weak = weak_from_this()](const auto &ec, size_t transferred) {
+        // The input ring is full, continue once the decoder has made room for another read
+        if (input->writable() < buffer.size()) {
+            input->when_writable(buffer.size(), [weak = weak_from_this(), &ctx = ctx, from]() {
+                boost::asio::post(ctx, [weak, from]() {
+                    if (auto self = weak.lock())
+                        self->read_from_pipe(from, {}, 0);
+                });
+            });
+            return;
+        }
+
+        auto pipe_read_cb = [weak = weak_from_this(), from](const auto &ec, size_t transferred) {
             if (auto self = weak.lock())
-                self->read_from_pipe(ec, transferred);
+                self->read_from_pipe(from, ec, transferred);
         };
-        // Read from the pipe and fill up the audio_file_data vector
+        // Read from the pipe and fill up the decoder's input buffer
         boost::asio::async_read(pipe, boost::asio::buffer(buffer), pipe_read_cb);
     } else if (e == boost::asio::error::eof) {
         std::cout << "[youtube-dl source] got eof from async_pipe\n";
@@ -75,18 +248,30 @@ void youtube_dl_source::read_from_pipe(const boost::system::error_code &e, size_
             std::cerr << "[youtube-dl source] error closing pipe: " << be.message() << "\n";
         if (se)
             std::cerr << "[youtube-dl source] error waiting for process: " << se.message() << "\n";
-        if (!notified) {
-            decoder.check_stream();
-            notified = true;
-            auto error = decoder.ready() ? boost::system::error_code{}
-                                         : make_error_code(boost::system::errc::io_error);
-            voice_context.notify_audio_source_ready(error);
+
+        // The media URL expired or was refused, youtube-dl gets a fresh one
+        if (fetching_resolved && bytes_sent_to_decoder == 0) {
+            std::cerr << "[youtube-dl source] nothing fetched for " << url
+                      << ", falling back to youtube-dl\n";
+            resolver->forget(url);
+            fall_back_to_youtube_dl();
+            return;
         }
+
+        input->finish();
+        if (!notified)
+            start_playback();
     } else {
         std::cerr << "[youtube-dl source] pipe read error: " << e.message() << "\n";
+
+        // Play whatever made it through before the error
+        input->finish();
         if (!notified) {
-            voice_context.notify_audio_source_ready(e);
             notified = true;
+            if (restart.load(std::memory_order_relaxed) == restart_state::restarting)
+                restart.store(restart_state::failed, std::memory_order_release);
+            else if (auto context = voice_context.lock())
+                context->notify_audio_source_ready(e);
         }
     }
 }
@@ -2,14 +2,21 @@
 #define AUDIO_SOURCE_YOUTUBE_DL_H
 
 #include <array>
+#include <atomic>
 #include <boost/asio/io_context.hpp>
 #include <boost/process/async_pipe.hpp>
 #include <boost/process/child.hpp>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "audio/decoding.h"
 #include "audio/opus_encoder.h"
 #include "audio/source.h"
+#include "audio/stream_buffer.h"
+#include "audio/stream_resolver.h"
 #include "callbacks.h"
 #include "voice/voice_connector.h"
 
@@ -17,25 +24,52 @@ class youtube_dl_source : public audio_source,
                           public std::enable_shared_from_this<youtube_dl_source>
 {
 public:
-    youtube_dl_source(discord::voice_context &voice_context, const std::string &url);
+    youtube_dl_source(discord::voice_context &voice_context, std::string url);
     virtual ~youtube_dl_source() = default;
-    virtual opus_frame next();
+    virtual void next(opus_frame &frame);
     virtual void prepare();
+    virtual bool seek(std::chrono::milliseconds position);
 
 private:
-    discord::voice_context &voice_context;
+    // A seek further back than the input ring reaches starts the download over. The worker leaves
+    // the decoder to the io thread until the new one is open, then seeks it
+    enum class restart_state { none, restarting, failed };
+
+    // A worker may still hold this after voice_context is gone, pending pipe reads and resolves
+    // only use what is kept here
+    boost::asio::io_context &ctx;
+    std::weak_ptr<discord::voice_context> voice_context;
+    stream_resolver *resolver;
+    std::shared_ptr<discord::opus_encoder> encoder;
     boost::process::child child;
     boost::process::async_pipe pipe;
+    std::string program;  // what make_process last ran, run again by a restart
+    std::vector<std::string> args;
+    uint32_t download;  // bumped by every process, reads of an older one are ignored
 
-    float_audio_decoder decoder;
+    size_t input_buffer_bytes;
+    std::unique_ptr<stream_buffer> input;
+    std::unique_ptr<float_audio_decoder> decoder;
     std::array<uint8_t, 8192> buffer;
-    int bytes_sent_to_decoder;
+    std::atomic<size_t> bytes_sent_to_decoder;  // also read by the audio worker
+    size_t prebuffer_size;
+
+    std::atomic<restart_state> restart;
+    std::chrono::milliseconds seek_position;  // worker side, where to go once restarted
+    bool seek_pending;
 
-    const std::string &url;
+    const std::string url;
+    bool fetching_resolved;  // from the media URL a resolver answered with, not youtube-dl
     bool notified;
+    bool first_audio;
+    std::chrono::steady_clock::time_point start_time;
 
-    void make_process(const std::string &url);
-    void read_from_pipe(const boost::system::error_code &e, size_t transferred);
+    void on_resolved(const boost::system::error_code &ec, const stream_resolver::stream &s);
+    void fall_back_to_youtube_dl();
+    void make_process(std::string program, std::vector<std::string> args);
+    void restart_download();
+    void read_from_pipe(uint32_t from, const boost::system::error_code &e, size_t transferred);
+    bool start_playback();
 };
 
 #endif
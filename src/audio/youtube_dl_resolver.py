@@ -0,0 +1,31 @@
+# Resolves page URLs into the URLs of their audio for the bot's stream_resolver. Reads {"url": ...}
+# one per line on stdin and answers each with {"url": ..., "format": ..., "protocol": ...,
+# "headers": {...}} or {"error": ...} on a line of stdout, until stdin closes. youtube-dl is loaded
+# once here, not for every track
+import json
+import sys
+
+import youtube_dl
+from youtube_dl.utils import determine_protocol
+
+# Prefer opus, vorbis, aac, see youtube_dl/extractor/youtube.py for the formats
+FORMATS = '250/251/249/171/172'
+
+
+def main():
+    ydl = youtube_dl.YoutubeDL({'format': FORMATS, 'quiet': True, 'no_warnings': True,
+                                'noplaylist': True})
+    for line in sys.stdin:
+        try:
+            info = ydl.extract_info(json.loads(line)['url'], download=False)
+            reply = {'url': info['url'], 'format': info.get('format_id', ''),
+                     'protocol': determine_protocol(info),
+                     'headers': info.get('http_headers', {})}
+        except Exception as e:
+            reply = {'error': str(e)}
+        sys.stdout.write(json.dumps(reply) + '\n')
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
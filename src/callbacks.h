@@ -4,11 +4,13 @@
 #include <boost/system/error_code.hpp>
 #include <functional>
 #include <json.hpp>
+#include <string_view>
 
 using data_cb = std::function<void(const boost::system::error_code &, const uint8_t *, size_t)>;
 using transfer_cb = std::function<void(const boost::system::error_code &, size_t)>;
 using error_cb = std::function<void(const boost::system::error_code &)>;
 using json_cb = std::function<void(const boost::system::error_code &, const nlohmann::json &)>;
+using message_cb = std::function<void(const boost::system::error_code &, std::string_view)>;
 using void_cb = std::function<void()>;
 
 void ignore_transfer(const boost::system::error_code &, size_t);
@@ -1,8 +1,29 @@
+#include <charconv>
+#include <stdexcept>
+
 #include "discord.h"
 
-static discord::snowflake make_snowflake(const std::string &s)
+discord::snowflake discord::make_snowflake(const nlohmann::json &json)
+{
+    if (json.is_null())
+        return 0;
+    if (!json.is_string())
+        return json.get<discord::snowflake>();
+
+    // Parsed in place, without the copy get<std::string>() would make
+    auto &s = json.get_ref<const std::string &>();
+    auto id = discord::snowflake{0};
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), id);
+    if (ec != std::errc{} || end != s.data() + s.size())
+        throw std::invalid_argument{"Invalid snowflake: " + s};
+    return id;
+}
+
+// The snowflake in field, 0 if there is none
+static discord::snowflake optional_snowflake(const nlohmann::json &json, const char *field)
 {
-    return static_cast<discord::snowflake>(std::stoull(s, nullptr, 10));
+    auto find = json.find(field);
+    return find != json.end() ? discord::make_snowflake(*find) : 0;
 }
 
 template<typename T>
@@ -27,7 +48,6 @@ std::string get_safe<std::string>(const nlohmann::json &json, const std::string
 }
 
 static std::string empty_string = "";
-static std::string zero_string = "0";
 
 bool discord::operator<(const discord::channel &lhs, const discord::channel &rhs)
 {
@@ -36,8 +56,8 @@ bool discord::operator<(const discord::channel &lhs, const discord::channel &rhs
 
 void discord::from_json(const nlohmann::json &json, discord::channel &c)
 {
-    c.id = make_snowflake(json.at("id").get<std::string>());
-    c.guild_id = make_snowflake(get_safe(json, "guild_id", zero_string));
+    c.id = make_snowflake(json.at("id"));
+    c.guild_id = optional_snowflake(json, "guild_id");
     c.user_limit = get_safe(json, "user-limit", 0);
     c.bitrate = get_safe(json, "bitrate", 0);
     c.type = json.at("type").get<discord::channel::channel_type>();
@@ -51,14 +71,24 @@ bool discord::operator<(const discord::guild &lhs, const discord::guild &rhs)
 
 void discord::from_json(const nlohmann::json &json, discord::guild &g)
 {
-    g.id = make_snowflake(json.at("id").get<std::string>());
-    g.owner = make_snowflake(get_safe(json, "owner_id", zero_string));
+    g.id = make_snowflake(json.at("id"));
+    g.owner = optional_snowflake(json, "owner_id");
     g.name = json.at("name").get<std::string>();
     g.region = json.at("region").get<std::string>();
     g.unavailable = json.at("unavailable").get<bool>();
-    g.members = json.at("members").get<std::set<discord::member>>();
-    g.channels = json.at("channels").get<std::set<discord::channel>>();
-    g.voice_states = get_safe<std::set<discord::voice_state>>(json, "voice_states", {});
+    g.members.clear();
+    g.channels.clear();
+    g.voice_states.clear();
+    for (auto &member : json.at("members"))
+        g.members.append(member.get<discord::member>());
+    for (auto &channel : json.at("channels"))
+        g.channels.append(channel.get<discord::channel>());
+    if (auto it = json.find("voice_states"); it != json.end() && it->is_array())
+        for (auto &voice_state : *it)
+            g.voice_states.append(voice_state.get<discord::voice_state>());
+    g.members.sort();
+    g.channels.sort();
+    g.voice_states.sort();
 }
 
 bool discord::operator<(const discord::member &lhs, const discord::member &rhs)
@@ -79,7 +109,7 @@ bool discord::operator<(const discord::user &lhs, const discord::user &rhs)
 
 void discord::from_json(const nlohmann::json &json, discord::user &u)
 {
-    u.id = make_snowflake(get_safe(json, "id", zero_string));
+    u.id = optional_snowflake(json, "id");
     u.discriminator = get_safe(json, "discriminator", empty_string);
     u.name = get_safe(json, "username", empty_string);
 }
@@ -91,8 +121,8 @@ bool discord::operator<(const discord::message &lhs, const discord::message &rhs
 
 void discord::from_json(const nlohmann::json &json, discord::message &m)
 {
-    m.id = make_snowflake(json.at("id").get<std::string>());
-    m.channel_id = make_snowflake(json.at("channel_id").get<std::string>());
+    m.id = make_snowflake(json.at("id"));
+    m.channel_id = make_snowflake(json.at("channel_id"));
     m.author = json.at("author").get<discord::user>();
     m.content = json.at("content").get<std::string>();
     m.type = json.at("type").get<discord::message::message_type>();
@@ -105,9 +135,9 @@ bool discord::operator<(const discord::voice_state &lhs, const discord::voice_st
 
 void discord::from_json(const nlohmann::json &json, discord::voice_state &v)
 {
-    v.guild_id = make_snowflake(get_safe(json, "guild_id", zero_string));
-    v.channel_id = make_snowflake(get_safe(json, "channel_id", zero_string));
-    v.user_id = make_snowflake(json.at("user_id").get<std::string>());
+    v.guild_id = optional_snowflake(json, "guild_id");
+    v.channel_id = optional_snowflake(json, "channel_id");
+    v.user_id = make_snowflake(json.at("user_id"));
     v.session_id = json.at("session_id").get<std::string>();
     v.deaf = get_safe(json, "deaf", false);
     v.mute = get_safe(json, "mute", false);
@@ -127,6 +157,7 @@ void discord::from_json(const nlohmann::json &json, discord::payload &p)
         p.sequence_num = -1;
         p.event_name = {};
     }
+    p.event = discord::to_gateway_event(p.event_name);
 }
 
 void discord::from_json(const nlohmann::json &json, discord::voice_payload &vp)
@@ -139,6 +170,8 @@ void discord::from_json(const nlohmann::json &json, discord::voice_ready &vr)
 {
     vr.ssrc = json.at("ssrc").get<uint32_t>();
     vr.port = json.at("port").get<uint16_t>();
+    if (json.count("modes"))
+        vr.modes = json.at("modes").get<std::vector<std::string>>();
 }
 
 void discord::from_json(const nlohmann::json &json, discord::voice_session &vs)
@@ -161,7 +194,7 @@ void discord::event::from_json(const nlohmann::json &json, discord::event::ready
 
 void discord::event::from_json(const nlohmann::json &json, discord::event::voice_server_update &v)
 {
-    v.guild_id = make_snowflake(json.at("guild_id").get<std::string>());
+    v.guild_id = make_snowflake(json.at("guild_id"));
     v.token = json.at("token").get<std::string>();
     v.endpoint = json.at("endpoint").get<std::string>();
 }
@@ -6,6 +6,9 @@
 
 #include <json.hpp>
 
+#include "gateway_event.h"
+#include "id_set.h"
+
 namespace discord
 {
 enum class gateway_op {
@@ -80,9 +83,9 @@ struct voice_state {
 struct guild {
     discord::snowflake id;
     discord::snowflake owner;
-    std::set<channel> channels;
-    std::set<member> members;
-    std::set<voice_state> voice_states;
+    discord::id_set<channel> channels;
+    discord::id_set<member> members;
+    discord::id_set<voice_state> voice_states;  // by user id
     std::string name;
     std::string region;
     bool unavailable;
@@ -109,6 +112,7 @@ struct payload {
     discord::gateway_op op;
     int sequence_num;
     std::string event_name;
+    discord::gateway_event event;
     nlohmann::json data;
 };
 
@@ -120,6 +124,7 @@ struct voice_payload {
 struct voice_ready {
     uint32_t ssrc;
     uint16_t port;
+    std::vector<std::string> modes;  // encryption modes the server supports
 };
 
 struct voice_session {
@@ -134,6 +139,25 @@ bool operator<(const discord::guild &lhs, const discord::guild &rhs);
 bool operator<(const discord::message &lhs, const discord::message &rhs);
 bool operator<(const discord::voice_state &lhs, const discord::voice_state &rhs);
 
+// The ids an id_set orders them by
+inline discord::snowflake id_of(const discord::channel &c)
+{
+    return c.id;
+}
+
+inline discord::snowflake id_of(const discord::member &m)
+{
+    return m.user.id;
+}
+
+inline discord::snowflake id_of(const discord::voice_state &v)
+{
+    return v.user_id;
+}
+
+// A snowflake as JSON text has it, a decimal string, or as ETF does, an integer. Null is 0
+discord::snowflake make_snowflake(const nlohmann::json &json);
+
 void from_json(const nlohmann::json &json, discord::channel &c);
 void from_json(const nlohmann::json &json, discord::user &u);
 void from_json(const nlohmann::json &json, discord::member &m);
@@ -0,0 +1,308 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "etf.h"
+
+namespace
+{
+enum tag : uint8_t {
+    new_float_ext = 70,
+    small_integer_ext = 97,
+    integer_ext = 98,
+    float_ext = 99,
+    atom_ext = 100,
+    small_tuple_ext = 104,
+    large_tuple_ext = 105,
+    nil_ext = 106,
+    string_ext = 107,
+    list_ext = 108,
+    binary_ext = 109,
+    small_big_ext = 110,
+    large_big_ext = 111,
+    small_atom_ext = 115,
+    map_ext = 116,
+    atom_utf8_ext = 118,
+    small_atom_utf8_ext = 119,
+    version = 131
+};
+
+// Reads terms front to back, integers in the format are big endian
+class etf_reader
+{
+public:
+    explicit etf_reader(std::string_view data)
+        : it{reinterpret_cast<const uint8_t *>(data.data())}, begin{it}, end{it + data.size()}
+    {
+    }
+
+    nlohmann::json term()
+    {
+        switch (u8()) {
+            case small_integer_ext:
+                return u8();
+            case integer_ext:
+                return static_cast<int32_t>(u32());
+            case new_float_ext: {
+                auto bits = u64();
+                auto value = 0.0;
+                std::memcpy(&value, &bits, sizeof value);
+                return value;
+            }
+            case float_ext:
+                return std::strtod(std::string{bytes(31)}.c_str(), nullptr);
+            case atom_ext:
+            case atom_utf8_ext:
+                return atom(bytes(u16()));
+            case small_atom_ext:
+            case small_atom_utf8_ext:
+                return atom(bytes(u8()));
+            case small_tuple_ext:
+                return elements(u8());
+            case large_tuple_ext:
+                return elements(u32());
+            case nil_ext:
+                return nlohmann::json::array();
+            case string_ext: {
+                // A list of small integers, packed one byte each
+                auto array = nlohmann::json::array();
+                for (auto c : bytes(u16()))
+                    array.push_back(static_cast<uint8_t>(c));
+                return array;
+            }
+            case list_ext: {
+                auto array = elements(u32());
+                auto tail = term();
+                if (!tail.is_array() || !tail.empty())
+                    array.push_back(std::move(tail));
+                return array;
+            }
+            case binary_ext:
+                return std::string{bytes(u32())};
+            case small_big_ext:
+                return big(u8());
+            case large_big_ext:
+                return big(u32());
+            case map_ext:
+                return map(u32());
+            default:
+                fail("unsupported term");
+        }
+    }
+
+    bool done() const
+    {
+        return it == end;
+    }
+
+    uint8_t u8()
+    {
+        need(1);
+        return *it++;
+    }
+
+private:
+    const uint8_t *it;
+    const uint8_t *begin;
+    const uint8_t *end;
+
+    [[noreturn]] void fail(const char *what) const
+    {
+        throw discord::etf_error{std::string{what} + " at offset " + std::to_string(it - begin)};
+    }
+
+    void need(size_t n) const
+    {
+        if (static_cast<size_t>(end - it) < n)
+            fail("unexpected end");
+    }
+
+    uint16_t u16()
+    {
+        need(2);
+        auto value = static_cast<uint16_t>(it[0] << 8 | it[1]);
+        it += 2;
+        return value;
+    }
+
+    uint32_t u32()
+    {
+        need(4);
+        auto value = uint32_t{it[0]} << 24 | uint32_t{it[1]} << 16 | uint32_t{it[2]} << 8 | it[3];
+        it += 4;
+        return value;
+    }
+
+    uint64_t u64()
+    {
+        auto high = uint64_t{u32()};
+        return high << 32 | u32();
+    }
+
+    std::string_view bytes(size_t n)
+    {
+        need(n);
+        auto view = std::string_view{reinterpret_cast<const char *>(it), n};
+        it += n;
+        return view;
+    }
+
+    static nlohmann::json atom(std::string_view name)
+    {
+        if (name == "nil" || name == "null")
+            return nullptr;
+        if (name == "true")
+            return true;
+        if (name == "false")
+            return false;
+        return std::string{name};
+    }
+
+    nlohmann::json elements(size_t n)
+    {
+        auto array = nlohmann::json::array();
+        for (auto i = size_t{0}; i < n; ++i)
+            array.push_back(term());
+        return array;
+    }
+
+    // Digits little endian after a sign byte, snowflakes take 8 of them
+    nlohmann::json big(size_t n)
+    {
+        auto negative = u8() != 0;
+        if (n > 8)
+            fail("integer too big");
+        auto digits = bytes(n);
+        auto value = uint64_t{0};
+        for (auto i = n; i-- > 0;)
+            value = value << 8 | static_cast<uint8_t>(digits[i]);
+        if (!negative)
+            return value;
+        if (value > uint64_t{INT64_MAX} + 1)
+            fail("integer too big");
+        return static_cast<int64_t>(0 - value);
+    }
+
+    nlohmann::json map(size_t n)
+    {
+        auto object = nlohmann::json::object();
+        for (auto i = size_t{0}; i < n; ++i) {
+            auto key = term();
+            auto name = key.is_string() ? key.get<std::string>() : key.dump();
+            object[name] = term();
+        }
+        return object;
+    }
+};
+
+void put_u32(std::string &out, uint32_t value)
+{
+    for (auto shift = 24; shift >= 0; shift -= 8)
+        out += static_cast<char>(value >> shift);
+}
+
+void put_atom(std::string &out, std::string_view name)
+{
+    out += static_cast<char>(small_atom_utf8_ext);
+    out += static_cast<char>(name.size());
+    out += name;
+}
+
+void put_binary(std::string &out, std::string_view s)
+{
+    out += static_cast<char>(binary_ext);
+    put_u32(out, static_cast<uint32_t>(s.size()));
+    out += s;
+}
+
+void put_integer(std::string &out, uint64_t magnitude, bool negative)
+{
+    if (!negative && magnitude < 256) {
+        out += static_cast<char>(small_integer_ext);
+        out += static_cast<char>(magnitude);
+    } else if (magnitude <= (negative ? uint64_t{1} << 31 : uint64_t{INT32_MAX})) {
+        out += static_cast<char>(integer_ext);
+        put_u32(out, static_cast<uint32_t>(negative ? 0 - magnitude : magnitude));
+    } else {
+        out += static_cast<char>(small_big_ext);
+        auto size_at = out.size();
+        out += '\0';
+        out += static_cast<char>(negative);
+        auto n = 0;
+        for (; magnitude != 0; magnitude >>= 8, ++n)
+            out += static_cast<char>(magnitude & 0xff);
+        out[size_at] = static_cast<char>(n);
+    }
+}
+
+void put_term(std::string &out, const nlohmann::json &json)
+{
+    switch (json.type()) {
+        case nlohmann::json::value_t::null:
+            put_atom(out, "nil");
+            break;
+        case nlohmann::json::value_t::boolean:
+            put_atom(out, json.get<bool>() ? "true" : "false");
+            break;
+        case nlohmann::json::value_t::number_unsigned:
+            put_integer(out, json.get<uint64_t>(), false);
+            break;
+        case nlohmann::json::value_t::number_integer: {
+            auto value = json.get<int64_t>();
+            auto magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : value;
+            put_integer(out, magnitude, value < 0);
+            break;
+        }
+        case nlohmann::json::value_t::number_float: {
+            auto value = json.get<double>();
+            auto bits = uint64_t{0};
+            std::memcpy(&bits, &value, sizeof bits);
+            out += static_cast<char>(new_float_ext);
+            put_u32(out, static_cast<uint32_t>(bits >> 32));
+            put_u32(out, static_cast<uint32_t>(bits));
+            break;
+        }
+        case nlohmann::json::value_t::string:
+            put_binary(out, json.get_ref<const std::string &>());
+            break;
+        case nlohmann::json::value_t::array:
+            if (!json.empty()) {
+                out += static_cast<char>(list_ext);
+                put_u32(out, static_cast<uint32_t>(json.size()));
+                for (auto &element : json)
+                    put_term(out, element);
+            }
+            out += static_cast<char>(nil_ext);
+            break;
+        case nlohmann::json::value_t::object:
+            out += static_cast<char>(map_ext);
+            put_u32(out, static_cast<uint32_t>(json.size()));
+            for (auto it = json.begin(); it != json.end(); ++it) {
+                put_binary(out, it.key());
+                put_term(out, it.value());
+            }
+            break;
+        default:
+            throw discord::etf_error{"unsupported JSON value"};
+    }
+}
+}  // namespace
+
+nlohmann::json discord::etf_decode(std::string_view data)
+{
+    auto reader = etf_reader{data};
+    if (reader.u8() != version)
+        throw discord::etf_error{"unsupported format version"};
+    auto json = reader.term();
+    if (!reader.done())
+        throw discord::etf_error{"data after the term"};
+    return json;
+}
+
+std::string discord::etf_encode(const nlohmann::json &json)
+{
+    auto out = std::string{};
+    out += static_cast<char>(version);
+    put_term(out, json);
+    return out;
+}
@@ -0,0 +1,27 @@
+#ifndef DISCORD_ETF_H
+#define DISCORD_ETF_H
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <json.hpp>
+
+namespace discord
+{
+struct etf_error : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// The Erlang external term format the gateway speaks with encoding=etf, to and from the JSON
+// documents the rest of the bot reads. Binaries and strings become strings, maps objects, lists
+// and tuples arrays, the atoms nil, true and false null and booleans, and other atoms their name.
+// Integers stay integers, so snowflakes arrive as numbers rather than decimal strings. Throws
+// etf_error on data it can't read
+nlohmann::json etf_decode(std::string_view data);
+
+// Strings go out as binaries and objects as maps with binary keys, the way Discord expects them
+std::string etf_encode(const nlohmann::json &json);
+}  // namespace discord
+
+#endif
@@ -1,7 +1,11 @@
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 
 #include "errors.h"
+#include "etf.h"
 #include "gateway.h"
+#include "payload_scanner.h"
 #include "voice/voice_connector.h"
 #include "voice/voice_gateway.h"
 
@@ -20,39 +24,101 @@ static void check_quit(discord::gateway *gateway, boost::asio::io_context &ctx,
     }
 }
 
-discord::gateway::gateway(boost::asio::io_context &ctx, ssl::context &tls, const std::string &token,
-                          discord::connection &c)
-    : conn{c}, beater{ctx}, token{token}, state{connection_state::disconnected}
+// The URL with its query parameter name set to value, replacing what it was set to
+static std::string with_query(std::string url, std::string_view name, std::string_view value)
 {
-    event_to_handler.emplace("READY", [&](const auto &json) { on_ready(json); });
-    event_to_handler.emplace("RESUME", [&](const auto &) { state = connection_state::connected; });
+    auto query = url.find('?');
+    if (query == std::string::npos) {
+        url += '?';
+    } else {
+        for (auto at = query + 1; at < url.size();) {
+            auto next = std::min(url.find('&', at), url.size());
+            auto param = std::string_view{url}.substr(at, next - at);
+            if (param.substr(0, name.size()) == name && param.substr(name.size(), 1) == "=") {
+                url.replace(at + name.size() + 1, next - at - name.size() - 1, value);
+                return url;
+            }
+            at = next + 1;
+        }
+        if (url.back() != '?' && url.back() != '&')
+            url += '&';
+    }
+    url.append(name).append("=").append(value);
+    return url;
+}
+
+discord::gateway::gateway(boost::asio::io_context &ctx, const discord::options &opts,
+                          discord::connection &c,
+                          std::shared_ptr<discord::voice_connector> connector, size_t shard_id,
+                          size_t shard_count)
+    : opts{opts}
+    , conn{c}
+    , store{opts.member_cache}
+    , beater{ctx}
+    , voice{std::move(connector)}
+    , token{opts.token}
+    , user_id{0}
+    , seq_num{0}
+    , shard_id{shard_id}
+    , shard_count{shard_count}
+    , state{connection_state::disconnected}
+    , etf{opts.gateway_encoding == "etf"}
+{
+    // Discord takes 120 commands a minute, heartbeats included. A burst of 10 and one more every
+    // 60/105 s is at most 115 in any minute, leaving room for heartbeats, which skip the limit
+    conn.set_rate_limit(10, std::chrono::milliseconds(60000) / 105);
+
+    on_event(gateway_event::ready, [&](const auto &json) { on_ready(json); });
+    on_event(gateway_event::resumed, [&](const auto &) { state = connection_state::connected; });
 
     // gateway_store events
-    event_to_handler.emplace("GUILD_CREATE", [&](const auto &json) { store.guild_create(json); });
-    event_to_handler.emplace("CHANNEL_CREATE",
-                             [&](const auto &json) { store.channel_create(json); });
-    event_to_handler.emplace("CHANNEL_UPDATE",
-                             [&](const auto &json) { store.channel_update(json); });
-    event_to_handler.emplace("CHANNEL_DELETE",
-                             [&](const auto &json) { store.channel_delete(json); });
-    event_to_handler.emplace("VOICE_STATE_UPDATE",
-                             [&](const auto &json) { store.voice_state_update(json); });
-
-    auto handler = std::make_shared<voice_connector>(ctx, tls, *this);
-    event_to_handler.emplace("VOICE_STATE_UPDATE",
-                             [handler](const auto &json) { handler->on_voice_state_update(json); });
-    event_to_handler.emplace("VOICE_SERVER_UPDATE", [handler](const auto &json) {
-        handler->on_voice_server_update(json);
+    auto on_guild_create = [this](discord::snowflake guild_id) {
+        // Members come only on request then, the bot wants the ones already in voice
+        if (guild_id != 0 && store.lazy_members())
+            request_guild_members(guild_id, store.uncached_voice_members(guild_id));
+    };
+    // ETF arrives decoded already, only JSON text can be read without a document
+    if (etf)
+        on_event(gateway_event::guild_create, [this, on_guild_create](const auto &json) {
+            on_guild_create(store.guild_create(json));
+        });
+    else
+        event_to_raw_handler[static_cast<size_t>(gateway_event::guild_create)] =
+            [this, on_guild_create](auto json) { on_guild_create(store.guild_create(json)); };
+    on_event(gateway_event::channel_create, [&](const auto &json) { store.channel_create(json); });
+    on_event(gateway_event::channel_update, [&](const auto &json) { store.channel_update(json); });
+    on_event(gateway_event::channel_delete, [&](const auto &json) { store.channel_delete(json); });
+    on_event(gateway_event::voice_state_update,
+             [&](const auto &json) { store.voice_state_update(json); });
+    on_event(gateway_event::guild_members_chunk,
+             [&](const auto &json) { store.guild_members_chunk(json); });
+    on_event(gateway_event::guild_member_add,
+             [&](const auto &json) { store.guild_member_add(json); });
+    on_event(gateway_event::guild_member_update,
+             [&](const auto &json) { store.guild_member_update(json); });
+    on_event(gateway_event::guild_member_remove,
+             [&](const auto &json) { store.guild_member_remove(json); });
+    on_event(gateway_event::message_create, [&](const auto &json) { store.message_create(json); });
+
+    // Voice events of a guild come in on its shard, replies have to go out on it too
+    on_event(gateway_event::voice_state_update, [this](const auto &json) {
+        voice->on_voice_state_update(*this, json);
     });
-    event_to_handler.emplace("MESSAGE_CREATE",
-                             [handler](const auto &json) { handler->on_message_create(json); });
-    event_to_handler.emplace("MESSAGE_CREATE",
-                             [this, &ctx](const auto &json) { check_quit(this, ctx, json); });
+    on_event(gateway_event::voice_server_update, [this](const auto &json) {
+        voice->on_voice_server_update(*this, json);
+    });
+    on_event(gateway_event::message_create,
+             [this](const auto &json) { voice->on_message_create(*this, json); });
+    on_event(gateway_event::message_create,
+             [this, &ctx](const auto &json) { check_quit(this, ctx, json); });
 }
 
 void discord::gateway::run()
 {
-    conn.connect("wss://gateway.discord.gg/?v=6&encoding=json",
+    auto url = with_query(opts.gateway_url, "encoding", opts.gateway_encoding);
+    if (opts.gateway_compression)
+        url = with_query(std::move(url), "compress", "zlib-stream");
+    conn.connect(url,
                  [weak = weak_from_this()](const auto &ec) {
                      if (auto self = weak.lock()) {
                          if (ec) {
@@ -67,19 +133,43 @@ void discord::gateway::run()
 void discord::gateway::disconnect()
 {
     state = connection_state::disconnected;
+    if (auto *inflater = conn.compression(); inflater && inflater->compressed_bytes() > 0) {
+        using std::chrono::duration_cast;
+        using std::chrono::milliseconds;
+        std::cout << "[gateway] inflated " << inflater->inflated_bytes() / 1024 << " KiB from "
+                  << inflater->compressed_bytes() / 1024 << " KiB, ratio "
+                  << static_cast<double>(inflater->inflated_bytes()) / inflater->compressed_bytes()
+                  << ", " << duration_cast<milliseconds>(inflater->inflate_time()).count()
+                  << " ms CPU\n";
+    }
     conn.disconnect();
-    event_to_handler.clear();
+    for (auto &handlers : event_to_handlers)
+        handlers.clear();
+    event_to_raw_handler = {};
 }
 
 void discord::gateway::heartbeat()
 {
     auto json = nlohmann::json{{"op", static_cast<int>(gateway_op::heartbeat)}, {"d", seq_num}};
-    send(json.dump(), ignore_transfer);
+    conn.send_heartbeat(etf ? discord::etf_encode(json) : json.dump(), ignore_transfer);
+
+    // Whether the rate limit held commands back since the last heartbeat
+    auto wait = conn.take_peak_send_wait();
+    if (wait > std::chrono::milliseconds(100)) {
+        using std::chrono::duration_cast;
+        using std::chrono::milliseconds;
+        std::cout << "[gateway] commands waited up to " << duration_cast<milliseconds>(wait).count()
+                  << " ms to be sent, " << conn.send_queue_depth() << " queued\n";
+    }
 }
 
 void discord::gateway::send(const std::string &s, transfer_cb c)
 {
-    conn.send(s, c);
+    // Payloads are built as JSON everywhere, the few sent are converted here
+    if (etf)
+        conn.send(discord::etf_encode(nlohmann::json::parse(s)), c);
+    else
+        conn.send(s, c);
 }
 
 discord::snowflake discord::gateway::get_user_id() const
@@ -100,8 +190,11 @@ void discord::gateway::identify()
          {{"token", token},
           {"properties",
            {{"$os", "linux"}, {"$browser", "cmd-discord"}, {"$device", "cmd-discord"}}},
+          // Payload compression, which the zlib-stream transport replaces
           {"compress", false},
           {"large_threshold", 250}}}};
+    if (shard_count > 1)
+        identify_payload["d"]["shard"] = {shard_id, shard_count};
 
     auto callback = [weak = weak_from_this()](const auto &ec, size_t) {
         if (auto self = weak.lock()) {
@@ -116,6 +209,23 @@ void discord::gateway::identify()
     send(identify_payload.dump(), callback);
 }
 
+void discord::gateway::request_guild_members(discord::snowflake guild_id,
+                                             const std::vector<discord::snowflake> &user_ids)
+{
+    // Discord takes up to 100 users per request, and answers with GUILD_MEMBERS_CHUNK events
+    constexpr auto max_users = size_t{100};
+    for (auto first = size_t{0}; first < user_ids.size(); first += max_users) {
+        auto ids = nlohmann::json::array();
+        for (auto i = first; i < std::min(first + max_users, user_ids.size()); ++i)
+            ids.push_back(std::to_string(user_ids[i]));
+
+        auto request = nlohmann::json{
+            {"op", static_cast<int>(gateway_op::request_guild_members)},
+            {"d", {{"guild_id", std::to_string(guild_id)}, {"user_ids", ids}, {"limit", 0}}}};
+        send(request.dump(), ignore_transfer);
+    }
+}
+
 void discord::gateway::resume()
 {
     // If we are connected, ignore any resumes
@@ -154,33 +264,61 @@ void discord::gateway::next_event()
 {
     // Asynchronously read next message, on message received send it to listeners
     if (state != connection_state::disconnected)
-        conn.read([weak = weak_from_this()](const auto &ec, const auto &json) {
+        conn.read_message([weak = weak_from_this()](const auto &ec, auto message) {
             if (auto self = weak.lock()) {
                 if (ec) {
                     std::cerr << "[gateway] error: " << ec.message() << "\n";
                     self->disconnect();
                 } else {
-                    self->handle_event(json);
+                    self->handle_event(message);
                 }
             }
         });
 }
 
-void discord::gateway::handle_event(const nlohmann::json &j)
+void discord::gateway::handle_event(std::string_view message)
 {
-    std::cout << "[gateway] " << j.dump() << "\n";
+    auto payload = discord::payload_view{};
+    auto decoded = discord::payload{};
+    if (etf) {
+        try {
+            decoded = discord::etf_decode(message).get<discord::payload>();
+        } catch (std::exception &e) {
+            std::cerr << "[gateway] malformed payload: " << e.what() << "\n";
+            return;
+        }
+        payload.op = decoded.op;
+        payload.sequence_num = decoded.sequence_num;
+        payload.event_name = decoded.event_name;
+        payload.event = decoded.event;
+    } else if (!discord::scan_payload(message, payload)) {
+        std::cerr << "[gateway] malformed payload: " << message.substr(0, 100) << "\n";
+        return;
+    }
+    std::cout << "[gateway] op " << static_cast<int>(payload.op) << " " << payload.event_name
+              << " (" << message.size() << " bytes";
+    if (auto *inflater = conn.compression())
+        std::cout << ", " << inflater->payload_compressed_size() << " compressed";
+    std::cout << ")\n";
+
     try {
-        auto payload = j.get<discord::payload>();
         seq_num = payload.sequence_num;
 
-        // if (payload.event_name == "MESSAGE_CREATE") {
-        //     auto message = payload.data.get<discord::message>();
-        // }
+        if (payload.op == gateway_op::dispatch) {
+            // Nothing handles an unknown event, its data is never parsed
+            if (payload.event != gateway_event::unknown) {
+                if (etf)
+                    run_gateway_dispatch(decoded.data, payload.event);
+                else
+                    run_gateway_dispatch(payload.data, payload.event);
+            }
+            next_event();
+            return;
+        }
 
+        auto data = etf ? std::move(decoded.data)
+                        : nlohmann::json::parse(payload.data.begin(), payload.data.end());
         switch (payload.op) {
-            case gateway_op::dispatch:
-                run_gateway_dispatch(payload.data, payload.event_name);
-                break;
             case gateway_op::heartbeat:
                 heartbeat();  // Respond to heartbeats with a heartbeat
                 break;
@@ -195,14 +333,14 @@ void discord::gateway::handle_event(const nlohmann::json &j)
                 } else {
                     state = connection_state::disconnected;
                     // Already connected, if we can reconnect, try to resume the connection
-                    if (payload.data.is_boolean() && payload.data.get<bool>())
+                    if (data.is_boolean() && data.get<bool>())
                         resume();
                     else
                         throw std::runtime_error("disconnected");
                 }
                 break;
             case gateway_op::hello:
-                beater.on_hello(payload.data, *this);
+                beater.on_hello(data, *this);
                 break;
             case gateway_op::heartbeat_ack:
                 beater.on_heartbeat_ack();
@@ -217,16 +355,55 @@ void discord::gateway::handle_event(const nlohmann::json &j)
     }
 }
 
+void discord::gateway::on_event(discord::gateway_event event, discord_event_cb c)
+{
+    event_to_handlers[static_cast<size_t>(event)].push_back(std::move(c));
+}
+
+void discord::gateway::run_gateway_dispatch(std::string_view data, discord::gateway_event event)
+{
+    auto start = std::chrono::steady_clock::now();
+    if (voice)
+        voice->take_peak_lateness();
+
+    if (auto &raw = event_to_raw_handler[static_cast<size_t>(event)])
+        raw(data);
+
+    // Only what some handler wants gets parsed, the rest is never more than scanned over
+    if (auto &handlers = event_to_handlers[static_cast<size_t>(event)]; !handlers.empty()) {
+        auto json = nlohmann::json::parse(data.begin(), data.end());
+        for (auto &handler : handlers)
+            handler(json);
+    }
+    report_slow_event(event, start);
+}
+
 void discord::gateway::run_gateway_dispatch(const nlohmann::json &data,
-                                            const std::string &event_name)
-{
-    using namespace std::string_literals;
-    auto events = {event_name, "ALL"s};
-    for (auto &event : events) {
-        auto range = event_to_handler.equal_range(event);
-        for (auto it = range.first; it != range.second; ++it) {
-            it->second(data);
-        }
+                                            discord::gateway_event event)
+{
+    auto start = std::chrono::steady_clock::now();
+    if (voice)
+        voice->take_peak_lateness();
+
+    for (auto &handler : event_to_handlers[static_cast<size_t>(event)])
+        handler(data);
+    report_slow_event(event, start);
+}
+
+// Events long enough to have stalled a 20 ms voice tick were they on the same thread, with the
+// worst a frame actually went out late meanwhile
+void discord::gateway::report_slow_event(discord::gateway_event event,
+                                         std::chrono::steady_clock::time_point start)
+{
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    if (voice && elapsed > std::chrono::milliseconds(20)) {
+        using std::chrono::duration_cast;
+        using std::chrono::microseconds;
+        using std::chrono::milliseconds;
+        std::cout << "[gateway] " << discord::to_string(event) << " took "
+                  << duration_cast<milliseconds>(elapsed).count()
+                  << " ms, worst voice frame lateness meanwhile "
+                  << duration_cast<microseconds>(voice->take_peak_lateness()).count() << " us\n";
     }
 }
 
@@ -234,3 +411,18 @@ const discord::gateway_store &discord::gateway::get_gateway_store() const
 {
     return store;
 }
+
+const discord::options &discord::gateway::get_options() const
+{
+    return opts;
+}
+
+size_t discord::gateway::get_shard_id() const
+{
+    return shard_id;
+}
+
+bool discord::gateway::is_ready() const
+{
+    return state == connection_state::connected;
+}
@@ -1,7 +1,11 @@
 #ifndef DISCORD_GATEWAY_H
 #define DISCORD_GATEWAY_H
 
+#include <array>
+#include <chrono>
 #include <memory>
+#include <string_view>
+#include <vector>
 
 #include <boost/asio/io_context.hpp>
 #include <json.hpp>
@@ -9,48 +13,74 @@
 #include "aliases.h"
 #include "callbacks.h"
 #include "discord.h"
+#include "gateway_event.h"
 #include "gateway_store.h"
 #include "heartbeater.h"
 #include "net/connection.h"
+#include "options.h"
 
 namespace discord
 {
+class voice_connector;
+
+// One gateway session, shard shard_id of shard_count. Its store holds the guilds of that shard,
+// voice events go to the voice connector shared by every shard
 class gateway : public std::enable_shared_from_this<gateway>
 {
 public:
-    gateway(boost::asio::io_context &ctx, ssl::context &tls, const std::string &token,
-            discord::connection &c);
+    gateway(boost::asio::io_context &ctx, const discord::options &opts, discord::connection &c,
+            std::shared_ptr<discord::voice_connector> voice, size_t shard_id = 0,
+            size_t shard_count = 1);
     ~gateway() = default;
     void run();
     void disconnect();
     void heartbeat();
     void send(const std::string &s, transfer_cb c);
+    // Asks for the members, which arrive as GUILD_MEMBERS_CHUNK events
+    void request_guild_members(discord::snowflake guild_id,
+                               const std::vector<discord::snowflake> &user_ids);
     discord::snowflake get_user_id() const;
     const std::string &get_session_id() const;
     const discord::gateway_store &get_gateway_store() const;
+    const discord::options &get_options() const;
+    size_t get_shard_id() const;
+    bool is_ready() const;
 
     using discord_event_cb = std::function<void(const nlohmann::json &)>;
+    // Gets the event's data as JSON text, for events big enough to be worth reading without a
+    // document
+    using raw_event_cb = std::function<void(std::string_view)>;
 
 private:
+    const discord::options &opts;
     discord::connection &conn;
     discord::gateway_store store;
     discord::heartbeater beater;
+    std::shared_ptr<discord::voice_connector> voice;
 
-    // Map an event name (e.g. READY, RESUMED, etc.) to a handler
-    std::multimap<std::string, discord_event_cb> event_to_handler;
+    // Handlers by event, indexed by its discord::gateway_event
+    std::array<std::vector<discord_event_cb>, discord::gateway_event_count> event_to_handlers;
+    std::array<raw_event_cb, discord::gateway_event_count> event_to_raw_handler;
 
     std::string token;
     std::string session_id;
     discord::snowflake user_id;
     int seq_num;
+    size_t shard_id;
+    size_t shard_count;
     enum class connection_state { disconnected, connecting, connected } state;
+    bool etf;
 
     void identify();
     void resume();
     void on_ready(const nlohmann::json &data);
     void next_event();
-    void handle_event(const nlohmann::json &j);
-    void run_gateway_dispatch(const nlohmann::json &data, const std::string &event_name);
+    void handle_event(std::string_view message);
+    void on_event(discord::gateway_event event, discord_event_cb c);
+    void run_gateway_dispatch(std::string_view data, discord::gateway_event event);
+    void run_gateway_dispatch(const nlohmann::json &data, discord::gateway_event event);
+    void report_slow_event(discord::gateway_event event,
+                           std::chrono::steady_clock::time_point start);
 };
 }  // namespace discord
 
@@ -0,0 +1,108 @@
+#ifndef DISCORD_GATEWAY_EVENT_H
+#define DISCORD_GATEWAY_EVENT_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace discord
+{
+// The dispatch events the bot has handlers for, any other is unknown and dropped unread
+enum class gateway_event : uint8_t {
+    unknown,
+    ready,
+    resumed,
+    guild_create,
+    channel_create,
+    channel_update,
+    channel_delete,
+    guild_members_chunk,
+    guild_member_add,
+    guild_member_update,
+    guild_member_remove,
+    voice_state_update,
+    voice_server_update,
+    message_create
+};
+
+constexpr auto gateway_event_count = size_t{14};
+
+// By event, as Discord names them in the "t" field
+constexpr std::array<std::string_view, gateway_event_count> gateway_event_names{
+    "",
+    "READY",
+    "RESUMED",
+    "GUILD_CREATE",
+    "CHANNEL_CREATE",
+    "CHANNEL_UPDATE",
+    "CHANNEL_DELETE",
+    "GUILD_MEMBERS_CHUNK",
+    "GUILD_MEMBER_ADD",
+    "GUILD_MEMBER_UPDATE",
+    "GUILD_MEMBER_REMOVE",
+    "VOICE_STATE_UPDATE",
+    "VOICE_SERVER_UPDATE",
+    "MESSAGE_CREATE"};
+
+constexpr std::string_view to_string(discord::gateway_event e)
+{
+    return gateway_event_names[static_cast<size_t>(e)];
+}
+
+namespace detail
+{
+// FNV-1a with a seed mixed in, the seed is what makes the hash perfect over the names
+constexpr uint32_t event_hash(std::string_view name, uint32_t seed)
+{
+    auto hash = uint32_t{2166136261} ^ seed;
+    for (auto c : name)
+        hash = (hash ^ static_cast<uint8_t>(c)) * uint32_t{16777619};
+    return hash;
+}
+
+constexpr auto event_slots = size_t{32};
+static_assert((event_slots & (event_slots - 1)) == 0 && event_slots >= gateway_event_count);
+
+// The first seed giving every name a slot of its own, found by the compiler
+constexpr uint32_t find_event_seed()
+{
+    for (auto seed = uint32_t{0};; ++seed) {
+        bool taken[event_slots] = {};
+        auto perfect = true;
+        for (auto i = size_t{1}; i < gateway_event_count && perfect; ++i) {
+            auto &slot = taken[event_hash(gateway_event_names[i], seed) & (event_slots - 1)];
+            perfect = !slot;
+            slot = true;
+        }
+        if (perfect)
+            return seed;
+    }
+}
+
+constexpr auto event_seed = find_event_seed();
+
+// Slot to event, unknown where no name hashes to
+constexpr std::array<discord::gateway_event, event_slots> make_event_table()
+{
+    auto table = std::array<discord::gateway_event, event_slots>{};
+    for (auto i = size_t{1}; i < gateway_event_count; ++i)
+        table[event_hash(gateway_event_names[i], event_seed) & (event_slots - 1)] =
+            static_cast<discord::gateway_event>(i);
+    return table;
+}
+
+constexpr auto event_table = make_event_table();
+}  // namespace detail
+
+// Interns an event name: one hash over it and one comparison with the name in its slot, which
+// tells a known event from another name landing there
+constexpr discord::gateway_event to_gateway_event(std::string_view name)
+{
+    auto e = detail::event_table[detail::event_hash(name, detail::event_seed) &
+                                 (detail::event_slots - 1)];
+    return to_string(e) == name ? e : gateway_event::unknown;
+}
+}  // namespace discord
+
+#endif
@@ -1,20 +1,168 @@
+#include <algorithm>
 #include <iostream>
 
 #include "gateway_store.h"
+#include "json_reader.h"
 
-void discord::gateway_store::guild_create(const nlohmann::json &json)
+static void read_channel(discord::json_reader &reader, discord::channel &c)
+{
+    c = {};
+    reader.begin_object();
+    for (auto key = std::string_view{}; reader.next_key(key);) {
+        if (key == "id")
+            c.id = reader.snowflake();
+        else if (key == "guild_id")
+            c.guild_id = reader.snowflake();
+        else if (key == "user_limit")
+            c.user_limit = reader.is_null() ? 0 : static_cast<int>(reader.integer());
+        else if (key == "bitrate")
+            c.bitrate = reader.is_null() ? 0 : static_cast<int>(reader.integer());
+        else if (key == "type")
+            c.type = static_cast<discord::channel::channel_type>(reader.integer());
+        else if (key == "name")
+            reader.string(c.name);
+        else
+            reader.skip();
+    }
+}
+
+static void read_member(discord::json_reader &reader, discord::member &m)
+{
+    m = {};
+    reader.begin_object();
+    for (auto key = std::string_view{}; reader.next_key(key);) {
+        if (key == "user") {
+            reader.begin_object();
+            for (auto user_key = std::string_view{}; reader.next_key(user_key);) {
+                if (user_key == "id")
+                    m.user.id = reader.snowflake();
+                else if (user_key == "username")
+                    reader.string(m.user.name);
+                else if (user_key == "discriminator")
+                    reader.string(m.user.discriminator);
+                else
+                    reader.skip();
+            }
+        } else if (key == "nick") {
+            if (!reader.is_null())
+                reader.string(m.nick);
+        } else {
+            reader.skip();
+        }
+    }
+}
+
+static void read_voice_state(discord::json_reader &reader, discord::voice_state &v)
+{
+    v = {};
+    reader.begin_object();
+    for (auto key = std::string_view{}; reader.next_key(key);) {
+        if (key == "guild_id")
+            v.guild_id = reader.snowflake();
+        else if (key == "channel_id")
+            v.channel_id = reader.snowflake();
+        else if (key == "user_id")
+            v.user_id = reader.snowflake();
+        else if (key == "session_id")
+            reader.string(v.session_id);
+        else if (key == "deaf")
+            v.deaf = reader.boolean();
+        else if (key == "mute")
+            v.mute = reader.boolean();
+        else if (key == "self_deaf")
+            v.self_deaf = reader.boolean();
+        else if (key == "self_mute")
+            v.self_mute = reader.boolean();
+        else if (key == "suppress")
+            v.suppress = reader.boolean();
+        else
+            reader.skip();
+    }
+}
+
+discord::gateway_store::gateway_store(size_t member_cache_size)
+{
+    if (member_cache_size > 0)
+        member_cache = std::make_unique<discord::member_cache>(member_cache_size);
+}
+
+discord::snowflake discord::gateway_store::guild_create(const nlohmann::json &json)
+{
+    try {
+        auto g = std::make_unique<discord::guild>(json.get<discord::guild>());
+        if (member_cache)
+            g->members.clear();
+        auto id = g->id;
+        add_guild(std::move(g));
+        return id;
+    } catch (std::exception &e) {
+        std::cerr << "[gateway store] " << e.what() << "\n";
+        return 0;
+    }
+}
+
+discord::snowflake discord::gateway_store::guild_create(std::string_view json)
 {
     try {
-        auto g = json.get<discord::guild>();
-        for (auto &channel : g.channels)
-            channels_to_guild[channel.id] = g.id;
+        auto g = std::make_unique<discord::guild>();
+        g->id = 0;
+        g->owner = 0;
+        g->unavailable = false;
+
+        // Each element is read into the one scratch object, then moved to the end of its set
+        auto channel = discord::channel{};
+        auto member = discord::member{};
+        auto voice_state = discord::voice_state{};
 
-        for (auto &member : g.members)
-            user_to_guilds.insert({member.user.id, g.id});
+        auto reader = discord::json_reader{json};
+        reader.begin_object();
+        for (auto key = std::string_view{}; reader.next_key(key);) {
+            if (key == "id") {
+                g->id = reader.snowflake();
+            } else if (key == "owner_id") {
+                g->owner = reader.snowflake();
+            } else if (key == "name") {
+                reader.string(g->name);
+            } else if (key == "region") {
+                reader.string(g->region);
+            } else if (key == "unavailable") {
+                g->unavailable = reader.boolean();
+            } else if (key == "channels") {
+                reader.begin_array();
+                while (reader.next_element()) {
+                    read_channel(reader, channel);
+                    g->channels.append(std::move(channel));
+                }
+            } else if (key == "members" && !member_cache) {
+                reader.begin_array();
+                while (reader.next_element()) {
+                    read_member(reader, member);
+                    g->members.append(std::move(member));
+                }
+            } else if (key == "voice_states") {
+                if (reader.is_null())
+                    continue;
+                reader.begin_array();
+                while (reader.next_element()) {
+                    read_voice_state(reader, voice_state);
+                    g->voice_states.append(std::move(voice_state));
+                }
+            } else {
+                reader.skip();
+            }
+        }
 
-        guilds[g.id] = std::make_unique<discord::guild>(std::move(g));
+        if (g->id == 0)
+            throw discord::json_error{"guild without an id"};
+        g->channels.sort();
+        g->members.sort();
+        g->voice_states.sort();
+        auto id = g->id;
+        add_guild(std::move(g));
+        return id;
     } catch (std::exception &e) {
         std::cerr << "[gateway store] " << e.what() << "\n";
+        return 0;
     }
 }
 
@@ -23,9 +171,9 @@ void discord::gateway_store::channel_create(const nlohmann::json &json)
     try {
         auto c = json.get<discord::channel>();
         channels_to_guild[c.id] = c.guild_id;
-        auto g = guilds[c.guild_id].get();
-        if (g) {
-            g->channels.insert(c);
+        if (auto *g = find_guild(c.guild_id)) {
+            g->channels.insert(std::move(c));
+            index_channel_names(*g);
         }
     } catch (std::exception &e) {
         std::cerr << "[gateway store] " << e.what() << "\n";
@@ -36,11 +184,9 @@ void discord::gateway_store::channel_update(const nlohmann::json &json)
 {
     try {
         auto c = json.get<discord::channel>();
-        auto g = guilds[c.guild_id].get();
-        if (g) {
-            // erase old entry, replace with new channel
-            g->channels.erase(c);
-            g->channels.insert(c);
+        if (auto *g = find_guild(c.guild_id)) {
+            g->channels.insert(std::move(c));  // replaces the old entry
+            index_channel_names(*g);
         }
     } catch (std::exception &e) {
         std::cerr << "[gateway store] " << e.what() << "\n";
@@ -51,9 +197,9 @@ void discord::gateway_store::channel_delete(const nlohmann::json &json)
 {
     try {
         auto c = json.get<discord::channel>();
-        auto g = guilds[c.guild_id].get();
-        if (g) {
-            g->channels.erase(c);
+        if (auto *g = find_guild(c.guild_id)) {
+            g->channels.erase(c.id);
+            index_channel_names(*g);
         }
         channels_to_guild.erase(c.id);
     } catch (std::exception &e) {
@@ -65,9 +211,79 @@ void discord::gateway_store::voice_state_update(const nlohmann::json &json)
 {
     try {
         auto vs = json.get<discord::voice_state>();
-        auto g = guilds[vs.guild_id].get();
-        g->voice_states.erase(vs);  // erase any existing voice state information
-        g->voice_states.insert(std::move(vs));
+        // Someone in voice is someone the bot may be asked about
+        if (member_cache && json.count("member") && json["member"].count("user"))
+            member_cache->insert(vs.guild_id, json["member"].get<discord::member>());
+        if (auto *g = find_guild(vs.guild_id))
+            g->voice_states.insert(std::move(vs));  // replaces any existing voice state
+    } catch (std::exception &e) {
+        std::cerr << "[gateway store] " << e.what() << "\n";
+    }
+}
+
+void discord::gateway_store::guild_members_chunk(const nlohmann::json &json)
+{
+    try {
+        auto guild_id = discord::make_snowflake(json.at("guild_id"));
+        for (auto &m : json.at("members"))
+            add_member(guild_id, m.get<discord::member>());
+    } catch (std::exception &e) {
+        std::cerr << "[gateway store] " << e.what() << "\n";
+    }
+}
+
+void discord::gateway_store::guild_member_add(const nlohmann::json &json)
+{
+    // With a member cache, new members are of no interest until they show up somewhere
+    if (member_cache)
+        return;
+    try {
+        add_member(discord::make_snowflake(json.at("guild_id")), json.get<discord::member>());
+    } catch (std::exception &e) {
+        std::cerr << "[gateway store] " << e.what() << "\n";
+    }
+}
+
+void discord::gateway_store::guild_member_update(const nlohmann::json &json)
+{
+    try {
+        auto guild_id = discord::make_snowflake(json.at("guild_id"));
+        auto m = json.get<discord::member>();
+        if (get_member(guild_id, m.user.id))
+            add_member(guild_id, std::move(m));
+    } catch (std::exception &e) {
+        std::cerr << "[gateway store] " << e.what() << "\n";
+    }
+}
+
+void discord::gateway_store::guild_member_remove(const nlohmann::json &json)
+{
+    try {
+        auto guild_id = discord::make_snowflake(json.at("guild_id"));
+        auto user_id = json.at("user").get<discord::user>().id;
+        if (member_cache) {
+            member_cache->erase(guild_id, user_id);
+        } else if (auto *g = find_guild(guild_id)) {
+            g->members.erase(user_id);
+        }
+    } catch (std::exception &e) {
+        std::cerr << "[gateway store] " << e.what() << "\n";
+    }
+}
+
+void discord::gateway_store::message_create(const nlohmann::json &json)
+{
+    // The author of a message may be about to use a command. A guild message carries its author's
+    // member, without the user, which is the author
+    if (!member_cache || !json.count("member") || !json.count("guild_id"))
+        return;
+    try {
+        auto m = discord::member{};
+        m.user = json.at("author").get<discord::user>();
+        auto &member = json["member"];
+        if (member.count("nick") && member["nick"].is_string())
+            m.nick = member["nick"].get<std::string>();
+        member_cache->insert(discord::make_snowflake(json["guild_id"]), std::move(m));
     } catch (std::exception &e) {
         std::cerr << "[gateway store] " << e.what() << "\n";
     }
@@ -75,16 +291,91 @@ void discord::gateway_store::voice_state_update(const nlohmann::json &json)
 
 const discord::guild *discord::gateway_store::get_guild(discord::snowflake guild_id) const
 {
-    auto it = guilds.find(guild_id);
-    if (it != guilds.end())
-        return it->second.get();
-    return nullptr;
+    auto *g = guilds.find(guild_id);
+    return g ? g->get() : nullptr;
 }
 
 discord::snowflake discord::gateway_store::lookup_channel(discord::snowflake channel_id) const
 {
-    auto it = channels_to_guild.find(channel_id);
-    if (it == channels_to_guild.end())
-        return 0;
-    return it->second;
+    auto *guild_id = channels_to_guild.find(channel_id);
+    return guild_id ? *guild_id : 0;
+}
+
+const discord::member *discord::gateway_store::get_member(discord::snowflake guild_id,
+                                                          discord::snowflake user_id) const
+{
+    if (member_cache)
+        return member_cache->find(guild_id, user_id);
+    const auto *g = get_guild(guild_id);
+    return g ? g->members.find(user_id) : nullptr;
+}
+
+bool discord::gateway_store::lazy_members() const
+{
+    return member_cache != nullptr;
+}
+
+std::vector<discord::snowflake>
+discord::gateway_store::uncached_voice_members(discord::snowflake guild_id) const
+{
+    auto users = std::vector<discord::snowflake>{};
+    if (const auto *g = get_guild(guild_id))
+        for (auto &vs : g->voice_states)
+            if (vs.channel_id != 0 && !get_member(guild_id, vs.user_id))
+                users.push_back(vs.user_id);
+    return users;
+}
+
+discord::gateway_store::channel_name_range
+discord::gateway_store::voice_channels_named(discord::snowflake guild_id,
+                                             std::string_view name) const
+{
+    auto *names = voice_channel_names.find(guild_id);
+    if (!names)
+        return {};
+    return std::equal_range(names->begin(), names->end(), channel_name{name, 0},
+                            [](const auto &a, const auto &b) { return a.first < b.first; });
+}
+
+discord::guild *discord::gateway_store::find_guild(discord::snowflake guild_id)
+{
+    auto *g = guilds.find(guild_id);
+    return g ? g->get() : nullptr;
+}
+
+void discord::gateway_store::add_guild(std::unique_ptr<discord::guild> g)
+{
+    // A guild sent again, after an outage or on a new session, replaces what was known
+    if (auto *old = find_guild(g->id)) {
+        for (auto &c : old->channels)
+            channels_to_guild.erase(c.id);
+    }
+
+    channels_to_guild.reserve(channels_to_guild.size() + g->channels.size());
+    for (auto &c : g->channels)
+        channels_to_guild[c.id] = g->id;
+
+    index_channel_names(*g);
+    guilds[g->id] = std::move(g);
+}
+
+void discord::gateway_store::add_member(discord::snowflake guild_id, discord::member m)
+{
+    if (member_cache) {
+        member_cache->insert(guild_id, std::move(m));
+    } else if (auto *g = find_guild(guild_id)) {
+        g->members.insert(std::move(m));
+    }
+}
+
+void discord::gateway_store::index_channel_names(const discord::guild &g)
+{
+    auto &names = voice_channel_names[g.id];
+    names.clear();
+    for (auto &c : g.channels)
+        if (c.type == discord::channel::channel_type::guild_voice)
+            names.emplace_back(c.name, c.id);
+    // Channels go in by id, a stable sort keeps that order among channels of the same name
+    std::stable_sort(names.begin(), names.end(),
+                     [](const auto &a, const auto &b) { return a.first < b.first; });
 }
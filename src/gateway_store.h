@@ -2,34 +2,70 @@
 #define GATEWAY_STORE_H
 
 #include <json.hpp>
-#include <map>
 #include <memory>
-#include <set>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 #include "discord.h"
+#include "member_cache.h"
+#include "snowflake_map.h"
 
 namespace discord
 {
+// What the gateway has told about the guilds. With a member cache size, members are not kept from
+// GUILD_CREATE: only the ones recently seen in messages, voice states or requested member chunks
+// are, up to that many, and guild::members stays empty
 class gateway_store
 {
 public:
-    void guild_create(const nlohmann::json &json);
+    explicit gateway_store(size_t member_cache_size = 0);
+
+    // Returns the guild's id, 0 if it could not be read
+    discord::snowflake guild_create(const nlohmann::json &json);
+    // The same from the event's JSON text, read straight into the guild and the indexes without a
+    // document in between
+    discord::snowflake guild_create(std::string_view json);
     void channel_create(const nlohmann::json &json);
     void channel_update(const nlohmann::json &json);
     void channel_delete(const nlohmann::json &json);
     void voice_state_update(const nlohmann::json &json);
+    void guild_members_chunk(const nlohmann::json &json);
+    void guild_member_add(const nlohmann::json &json);
+    void guild_member_update(const nlohmann::json &json);
+    void guild_member_remove(const nlohmann::json &json);
+    void message_create(const nlohmann::json &json);
+
+    using channel_name = std::pair<std::string, discord::snowflake>;
+    using channel_name_range = std::pair<std::vector<channel_name>::const_iterator,
+                                         std::vector<channel_name>::const_iterator>;
 
     // Returns the guild_id that the channel is in
     discord::snowflake lookup_channel(discord::snowflake channel_id) const;
     const discord::guild *get_guild(discord::snowflake guild_id) const;
+    // The voice channels of the guild called name, with their ids, in id order
+    channel_name_range voice_channels_named(discord::snowflake guild_id,
+                                            std::string_view name) const;
+
+    // nullptr if not known, or with a member cache, not cached
+    const discord::member *get_member(discord::snowflake guild_id,
+                                      discord::snowflake user_id) const;
+    bool lazy_members() const;
+    // Users in the guild's voice channels whose members are not cached, to request
+    std::vector<discord::snowflake> uncached_voice_members(discord::snowflake guild_id) const;
 
 private:
-    std::map<discord::snowflake, std::unique_ptr<discord::guild>>
-        guilds;                                                          // guild id to guild struct
-    std::map<discord::snowflake, discord::snowflake> channels_to_guild;  // channel id to guild id
-    std::multimap<discord::snowflake, discord::snowflake>
-        user_to_guilds;  // user id to multiple guild ids
+    discord::snowflake_map<std::unique_ptr<discord::guild>> guilds;  // guild id to guild struct
+    discord::snowflake_map<discord::snowflake> channels_to_guild;    // channel id to guild id
+    // Per guild, the names of its voice channels with their ids, sorted by name
+    discord::snowflake_map<std::vector<channel_name>> voice_channel_names;
+    std::unique_ptr<discord::member_cache> member_cache;  // only for lazy members
+
+    discord::guild *find_guild(discord::snowflake guild_id);
+    void add_guild(std::unique_ptr<discord::guild> g);
+    void add_member(discord::snowflake guild_id, discord::member m);
+    void index_channel_names(const discord::guild &g);
 };
 }  // namespace discord
 
@@ -0,0 +1,112 @@
+#ifndef DISCORD_ID_SET_H
+#define DISCORD_ID_SET_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace discord
+{
+// Values kept sorted by id_of(value) in one vector, for the channels, members and voice states of
+// a guild: lookups are a binary search over contiguous memory and there is no node per value.
+// Inserting one value moves the ones after it, which is cheap next to an allocation at the sizes
+// a guild has. Loading many at once appends them all, then sorts once
+template<typename T>
+class id_set
+{
+public:
+    using value_type = T;
+    using const_iterator = typename std::vector<T>::const_iterator;
+
+    const T *find(uint64_t id) const
+    {
+        auto it = lower_bound(id);
+        return it != values.end() && id_of(*it) == id ? &*it : nullptr;
+    }
+
+    // Replaces the value with the same id, if any
+    void insert(T value)
+    {
+        auto id = id_of(value);
+        auto it = lower_bound(id);
+        if (it != values.end() && id_of(*it) == id)
+            *it = std::move(value);
+        else
+            values.insert(it, std::move(value));
+    }
+
+    bool erase(uint64_t id)
+    {
+        auto it = lower_bound(id);
+        if (it == values.end() || id_of(*it) != id)
+            return false;
+        values.erase(it);
+        return true;
+    }
+
+    // Adds a value in no particular order, sort has to be called before the set is used again
+    void append(T value)
+    {
+        values.push_back(std::move(value));
+    }
+
+    // Of values appended with the same id, the last one stays
+    void sort()
+    {
+        std::stable_sort(values.begin(), values.end(),
+                         [](const T &a, const T &b) { return id_of(a) < id_of(b); });
+        auto last = std::unique(values.rbegin(), values.rend(), [](const T &a, const T &b) {
+            return id_of(a) == id_of(b);
+        });
+        values.erase(values.begin(), last.base());
+        values.shrink_to_fit();
+    }
+
+    void reserve(size_t n)
+    {
+        values.reserve(n);
+    }
+
+    void clear()
+    {
+        values.clear();
+    }
+
+    size_t size() const
+    {
+        return values.size();
+    }
+
+    bool empty() const
+    {
+        return values.empty();
+    }
+
+    const_iterator begin() const
+    {
+        return values.begin();
+    }
+
+    const_iterator end() const
+    {
+        return values.end();
+    }
+
+private:
+    std::vector<T> values;
+
+    typename std::vector<T>::iterator lower_bound(uint64_t id)
+    {
+        return std::lower_bound(values.begin(), values.end(), id,
+                                [](const T &value, uint64_t id) { return id_of(value) < id; });
+    }
+
+    const_iterator lower_bound(uint64_t id) const
+    {
+        return std::lower_bound(values.begin(), values.end(), id,
+                                [](const T &value, uint64_t id) { return id_of(value) < id; });
+    }
+};
+}  // namespace discord
+
+#endif
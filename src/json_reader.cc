@@ -0,0 +1,268 @@
+#include <charconv>
+
+#include "json_reader.h"
+
+discord::json_reader::json_reader(std::string_view text)
+    : it{text.data()}, begin{text.data()}, end{text.data() + text.size()}, after_value{false}
+{
+}
+
+void discord::json_reader::fail(const char *what) const
+{
+    throw discord::json_error{std::string{what} + " at offset " + std::to_string(it - begin)};
+}
+
+void discord::json_reader::skip_whitespace()
+{
+    while (it != end && (*it == ' ' || *it == '\t' || *it == '\n' || *it == '\r'))
+        ++it;
+}
+
+char discord::json_reader::peek()
+{
+    skip_whitespace();
+    if (it == end)
+        fail("unexpected end");
+    return *it;
+}
+
+void discord::json_reader::expect(char c)
+{
+    if (peek() != c)
+        fail("unexpected character");
+    ++it;
+}
+
+void discord::json_reader::separator(char close)
+{
+    if (after_value && peek() != close)
+        expect(',');
+}
+
+void discord::json_reader::begin_object()
+{
+    expect('{');
+    after_value = false;
+}
+
+bool discord::json_reader::next_key(std::string_view &key)
+{
+    separator('}');
+    if (peek() == '}') {
+        ++it;
+        after_value = true;
+        return false;
+    }
+    key = string_view();
+    expect(':');
+    after_value = false;
+    return true;
+}
+
+void discord::json_reader::begin_array()
+{
+    expect('[');
+    after_value = false;
+}
+
+bool discord::json_reader::next_element()
+{
+    separator(']');
+    if (peek() == ']') {
+        ++it;
+        after_value = true;
+        return false;
+    }
+    after_value = false;
+    return true;
+}
+
+// it is on the opening quote, ends up past the closing one
+void discord::json_reader::skip_string()
+{
+    for (++it; it != end; ++it) {
+        if (*it == '\\') {
+            if (++it == end)
+                break;
+        } else if (*it == '"') {
+            ++it;
+            return;
+        }
+    }
+    fail("unterminated string");
+}
+
+// Only brackets outside of strings count, the value's own syntax is left for whoever parses it
+std::string_view discord::json_reader::raw()
+{
+    peek();
+    auto start = it;
+    if (*it == '"') {
+        skip_string();
+    } else if (*it == '{' || *it == '[') {
+        auto depth = 0;
+        do {
+            switch (*it) {
+                case '"':
+                    skip_string();
+                    continue;
+                case '{':
+                case '[':
+                    ++depth;
+                    break;
+                case '}':
+                case ']':
+                    --depth;
+                    break;
+            }
+            ++it;
+        } while (depth > 0 && it != end);
+        if (depth > 0)
+            fail("unterminated object or array");
+    } else {
+        // Number, true, false or null
+        while (it != end && *it != ',' && *it != '}' && *it != ']' && *it != ' ' && *it != '\t' &&
+               *it != '\n' && *it != '\r')
+            ++it;
+        if (it == start)
+            fail("missing value");
+    }
+    after_value = true;
+    return {start, static_cast<size_t>(it - start)};
+}
+
+void discord::json_reader::skip()
+{
+    raw();
+}
+
+bool discord::json_reader::is_null()
+{
+    if (peek() != 'n')
+        return false;
+    if (raw() != "null")
+        fail("expected null");
+    return true;
+}
+
+std::string_view discord::json_reader::string_view()
+{
+    if (peek() != '"')
+        fail("expected a string");
+    auto s = raw();
+    return s.substr(1, s.size() - 2);
+}
+
+static void append_utf8(std::string &s, uint32_t c)
+{
+    if (c < 0x80) {
+        s += static_cast<char>(c);
+    } else if (c < 0x800) {
+        s += static_cast<char>(0xC0 | c >> 6);
+        s += static_cast<char>(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+        s += static_cast<char>(0xE0 | c >> 12);
+        s += static_cast<char>(0x80 | (c >> 6 & 0x3F));
+        s += static_cast<char>(0x80 | (c & 0x3F));
+    } else {
+        s += static_cast<char>(0xF0 | c >> 18);
+        s += static_cast<char>(0x80 | (c >> 12 & 0x3F));
+        s += static_cast<char>(0x80 | (c >> 6 & 0x3F));
+        s += static_cast<char>(0x80 | (c & 0x3F));
+    }
+}
+
+void discord::json_reader::string(std::string &s)
+{
+    auto escaped = string_view();
+    s.clear();
+    s.reserve(escaped.size());
+
+    auto hex = [&](size_t at) {
+        auto c = uint32_t{0};
+        if (at + 4 > escaped.size() ||
+            std::from_chars(&escaped[at], &escaped[at] + 4, c, 16).ptr != &escaped[at] + 4)
+            fail("bad \\u escape");
+        return c;
+    };
+
+    for (auto i = size_t{0}; i < escaped.size(); ++i) {
+        if (escaped[i] != '\\') {
+            s += escaped[i];
+            continue;
+        }
+        switch (escaped[++i]) {
+            case 'b':
+                s += '\b';
+                break;
+            case 'f':
+                s += '\f';
+                break;
+            case 'n':
+                s += '\n';
+                break;
+            case 'r':
+                s += '\r';
+                break;
+            case 't':
+                s += '\t';
+                break;
+            case 'u': {
+                auto c = hex(i + 1);
+                i += 4;
+                // A surrogate pair for code points past the first plane
+                if (c >= 0xD800 && c < 0xDC00 && i + 2 < escaped.size() && escaped[i + 1] == '\\' &&
+                    escaped[i + 2] == 'u') {
+                    auto low = hex(i + 3);
+                    if (low >= 0xDC00 && low < 0xE000) {
+                        c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                        i += 6;
+                    }
+                }
+                append_utf8(s, c);
+                break;
+            }
+            default:  // quote, backslash and slash
+                s += escaped[i];
+                break;
+        }
+    }
+}
+
+bool discord::json_reader::boolean()
+{
+    auto value = raw();
+    if (value == "true")
+        return true;
+    if (value != "false")
+        fail("expected a boolean");
+    return false;
+}
+
+long long discord::json_reader::integer()
+{
+    auto value = raw();
+    auto i = 0LL;
+    auto result = std::from_chars(value.data(), value.data() + value.size(), i);
+    if (result.ec != std::errc{} || result.ptr != value.data() + value.size())
+        fail("expected an integer");
+    return i;
+}
+
+discord::snowflake discord::json_reader::snowflake()
+{
+    if (is_null())
+        return 0;
+    auto value = peek() == '"' ? string_view() : raw();
+    auto id = discord::snowflake{0};
+    auto result = std::from_chars(value.data(), value.data() + value.size(), id);
+    if (result.ec != std::errc{} || result.ptr != value.data() + value.size())
+        fail("expected a snowflake");
+    return id;
+}
+
+bool discord::json_reader::done()
+{
+    skip_whitespace();
+    return it == end;
+}
@@ -0,0 +1,66 @@
+#ifndef DISCORD_JSON_READER_H
+#define DISCORD_JSON_READER_H
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "discord.h"
+
+namespace discord
+{
+struct json_error : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Pulls values out of JSON text in the order they are written, for payloads too big to be worth a
+// document: the caller asks for what it expects next and skips the rest. Nothing is allocated
+// except by string(std::string &), views point into the text. Throws json_error on text it can't
+// read
+class json_reader
+{
+public:
+    explicit json_reader(std::string_view text);
+
+    // After begin_object, next_key gives each key in turn, leaving the reader on its value, and
+    // returns false past the closing brace
+    void begin_object();
+    bool next_key(std::string_view &key);
+
+    // Likewise, next_element returns false past the closing bracket
+    void begin_array();
+    bool next_element();
+
+    // The next value as written, including quotes for a string
+    std::string_view raw();
+    void skip();
+    bool is_null();
+
+    // Without escapes decoded, fine for ids and other ASCII
+    std::string_view string_view();
+    void string(std::string &s);
+    bool boolean();
+    long long integer();
+    // A snowflake, which Discord sends as a string. 0 if null
+    discord::snowflake snowflake();
+
+    // Whether only whitespace is left
+    bool done();
+
+private:
+    const char *it;
+    const char *begin;
+    const char *end;
+    // A value has been read since the last key or element, the next one needs a comma first
+    bool after_value;
+
+    [[noreturn]] void fail(const char *what) const;
+    void skip_whitespace();
+    char peek();
+    void expect(char c);
+    void separator(char close);
+    void skip_string();
+};
+}  // namespace discord
+
+#endif
@@ -5,16 +5,17 @@
 
 #include "aliases.h"
 #include "audio/decoding.h"
-#include "gateway.h"
-#include "net/connection.h"
+#include "options.h"
+#include "shard_manager.h"
+#include "voice/crypto.h"
 
-static discord::gateway *gateway_ptr{nullptr};
+static discord::shard_manager *manager_ptr{nullptr};
 static boost::asio::io_context *ctx_ptr{nullptr};
 
 void signal_handler(int)
 {
-    if (gateway_ptr)
-        gateway_ptr->disconnect();
+    if (manager_ptr)
+        manager_ptr->disconnect();
     if (ctx_ptr) {
         ctx_ptr->restart();
         ctx_ptr->stop();
@@ -25,30 +26,41 @@ int main(int argc, char *argv[])
 {
     try {
         if (argc < 2) {
-            std::cerr << "Usage: " << argv[0] << " <bot token>\n";
+            std::cerr << "Usage: " << argv[0] << " <bot token> [--name=value ...]\n"
+                      << "Options, described in README.md:\n"
+                      << "  --prebuffer-kb=N --input-buffer-kb=N --audio-workers=N\n"
+                      << "  --resolver-processes=N --resolver-command=CMD"
+                      << " --resolver-cache-minutes=N\n"
+                      << "  --batched-egress=on --lookahead-ms=N\n"
+                      << "  --voice-threads=N --voice-priority=N --voice-cpu=N\n"
+                      << "  --shards=N --max-concurrency=N --member-cache=N\n"
+                      << "  --gateway-url=URL --gateway-compression=off --gateway-encoding=etf\n";
             return EXIT_FAILURE;
         }
-        auto token = std::string{argv[1]};
-        if (token.length() != 59) {
+        auto opts = discord::parse_options(argc, argv);
+        if (opts.token.length() != 59) {
             std::cerr << "Invalid token. Token should be 59 characters long\n";
             return EXIT_FAILURE;
         }
 
         signal(SIGINT, signal_handler);
+        // A resolver process that died fails the write to its pipe, it doesn't end the bot
+        signal(SIGPIPE, SIG_IGN);
 
 #ifndef FF_API_NEXT
         av_register_all();
 #endif
+        discord::crypto::init();
+
         auto ctx = boost::asio::io_context{};
         auto tls = ssl::context{ssl::context::tls_client};
         tls.set_default_verify_paths();
         tls.set_verify_mode(ssl::context::verify_peer);
 
-        auto gateway_connection = discord::connection{ctx, tls};
-        auto gateway = std::make_shared<discord::gateway>(ctx, tls, token, gateway_connection);
-        gateway->run();
+        auto manager = discord::shard_manager{ctx, tls, opts};
+        manager.run();
 
-        gateway_ptr = gateway.get();
+        manager_ptr = &manager;
         ctx_ptr = &ctx;
 
         ctx.run();
@@ -0,0 +1,113 @@
+#include "member_cache.h"
+
+discord::member_cache::member_cache(size_t capacity)
+    : max_size{capacity}, most_recent{none}, least_recent{none}, free{none}, count{0}
+{
+}
+
+const discord::member *discord::member_cache::find(discord::snowflake guild_id,
+                                                   discord::snowflake user_id)
+{
+    auto *users = index.find(guild_id);
+    auto *i = users ? users->find(user_id) : nullptr;
+    if (!i)
+        return nullptr;
+    unlink(*i);
+    push_front(*i);
+    return &entries[*i].member;
+}
+
+void discord::member_cache::insert(discord::snowflake guild_id, discord::member m)
+{
+    if (max_size == 0 || m.user.id == 0)
+        return;
+
+    auto &users = index[guild_id];
+    if (auto *i = users.find(m.user.id)) {
+        entries[*i].member = std::move(m);
+        unlink(*i);
+        push_front(*i);
+        return;
+    }
+
+    auto i = uint32_t{0};
+    if (free != none) {
+        i = free;
+        free = entries[i].next;
+    } else if (entries.size() < max_size) {
+        i = static_cast<uint32_t>(entries.size());
+        entries.emplace_back();
+    } else {
+        // Full, the least recent member makes room. That may empty and drop its guild's map,
+        // so the one for this guild is looked up again after
+        i = least_recent;
+        remove(i);
+        free = entries[i].next;
+    }
+
+    entries[i].guild_id = guild_id;
+    entries[i].member = std::move(m);
+    index[guild_id][entries[i].member.user.id] = i;
+    push_front(i);
+    ++count;
+}
+
+void discord::member_cache::erase(discord::snowflake guild_id, discord::snowflake user_id)
+{
+    auto *users = index.find(guild_id);
+    auto *i = users ? users->find(user_id) : nullptr;
+    if (i)
+        remove(*i);
+}
+
+size_t discord::member_cache::size() const
+{
+    return count;
+}
+
+size_t discord::member_cache::capacity() const
+{
+    return max_size;
+}
+
+void discord::member_cache::unlink(uint32_t i)
+{
+    auto &e = entries[i];
+    if (e.prev != none)
+        entries[e.prev].next = e.next;
+    else
+        most_recent = e.next;
+    if (e.next != none)
+        entries[e.next].prev = e.prev;
+    else
+        least_recent = e.prev;
+}
+
+void discord::member_cache::push_front(uint32_t i)
+{
+    auto &e = entries[i];
+    e.prev = none;
+    e.next = most_recent;
+    if (most_recent != none)
+        entries[most_recent].prev = i;
+    else
+        least_recent = i;
+    most_recent = i;
+}
+
+// Takes the entry out of the list and the index and puts it on the free list
+void discord::member_cache::remove(uint32_t i)
+{
+    auto &e = entries[i];
+    unlink(i);
+
+    auto *users = index.find(e.guild_id);
+    users->erase(e.member.user.id);
+    if (users->size() == 0)
+        index.erase(e.guild_id);
+
+    e.member = {};
+    e.next = free;
+    free = i;
+    --count;
+}
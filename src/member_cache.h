@@ -0,0 +1,53 @@
+#ifndef DISCORD_MEMBER_CACHE_H
+#define DISCORD_MEMBER_CACHE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "discord.h"
+#include "snowflake_map.h"
+
+namespace discord
+{
+// The guild members seen most recently, at most capacity of them across all guilds. Looking one
+// up or inserting it makes it the most recent, inserting past capacity drops the least recent.
+// The entries are allocated once, up to capacity, and reused from then on
+class member_cache
+{
+public:
+    explicit member_cache(size_t capacity);
+
+    const discord::member *find(discord::snowflake guild_id, discord::snowflake user_id);
+    // Replaces what was cached for the same member
+    void insert(discord::snowflake guild_id, discord::member m);
+    void erase(discord::snowflake guild_id, discord::snowflake user_id);
+
+    size_t size() const;
+    size_t capacity() const;
+
+private:
+    static constexpr uint32_t none = UINT32_MAX;
+
+    struct entry {
+        discord::snowflake guild_id;
+        discord::member member;
+        uint32_t prev;  // more recent
+        uint32_t next;  // less recent, or the next free entry
+    };
+
+    size_t max_size;
+    std::vector<entry> entries;
+    uint32_t most_recent;
+    uint32_t least_recent;
+    uint32_t free;
+    size_t count;
+    // guild id to user id to entry
+    discord::snowflake_map<discord::snowflake_map<uint32_t>> index;
+
+    void unlink(uint32_t i);
+    void push_front(uint32_t i);
+    void remove(uint32_t i);
+};
+}  // namespace discord
+
+#endif
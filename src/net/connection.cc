@@ -1,11 +1,28 @@
+#include <algorithm>
 #include <boost/asio/connect.hpp>
-#include <boost/beast/core/buffers_to_string.hpp>
+#include <boost/asio/post.hpp>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
 
 #include "connection.h"
 #include "errors.h"
 
 discord::connection::connection(boost::asio::io_context &io, ssl::context &tls)
-    : ctx{io}, resolver{ctx}, websock{ctx, tls}
+    : ctx{io}
+    , resolver{ctx}
+    , websock{ctx, tls}
+    , plain_websock{ctx}
+    , secure{true}
+    , writing{false}
+    , close_after_write{false}
+    , token_timer{ctx}
+    , waiting_for_token{false}
+    , burst{0}
+    , tokens{0}
+    , token_interval{0}
+    , peak_send_wait{0}
 {
 }
 
@@ -14,6 +31,17 @@ void discord::connection::connect(const std::string &url, error_cb c)
     connect_cb = c;
 
     info = uri::parse(url);
+    secure = info.scheme != "ws";
+    // A new connection is a new zlib stream
+    inflater.reset();
+    if (info.path.find("compress=zlib-stream") != std::string::npos)
+        inflater = std::make_unique<discord::inflate_stream>();
+    // ETF is binary, and the server wants it in binary messages
+    auto binary = info.path.find("encoding=etf") != std::string::npos;
+    with_websocket([binary](auto &ws) { ws.binary(binary); });
+    close_after_write = false;
+    tokens = burst;
+    refilled = clock::now();
 
     auto query = tcp::resolver::query{info.authority, std::to_string(info.port)};
     resolver.async_resolve(query, [this](const auto &ec, auto it) { on_resolve(ec, it); });
@@ -21,30 +49,157 @@ void discord::connection::connect(const std::string &url, error_cb c)
 
 void discord::connection::disconnect()
 {
-    auto ec = boost::system::error_code{};
-    websock.close(boost::beast::websocket::close_code::normal, ec);
-    websock.lowest_layer().close(ec);
+    token_timer.cancel();
+    auto dropped = std::deque<outgoing>{};
+    auto kept = writing ? 1 : 0;
+    std::move(outbox.begin() + kept, outbox.end(), std::back_inserter(dropped));
+    outbox.erase(outbox.begin() + kept, outbox.end());
+    for (auto &m : dropped)
+        boost::asio::post(ctx, [cb = std::move(m.cb)] {
+            cb(boost::asio::error::operation_aborted, 0);
+        });
+
+    // A close is a write too, it can't start while another one is going
+    if (writing)
+        close_after_write = true;
+    else
+        close();
+}
+
+void discord::connection::close()
+{
+    with_websocket([](auto &ws) {
+        auto ec = boost::system::error_code{};
+        ws.close(boost::beast::websocket::close_code::normal, ec);
+        ws.lowest_layer().close(ec);
+    });
 }
 
 void discord::connection::read(json_cb c)
 {
-    websock.async_read(buffer, [c, this](const auto &ec, auto transferred) {
+    read_message([c](const auto &ec, auto message) {
         auto json = nlohmann::json{};
-        if (!ec) {
-            auto data = boost::beast::buffers_to_string(buffer.data());
-            json = nlohmann::json::parse(data);
-        }
+        if (!ec)
+            json = nlohmann::json::parse(message.begin(), message.end());
         c(ec, json);
-        buffer.consume(transferred);
     });
 }
 
+void discord::connection::read_message(message_cb c)
+{
+    auto on_read = [c, this](const auto &ec, size_t) {
+        auto data = buffer.data();
+        auto message = std::string_view{static_cast<const char *>(data.data()), data.size()};
+        if (ec || !inflater) {
+            c(ec, ec ? std::string_view{} : message);
+            return;
+        }
+
+        try {
+            if (!inflater->feed(message)) {
+                // Only part of a payload, the rest is in the messages after
+                read_message(c);
+                return;
+            }
+        } catch (const std::runtime_error &e) {
+            std::cerr << "[connection] " << e.what() << "\n";
+            c(make_error_code(gateway_errc::decode_error), {});
+            return;
+        }
+        c(ec, inflater->payload());
+    };
+    // The previous message goes only now, its callback may have started this read
+    buffer.consume(buffer.size());
+    with_websocket([&](auto &ws) { ws.async_read(buffer, on_read); });
+}
+
 void discord::connection::send(const std::string &s, transfer_cb c)
 {
-    // TODO: use strand + message queue + timer for delay
-    auto ec = boost::system::error_code{};
-    auto wrote = websock.write(boost::asio::buffer(s), ec);
-    c(ec, wrote);
+    outbox.push_back({s, std::move(c), clock::now(), false});
+    write_next();
+}
+
+void discord::connection::send_heartbeat(const std::string &s, transfer_cb c)
+{
+    // Right behind the message being written, if any
+    auto first = outbox.begin() + (writing ? 1 : 0);
+    if (first != outbox.end() && first->heartbeat) {
+        boost::asio::post(ctx, [cb = std::move(first->cb)] {
+            cb(boost::asio::error::operation_aborted, 0);
+        });
+        *first = {s, std::move(c), clock::now(), true};
+    } else {
+        outbox.insert(first, {s, std::move(c), clock::now(), true});
+    }
+    write_next();
+}
+
+void discord::connection::set_rate_limit(size_t burst, std::chrono::nanoseconds interval)
+{
+    this->burst = burst;
+    tokens = burst;
+    token_interval = interval;
+    refilled = clock::now();
+}
+
+void discord::connection::write_next()
+{
+    if (writing || close_after_write || outbox.empty())
+        return;
+
+    auto &next = outbox.front();
+    if (!next.heartbeat && !take_token()) {
+        if (!waiting_for_token) {
+            waiting_for_token = true;
+            token_timer.expires_at(refilled + token_interval);
+            token_timer.async_wait([this](const auto &ec) {
+                waiting_for_token = false;
+                if (!ec)
+                    write_next();
+            });
+        }
+        return;
+    }
+
+    writing = true;
+    peak_send_wait = std::max(peak_send_wait, clock::now() - next.queued);
+    with_websocket([&](auto &ws) {
+        ws.async_write(boost::asio::buffer(next.data),
+                       [this](const auto &ec, size_t n) { on_write(ec, n); });
+    });
+}
+
+void discord::connection::on_write(const boost::system::error_code &ec, size_t transferred)
+{
+    auto done = std::move(outbox.front());
+    outbox.pop_front();
+    writing = false;
+    done.cb(ec, transferred);
+
+    if (close_after_write) {
+        close_after_write = false;
+        close();
+    } else {
+        write_next();
+    }
+}
+
+bool discord::connection::take_token()
+{
+    if (burst == 0)
+        return true;
+
+    // Tokens that came since the last refill, the time short of another one is kept
+    auto now = clock::now();
+    auto gained = (now - refilled) / token_interval;
+    if (gained > 0) {
+        tokens = std::min(burst, tokens + static_cast<size_t>(gained));
+        refilled = tokens == burst ? now : refilled + gained * token_interval;
+    }
+    if (tokens == 0)
+        return false;
+    --tokens;
+    return true;
 }
 
 void discord::connection::on_resolve(const boost::system::error_code &ec,
@@ -53,7 +208,8 @@ void discord::connection::on_resolve(const boost::system::error_code &ec,
     if (ec) {
         connect_cb(ec);
     } else {
-        boost::asio::async_connect(websock.next_layer().next_layer(), it,
+        auto &sock = secure ? websock.next_layer().next_layer() : plain_websock.next_layer();
+        boost::asio::async_connect(sock, it,
                                    [this](const auto &ec, auto it) { on_connect(ec, it); });
     }
 }
@@ -62,6 +218,9 @@ void discord::connection::on_connect(const boost::system::error_code &ec, tcp::r
 {
     if (ec) {
         connect_cb(ec);
+    } else if (!secure) {
+        plain_websock.async_handshake(info.authority, info.path,
+                                      [this](const auto &ec) { on_websocket_handshake(ec); });
     } else {
         websock.next_layer().set_verify_mode(ssl::verify_peer);
         websock.next_layer().set_verify_callback(ssl::rfc2818_verification(info.authority));
@@ -87,7 +246,20 @@ void discord::connection::on_websocket_handshake(const boost::system::error_code
 
 int discord::connection::close_code()
 {
-    if (websock.is_open())
-        return -1;
-    return websock.reason().code;
+    return with_websocket([](auto &ws) { return ws.is_open() ? -1 : ws.reason().code; });
+}
+
+const discord::inflate_stream *discord::connection::compression() const
+{
+    return inflater.get();
+}
+
+size_t discord::connection::send_queue_depth() const
+{
+    return outbox.size();
+}
+
+std::chrono::nanoseconds discord::connection::take_peak_send_wait()
+{
+    return std::exchange(peak_send_wait, std::chrono::nanoseconds{0});
 }
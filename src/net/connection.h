@@ -1,34 +1,99 @@
 #ifndef DISCORD_CONNECTION_H
 #define DISCORD_CONNECTION_H
 
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+
 #include "aliases.h"
 #include "callbacks.h"
+#include "net/inflate_stream.h"
 #include "net/uri.h"
 
 namespace discord
 {
+// A websocket client, over TLS for wss:// URLs and plain TCP for ws:// ones. A URL asking for
+// compress=zlib-stream gets its messages inflated before they are passed on, one asking for
+// encoding=etf sends binary messages.
+// Sends are queued and written one after the other without blocking, each callback runs once its
+// message is written. With a rate limit, messages wait for a token from a bucket holding up to
+// burst of them and gaining one every interval, except heartbeats, which go ahead of the queue
 class connection
 {
 public:
     connection(boost::asio::io_context &io, ssl::context &tls);
     void connect(const std::string &url, error_cb c);
+    // Messages still queued are dropped, their callbacks get operation_aborted. One being written
+    // is finished first, then the connection closes
     void disconnect();
     void read(json_cb c);
+    // The message as received, or inflated, valid until the next read starts
+    void read_message(message_cb c);
     void send(const std::string &s, transfer_cb c);
+    // Skips the rate limit and whatever is queued. A heartbeat still queued when the next one
+    // comes is replaced by it, its callback gets operation_aborted
+    void send_heartbeat(const std::string &s, transfer_cb c);
+    void set_rate_limit(size_t burst, std::chrono::nanoseconds interval);
     int close_code();
+    // The inflate context of a compressed connection, for its totals, null otherwise
+    const discord::inflate_stream *compression() const;
+
+    // Messages queued, the one being written included, and the longest one of them waited to start
+    // being written since the last call
+    size_t send_queue_depth() const;
+    std::chrono::nanoseconds take_peak_send_wait();
 
 private:
     boost::asio::io_context &ctx;
     tcp::resolver resolver;
     secure_websocket websock;
-    boost::beast::multi_buffer buffer;
+    plain_websocket plain_websock;
+    bool secure;
+    boost::beast::flat_buffer buffer;
+    std::unique_ptr<discord::inflate_stream> inflater;
     error_cb connect_cb;
     uri::parsed_uri info;
 
+    using clock = std::chrono::steady_clock;
+    struct outgoing {
+        std::string data;
+        transfer_cb cb;
+        clock::time_point queued;
+        bool heartbeat;
+    };
+    // The front one is being written while writing is set
+    std::deque<outgoing> outbox;
+    bool writing;
+    bool close_after_write;
+    boost::asio::steady_timer token_timer;
+    bool waiting_for_token;
+    size_t burst;  // 0 for no rate limit
+    size_t tokens;
+    std::chrono::nanoseconds token_interval;
+    clock::time_point refilled;
+    std::chrono::nanoseconds peak_send_wait;
+
     void on_resolve(const boost::system::error_code &ec, tcp::resolver::iterator it);
     void on_connect(const boost::system::error_code &ec, tcp::resolver::iterator);
     void on_tls_handshake(const boost::system::error_code &ec);
     void on_websocket_handshake(const boost::system::error_code &ec);
+    void write_next();
+    void on_write(const boost::system::error_code &ec, size_t transferred);
+    bool take_token();
+    void close();
+
+    // Calls f with whichever websocket the URL connected was for
+    template<typename F>
+    decltype(auto) with_websocket(F &&f)
+    {
+        if (secure)
+            return f(websock);
+        return f(plain_websock);
+    }
 };
 }  // namespace discord
 
@@ -0,0 +1,129 @@
+#ifndef DISCORD_HANDLER_MEMORY_H
+#define DISCORD_HANDLER_MEMORY_H
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace discord
+{
+// Fixed blocks for asio to put the state of in-flight operations in, so starting one doesn't go to
+// the heap. Falls back to the heap when the operation is bigger than a block or every block is in
+// use. Not thread safe, use it for operations started and completed on one thread.
+// See the custom allocation example in the asio documentation
+template<size_t BlockSize, size_t Blocks>
+class handler_memory
+{
+public:
+    handler_memory() = default;
+    handler_memory(const handler_memory &) = delete;
+    handler_memory &operator=(const handler_memory &) = delete;
+
+    void *allocate(size_t size)
+    {
+        if (size <= BlockSize) {
+            for (auto i = size_t{0}; i < Blocks; ++i) {
+                if (!used[i]) {
+                    used[i] = true;
+                    return &storage[i];
+                }
+            }
+        }
+        return ::operator new(size);
+    }
+
+    void deallocate(void *pointer)
+    {
+        auto *block = static_cast<block_type *>(pointer);
+        if (block >= storage.data() && block < storage.data() + Blocks)
+            used[block - storage.data()] = false;
+        else
+            ::operator delete(pointer);
+    }
+
+private:
+    using block_type = std::aligned_storage_t<BlockSize, alignof(std::max_align_t)>;
+    std::array<block_type, Blocks> storage;
+    std::bitset<Blocks> used;
+};
+
+// Standard allocator over a handler_memory, what asio asks a handler for
+template<typename T, typename Memory>
+class handler_allocator
+{
+public:
+    using value_type = T;
+
+    explicit handler_allocator(Memory &memory) : memory{memory} {}
+
+    template<typename U>
+    handler_allocator(const handler_allocator<U, Memory> &other) : memory{other.memory}
+    {
+    }
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(memory.allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T *p, size_t)
+    {
+        memory.deallocate(p);
+    }
+
+    template<typename U>
+    bool operator==(const handler_allocator<U, Memory> &other) const
+    {
+        return &memory == &other.memory;
+    }
+
+    template<typename U>
+    bool operator!=(const handler_allocator<U, Memory> &other) const
+    {
+        return &memory != &other.memory;
+    }
+
+private:
+    template<typename, typename>
+    friend class handler_allocator;
+
+    Memory &memory;
+};
+
+// Wraps a completion handler so asio allocates its operation from memory
+template<typename Handler, typename Memory>
+class custom_alloc_handler
+{
+public:
+    using allocator_type = handler_allocator<Handler, Memory>;
+
+    custom_alloc_handler(Memory &memory, Handler h) : memory{memory}, handler{std::move(h)} {}
+
+    allocator_type get_allocator() const noexcept
+    {
+        return allocator_type{memory};
+    }
+
+    template<typename... Args>
+    void operator()(Args &&... args)
+    {
+        handler(std::forward<Args>(args)...);
+    }
+
+private:
+    Memory &memory;
+    Handler handler;
+};
+
+template<typename Handler, typename Memory>
+custom_alloc_handler<std::decay_t<Handler>, Memory> make_custom_alloc_handler(Memory &memory,
+                                                                              Handler &&handler)
+{
+    return {memory, std::forward<Handler>(handler)};
+}
+}  // namespace discord
+
+#endif
@@ -0,0 +1,103 @@
+#include <stdexcept>
+#include <time.h>
+
+#include "net/inflate_stream.h"
+
+namespace
+{
+std::chrono::nanoseconds thread_cpu_time()
+{
+    auto ts = timespec{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
+}
+
+bool ends_with_flush(std::string_view data)
+{
+    return data.size() >= 4 && data.substr(data.size() - 4) == std::string_view{"\0\0\xff\xff", 4};
+}
+}  // namespace
+
+discord::inflate_stream::inflate_stream()
+    : zs{}
+    , out(64 * 1024, '\0')
+    , out_size{0}
+    , pending_compressed{0}
+    , last_compressed{0}
+    , complete{false}
+    , total_in{0}
+    , total_out{0}
+    , cpu_time{0}
+{
+    if (inflateInit(&zs) != Z_OK)
+        throw std::runtime_error{"Could not initialize zlib"};
+}
+
+discord::inflate_stream::~inflate_stream()
+{
+    inflateEnd(&zs);
+}
+
+bool discord::inflate_stream::feed(std::string_view compressed)
+{
+    // The previous payload goes only now, it may still have been in use until this call
+    if (complete) {
+        out_size = 0;
+        complete = false;
+    }
+
+    auto start = thread_cpu_time();
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(compressed.data()));
+    zs.avail_in = static_cast<uInt>(compressed.size());
+    // A full buffer may leave output behind in zlib even with all input taken, so it grows and
+    // inflate runs again until there is room left over
+    do {
+        if (out_size == out.size())
+            out.resize(out.size() * 2);
+        zs.next_out = reinterpret_cast<Bytef *>(&out[out_size]);
+        zs.avail_out = static_cast<uInt>(out.size() - out_size);
+
+        auto ret = inflate(&zs, Z_SYNC_FLUSH);
+        out_size = out.size() - zs.avail_out;
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+            throw std::runtime_error{std::string{"Could not inflate gateway message: "} +
+                                     (zs.msg ? zs.msg : "unexpected end of stream")};
+    } while (zs.avail_in > 0 || zs.avail_out == 0);
+    cpu_time += thread_cpu_time() - start;
+
+    total_in += compressed.size();
+    pending_compressed += compressed.size();
+    if (!ends_with_flush(compressed))
+        return false;
+
+    total_out += out_size;
+    last_compressed = pending_compressed;
+    pending_compressed = 0;
+    complete = true;
+    return true;
+}
+
+std::string_view discord::inflate_stream::payload() const
+{
+    return complete ? std::string_view{out.data(), out_size} : std::string_view{};
+}
+
+size_t discord::inflate_stream::payload_compressed_size() const
+{
+    return last_compressed;
+}
+
+size_t discord::inflate_stream::compressed_bytes() const
+{
+    return total_in;
+}
+
+size_t discord::inflate_stream::inflated_bytes() const
+{
+    return total_out;
+}
+
+std::chrono::nanoseconds discord::inflate_stream::inflate_time() const
+{
+    return cpu_time;
+}
@@ -0,0 +1,49 @@
+#ifndef DISCORD_INFLATE_STREAM_H
+#define DISCORD_INFLATE_STREAM_H
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <zlib.h>
+
+namespace discord
+{
+// The receiving end of the gateway's zlib-stream transport. The whole connection is one zlib
+// stream, so the context lives as long as the connection and every message inflates against the
+// history of the ones before it. A payload ends with a sync flush, 00 00 FF FF, and may come in
+// several websocket messages. Payloads inflate into one buffer that keeps its capacity
+class inflate_stream
+{
+public:
+    inflate_stream();
+    ~inflate_stream();
+    inflate_stream(const inflate_stream &) = delete;
+    inflate_stream &operator=(const inflate_stream &) = delete;
+
+    // Inflates a websocket message, true when it completed a payload. Throws std::runtime_error
+    // when the data is not a valid continuation of the stream
+    bool feed(std::string_view compressed);
+    // The last completed payload, valid until the next feed
+    std::string_view payload() const;
+    // Compressed size of the last completed payload
+    size_t payload_compressed_size() const;
+
+    // Totals over the connection, and the thread CPU time spent in inflate
+    size_t compressed_bytes() const;
+    size_t inflated_bytes() const;
+    std::chrono::nanoseconds inflate_time() const;
+
+private:
+    z_stream zs;
+    std::string out;
+    size_t out_size;
+    size_t pending_compressed;
+    size_t last_compressed;
+    bool complete;
+    size_t total_in;
+    size_t total_out;
+    std::chrono::nanoseconds cpu_time;
+};
+}  // namespace discord
+
+#endif
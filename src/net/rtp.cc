@@ -6,8 +6,9 @@
 #include "net/rtp.h"
 #include "voice/crypto.h"
 
-discord::rtp_session::rtp_session(boost::asio::io_context &ctx)
-    : sock{ctx}
+discord::rtp_session::rtp_session(boost::asio::io_context &ctx, discord::udp_egress *egress)
+    : egress{egress}
+    , sock{ctx}
     , resolver{ctx}
     , timer{ctx}
     , ssrc{0}
@@ -15,18 +16,30 @@ discord::rtp_session::rtp_session(boost::asio::io_context &ctx)
     , seq_num{(uint16_t) rand()}
     , external_port{0}
     , buffer(1024)
+    , unreported_send_errors{0}
 {
     sock.open(udp::v4());
 }
 
+discord::rtp_session::~rtp_session()
+{
+    if (egress)
+        egress->forget(this);
+}
+
 void discord::rtp_session::connect(const std::string &host, const std::string &port, error_cb c)
 {
     auto query = udp::resolver::query{udp::v4(), host, port};
     resolver.async_resolve(query, [=](const auto &ec, auto it) {
         if (ec) {
             c(ec);  // host resolve error
+        } else if (egress) {
+            remote = *it;
+            std::cout << "[RTP] udp remote: " << remote << " (batched)\n";
+            c({});
         } else {
-            sock.connect(*it);
+            remote = *it;
+            sock.connect(remote);
             std::cout << "[RTP] udp local: " << sock.local_endpoint()
                       << " remote: " << sock.remote_endpoint() << "\n";
             c({});
@@ -36,6 +49,20 @@ void discord::rtp_session::connect(const std::string &host, const std::string &p
 
 void discord::rtp_session::ip_discovery(error_cb c)
 {
+    if (egress) {
+        // Packets will come from the egress socket, that's the address the server has to know
+        egress->discover(this, remote, ssrc, [this, c](const auto &ec, const auto &ip, auto port) {
+            if (!ec) {
+                external_ip = ip;
+                external_port = port;
+                std::cout << "[RTP] udp socket external addresses " << external_ip << ":"
+                          << external_port << "\n";
+            }
+            c(ec);
+        });
+        return;
+    }
+
     // Prepare buffer for ip discovery
     std::memset(buffer.data(), 0, 70);
     buffer[0] = (ssrc >> 24) & 0xFF;
@@ -117,49 +144,52 @@ static void write_rtp_header(unsigned char *buffer, uint16_t seq_num, uint32_t t
     buffer[11] = (ssrc >> 0) & 0xFF;
 }
 
-static void print_rtp_send_info(const boost::system::error_code &ec, size_t transferred)
+size_t discord::rtp_session::seal(opus_frame &frame)
 {
-    static auto bytes_sent = 0LL;
-    bytes_sent += transferred;
-    if (ec) {
-        std::cerr << "[RTP] error: " << ec.message() << "\n";
-    } else {
-        std::cout << "[RTP] " << transferred << " bytes sent (" << bytes_sent << " total)\r";
-    }
-}
-
-void discord::rtp_session::send(const opus_frame &frame)
-{
-    auto size = frame.data.size();
-    auto encrypted_len = size + 12 + crypto_secretbox_MACBYTES;
-
-    // Make sure we have enough room to store the encoded audio, 12 bytes for
-    // RTP header, crypto_secretbox_MACBYTES (for MAC) in buffer
-    if (encrypted_len > buffer.size())
-        buffer.resize(encrypted_len);
-
-    auto buf = buffer.data();
-    auto write_audio = &buf[12];
-    auto nonce = std::array<uint8_t, 24>{};
+    // Encryption adds a MAC and for some modes a nonce after the audio
+    static_assert(opus_frame::header_room == discord::crypto::voice_cipher::header_size);
+    static_assert(opus_frame::trailer_room >= discord::crypto::voice_cipher::max_overhead);
 
+    auto buf = frame.packet.data();
     write_rtp_header(buf, seq_num, timestamp, ssrc);
 
-    // First 12 bytes of nonce are RTP header, next 12 are 0s
-    std::memcpy(&nonce[0], buf, 12);
-    std::memset(&nonce[12], 0, 12);
-
     seq_num++;
     timestamp += frame.frame_count;
 
-    auto error = discord::crypto::xsalsa20_poly1305_encrypt(frame.data.data(), write_audio, size,
-                                                            secret_key.data(), nonce.data());
-
-    if (error) {
+    // In place, libsodium allows the message and ciphertext to overlap
+    auto size = cipher.seal(buf, frame.size);
+    if (size == 0)
         std::cerr << "[RTP] error encrypting data\n";
-        return;
-    }
+    return size;
+}
+
+void discord::rtp_session::unseal(opus_frame &frame)
+{
+    auto buf = frame.packet.data();
+    if (!cipher.open(buf, frame.size))
+        std::cerr << "[RTP] error decrypting data\n";
 
-    sock.async_send(boost::asio::buffer(buf, encrypted_len), ignore_transfer);
+    seq_num = static_cast<uint16_t>((buf[2] << 8) | buf[3]);
+    timestamp = (uint32_t{buf[4]} << 24) | (uint32_t{buf[5]} << 16) | (uint32_t{buf[6]} << 8) |
+                uint32_t{buf[7]};
+}
+
+void discord::rtp_session::skip(uint32_t samples)
+{
+    timestamp += samples;
+}
+
+// Called for every packet that fails, logged at most every few seconds with how many did
+void discord::rtp_session::on_send_error(const boost::system::error_code &ec)
+{
+    unreported_send_errors++;
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_send_error_report < std::chrono::seconds(5))
+        return;
+    std::cerr << "[RTP] could not send " << unreported_send_errors
+              << " packets, last error: " << ec.message() << "\n";
+    unreported_send_errors = 0;
+    last_send_error_report = now;
 }
 
 void discord::rtp_session::set_ssrc(uint32_t ssrc)
@@ -167,9 +197,10 @@ void discord::rtp_session::set_ssrc(uint32_t ssrc)
     this->ssrc = ssrc;
 }
 
-void discord::rtp_session::set_secret_key(std::vector<uint8_t> key)
+void discord::rtp_session::set_secret_key(discord::crypto::mode mode,
+                                          const std::vector<uint8_t> &key)
 {
-    secret_key = std::move(key);
+    cipher.set_key(mode, key);
 }
 
 const std::string &discord::rtp_session::get_external_ip() const
@@ -3,29 +3,59 @@
 
 #include <boost/asio/deadline_timer.hpp>
 #include <boost/asio/io_context.hpp>
+#include <chrono>
 #include <cstdint>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "aliases.h"
 #include "audio/source.h"
 #include "callbacks.h"
+#include "net/handler_memory.h"
+#include "net/udp_egress.h"
+#include "voice/crypto.h"
 
 namespace discord
 {
 class rtp_session
 {
 public:
-    rtp_session(boost::asio::io_context &ctx);
+    // With an egress, packets go out through its shared socket in batches instead of this
+    // session's own socket
+    rtp_session(boost::asio::io_context &ctx, discord::udp_egress *egress = nullptr);
+    ~rtp_session();
     void connect(const std::string &host, const std::string &port, error_cb c);
     void ip_discovery(error_cb c);
-    void send(const opus_frame &frame);
+
+    // Seals frame in place and sends it straight from its buffer, which has to stay valid until
+    // on_sent(error_code, size_t) is called. A frame that can't be sealed completes right away
+    template<typename Handler>
+    void send(opus_frame &frame, Handler &&on_sent);
+
+    // The two halves of send, so packets can be sealed ahead of their deadline. seal() writes the
+    // RTP header in front of the payload and encrypts the payload in place, taking the next
+    // sequence number and timestamp; it returns the packet's size, 0 if it could not be made.
+    // unseal() turns the last sealed frame back into plain audio and gives its sequence number and
+    // timestamp back, so the next packet sealed continues the stream without a gap
+    size_t seal(opus_frame &frame);
+    void unseal(opus_frame &frame);
+    // Moves the timestamp of the next packet sealed on by samples that were never sent, so the
+    // receiver plays the gap as silence instead of pulling the audio after it forward
+    void skip(uint32_t samples);
+    template<typename Handler>
+    void send_sealed(opus_frame &frame, size_t size, Handler &&on_sent);
+
     void set_ssrc(uint32_t ssrc);
-    void set_secret_key(std::vector<uint8_t> key);
+    void set_secret_key(discord::crypto::mode mode, const std::vector<uint8_t> &key);
     const std::string &get_external_ip() const;
     uint16_t get_external_port() const;
 
 private:
+    friend class udp_egress;
+
+    discord::udp_egress *egress;
+    udp::endpoint remote;
     udp::socket sock;
     udp::resolver resolver;
     boost::asio::deadline_timer timer;
@@ -35,11 +65,42 @@ private:
     uint16_t external_port;
     std::string external_ip;
     std::vector<uint8_t> buffer;
-    std::vector<uint8_t> secret_key;
+    discord::crypto::voice_cipher cipher;
+
+    // Packets the egress could not send since the last time that was logged
+    uint64_t unreported_send_errors;
+    std::chrono::steady_clock::time_point last_send_error_report;
+
+    // Operation state for the sends in flight, one per frame the audio queue can hold
+    discord::handler_memory<256, 8> send_memory;
 
     void send_ip_discovery_datagram(int retries, error_cb c);
+    void on_send_error(const boost::system::error_code &ec);
 };
 
 }  // namespace discord
 
+template<typename Handler>
+void discord::rtp_session::send(opus_frame &frame, Handler &&on_sent)
+{
+    send_sealed(frame, seal(frame), std::forward<Handler>(on_sent));
+}
+
+template<typename Handler>
+void discord::rtp_session::send_sealed(opus_frame &frame, size_t size, Handler &&on_sent)
+{
+    if (size == 0) {
+        on_sent(make_error_code(boost::system::errc::message_size), 0);
+        return;
+    }
+    if (egress) {
+        // Copied into the batch, the frame is free again right away
+        egress->queue(this, frame.packet.data(), size, remote);
+        on_sent(boost::system::error_code{}, size);
+        return;
+    }
+    sock.async_send(boost::asio::buffer(frame.packet.data(), size),
+                    make_custom_alloc_handler(send_memory, std::forward<Handler>(on_sent)));
+}
+
 #endif
@@ -0,0 +1,284 @@
+#include <algorithm>
+#include <boost/asio/post.hpp>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#include "errors.h"
+#include "net/rtp.h"
+#include "net/udp_egress.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103  // Linux 4.18, older headers don't have it
+#endif
+
+discord::udp_egress::udp_egress(boost::asio::io_context &ctx)
+    : ctx{ctx}
+    , sock{ctx, udp::endpoint{udp::v4(), 0}}
+    , gso{true}
+    , flush_posted{false}
+    , receiving{false}
+    , packets_sent{0}
+    , syscalls{0}
+    , flushes{0}
+    , taken_packets{0}
+    , taken_syscalls{0}
+{
+    sock.non_blocking(true);
+    bytes.reserve(64 * 1024);
+    std::cout << "[egress] sending voice from " << sock.local_endpoint() << "\n";
+}
+
+discord::udp_egress::~udp_egress()
+{
+    auto ec = boost::system::error_code{};
+    sock.close(ec);
+}
+
+void discord::udp_egress::discover(rtp_session *session, const udp::endpoint &server,
+                                   uint32_t ssrc, discovery_cb c)
+{
+    auto d = std::make_unique<discovery>();
+    d->session = session;
+    d->server = server;
+    d->request.fill(0);
+    d->request[0] = (ssrc >> 24) & 0xFF;
+    d->request[1] = (ssrc >> 16) & 0xFF;
+    d->request[2] = (ssrc >> 8) & 0xFF;
+    d->request[3] = (ssrc >> 0) & 0xFF;
+    d->timer = std::make_unique<boost::asio::steady_timer>(ctx);
+    d->retries = 5;
+    d->cb = std::move(c);
+    discoveries.push_back(std::move(d));
+
+    receive();
+    send_discovery(*discoveries.back());
+}
+
+// Same schedule as rtp_session: up to 5 retries 200 ms apart
+void discord::udp_egress::send_discovery(discovery &d)
+{
+    auto ec = boost::system::error_code{};
+    sock.send_to(boost::asio::buffer(d.request), d.server, 0, ec);
+    if (ec)
+        std::cerr << "[egress] could not send udp packet to voice server: " << ec.message() << "\n";
+
+    d.timer->expires_after(std::chrono::milliseconds(200));
+    d.timer->async_wait([this, &d](const auto &ec) {
+        if (ec)
+            return;  // answered or forgotten, d is gone
+        if (d.retries-- > 0) {
+            send_discovery(d);
+            return;
+        }
+
+        auto cb = std::move(d.cb);
+        auto it = std::find_if(discoveries.begin(), discoveries.end(),
+                               [&](const auto &p) { return p.get() == &d; });
+        discoveries.erase(it);
+        cb(voice_errc::ip_discovery_failed, {}, 0);
+    });
+}
+
+// Answers to discovery, and anything else voice servers send, arrive on the shared socket
+void discord::udp_egress::receive()
+{
+    if (receiving)
+        return;
+    receiving = true;
+
+    auto on_receive = [this](const auto &ec, auto transferred) {
+        if (ec == boost::asio::error::operation_aborted)
+            return;
+        receiving = false;
+        if (!ec)
+            this->on_receive(transferred);
+        receive();
+    };
+    sock.async_receive_from(boost::asio::buffer(receive_buffer), receive_from,
+                            make_custom_alloc_handler(receive_memory, on_receive));
+}
+
+void discord::udp_egress::on_receive(size_t transferred)
+{
+    if (transferred < 70)
+        return;
+
+    auto it = std::find_if(discoveries.begin(), discoveries.end(),
+                           [&](const auto &d) { return d->server == receive_from; });
+    if (it == discoveries.end())
+        return;
+
+    // First 4 bytes are the SSRC, then the external IP, the last 2 bytes are the port (little
+    // endian)
+    auto ip = std::string(reinterpret_cast<char *>(&receive_buffer[4]));
+    auto port = static_cast<uint16_t>((receive_buffer[69] << 8) | receive_buffer[68]);
+
+    auto cb = std::move((*it)->cb);
+    discoveries.erase(it);
+    cb({}, ip, port);
+}
+
+void discord::udp_egress::queue(rtp_session *session, const uint8_t *data, size_t size,
+                                const udp::endpoint &destination)
+{
+    auto offset = bytes.size();
+    bytes.insert(bytes.end(), data, data + size);
+    batch.push_back(packet{session, offset, size, destination});
+
+    // Every packet queued until the running handler (the scheduler tick) returns goes out together
+    if (!flush_posted) {
+        flush_posted = true;
+        boost::asio::post(ctx, make_custom_alloc_handler(flush_memory, [this] { flush(); }));
+    }
+}
+
+void discord::udp_egress::forget(rtp_session *session)
+{
+    for (auto &p : batch) {
+        if (p.session == session)
+            p.session = nullptr;
+    }
+    discoveries.erase(std::remove_if(discoveries.begin(), discoveries.end(),
+                                     [&](const auto &d) { return d->session == session; }),
+                      discoveries.end());
+}
+
+double discord::udp_egress::take_syscalls_per_packet()
+{
+    // Syscalls are counted before their packets, the ratio can only come out a little high
+    auto packets = packets_sent.load(std::memory_order_relaxed);
+    auto calls = syscalls.load(std::memory_order_relaxed);
+    auto sent = packets - taken_packets;
+    auto made = calls - taken_syscalls;
+    taken_packets = packets;
+    taken_syscalls = calls;
+    return sent ? static_cast<double>(made) / sent : 0.0;
+}
+
+void discord::udp_egress::flush()
+{
+    flush_posted = false;
+    if (batch.empty())
+        return;
+
+    build_messages(0);
+    auto next = size_t{0};
+    while (next < messages.size())
+        next = send_messages(next);
+
+    packets_sent += batch.size();
+    batch.clear();
+    bytes.clear();
+
+    if (++flushes % report_interval == 0) {
+        auto packets = packets_sent.load(std::memory_order_relaxed);
+        auto calls = syscalls.load(std::memory_order_relaxed);
+        std::cout << "[egress] " << packets << " packets in " << calls << " system calls ("
+                  << static_cast<double>(calls) / packets << " per packet)\n";
+    }
+}
+
+// Groups the batch from packet first on into sendmmsg messages. With GSO, consecutive packets to
+// the same destination become one message as long as none is bigger than the first, the kernel
+// cuts it back up at the first packet's size and only the last segment may be shorter
+void discord::udp_egress::build_messages(size_t first)
+{
+    messages.clear();
+    for (auto i = first; i < batch.size();) {
+        if (!batch[i].session) {
+            i++;
+            continue;
+        }
+
+        auto count = size_t{1};
+        auto total = batch[i].size;
+        while (gso && i + count < batch.size() && count < max_segments) {
+            const auto &next = batch[i + count];
+            if (!next.session || next.destination != batch[i].destination ||
+                next.size > batch[i].size || total + next.size > max_gso_bytes)
+                break;
+            total += next.size;
+            count++;
+            if (next.size < batch[i].size)
+                break;
+        }
+        messages.push_back(message{i, count});
+        i += count;
+    }
+
+    // Queued packets are contiguous in bytes, so a message is a single iovec
+    headers.resize(messages.size());
+    iovecs.resize(messages.size());
+    controls.resize(messages.size());
+    for (auto k = size_t{0}; k < messages.size(); ++k) {
+        const auto &m = messages[k];
+        auto &p = batch[m.first];
+        auto total = size_t{0};
+        for (auto i = m.first; i < m.first + m.count; ++i)
+            total += batch[i].size;
+        iovecs[k].iov_base = &bytes[p.offset];
+        iovecs[k].iov_len = total;
+
+        auto &h = headers[k].msg_hdr;
+        std::memset(&headers[k], 0, sizeof(headers[k]));
+        h.msg_name = p.destination.data();
+        h.msg_namelen = p.destination.size();
+        h.msg_iov = &iovecs[k];
+        h.msg_iovlen = 1;
+
+        if (m.count > 1) {
+            auto segment = static_cast<uint16_t>(p.size);
+            h.msg_control = controls[k].data();
+            h.msg_controllen = CMSG_SPACE(sizeof(segment));
+            auto *cmsg = CMSG_FIRSTHDR(&h);
+            cmsg->cmsg_level = IPPROTO_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(segment));
+            std::memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+        }
+    }
+}
+
+// Sends messages from first on with one system call. Returns the message to continue from
+size_t discord::udp_egress::send_messages(size_t first)
+{
+    auto n = static_cast<unsigned int>(headers.size() - first);
+    auto sent = ::sendmmsg(sock.native_handle(), &headers[first], n, MSG_DONTWAIT);
+    syscalls++;
+    if (sent > 0)
+        return first + sent;
+
+    auto error = errno;
+    auto ec = boost::system::error_code{error, boost::system::system_category()};
+    if (gso && messages[first].count > 1 &&
+        (error == EIO || error == EINVAL || error == ENOPROTOOPT)) {
+        // The kernel or the NIC can't segment, send every packet by itself from now on
+        std::cerr << "[egress] UDP GSO unavailable (" << ec.message()
+                  << "), sending packets individually\n";
+        gso = false;
+        build_messages(messages[first].first);
+        return 0;
+    }
+
+    if (error == EAGAIN || error == EWOULDBLOCK) {
+        // The socket buffer is full. Audio that can't go out now is useless later, drop the rest
+        for (auto k = first; k < messages.size(); ++k)
+            report_error(messages[k], ec);
+        return messages.size();
+    }
+
+    // The first message failed by itself, e.g. an unreachable server, the others may still go
+    report_error(messages[first], ec);
+    return first + 1;
+}
+
+void discord::udp_egress::report_error(const message &m, const boost::system::error_code &ec)
+{
+    for (auto i = m.first; i < m.first + m.count; ++i) {
+        if (batch[i].session)
+            batch[i].session->on_send_error(ec);
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef DISCORD_NET_UDP_EGRESS_H
+#define DISCORD_NET_UDP_EGRESS_H
+
+#include <array>
+#include <atomic>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+#include "aliases.h"
+#include "net/handler_memory.h"
+
+namespace discord
+{
+class rtp_session;
+
+// One UDP socket shared by the RTP sessions of every guild, so the packets due on a scheduler tick
+// go out together: queued packets are flushed with a single sendmmsg once the tick's handlers have
+// run, and runs of equal-sized packets to the same server become one UDP GSO message where the
+// kernel supports it. Failed messages are reported to the session they came from.
+//
+// Voice servers tell sessions apart by SSRC, so they can share the socket's address; IP discovery
+// still runs per server, NATs may map each destination differently
+class udp_egress
+{
+public:
+    using discovery_cb =
+        std::function<void(const boost::system::error_code &, const std::string &, uint16_t)>;
+
+    explicit udp_egress(boost::asio::io_context &ctx);
+    ~udp_egress();
+
+    // Learns the address the server sees this socket as, like rtp_session::ip_discovery
+    void discover(rtp_session *session, const udp::endpoint &server, uint32_t ssrc,
+                  discovery_cb c);
+
+    // Copies the packet into the current batch, which goes out after the running handler returns
+    void queue(rtp_session *session, const uint8_t *data, size_t size,
+               const udp::endpoint &destination);
+
+    // Drops everything still referring to session, it is going away
+    void forget(rtp_session *session);
+
+    // System calls per packet sent since the last call, from any one thread. 0 if nothing was sent
+    double take_syscalls_per_packet();
+
+private:
+    // Segments the kernel accepts in one GSO send
+    static constexpr size_t max_segments = 64;
+    static constexpr size_t max_gso_bytes = 65000;
+    static constexpr uint64_t report_interval = 3000;  // flushes, about a minute of ticks
+
+    struct packet {
+        rtp_session *session;
+        size_t offset;  // into bytes
+        size_t size;
+        udp::endpoint destination;
+    };
+
+    struct message {
+        size_t first;  // packet index
+        size_t count;
+    };
+
+    struct discovery {
+        rtp_session *session;
+        udp::endpoint server;
+        std::array<uint8_t, 70> request;
+        std::unique_ptr<boost::asio::steady_timer> timer;
+        int retries;
+        discovery_cb cb;
+    };
+
+    boost::asio::io_context &ctx;
+    udp::socket sock;
+    bool gso;
+
+    std::vector<packet> batch;
+    std::vector<uint8_t> bytes;
+    bool flush_posted;
+    discord::handler_memory<128, 1> flush_memory;
+
+    // Rebuilt by every flush, kept to reuse their memory
+    std::vector<message> messages;
+    std::vector<mmsghdr> headers;
+    std::vector<iovec> iovecs;
+    std::vector<std::array<uint8_t, 64>> controls;
+
+    std::vector<std::unique_ptr<discovery>> discoveries;
+    std::array<uint8_t, 2048> receive_buffer;
+    udp::endpoint receive_from;
+    bool receiving;
+    discord::handler_memory<256, 1> receive_memory;
+
+    std::atomic<uint64_t> packets_sent;
+    std::atomic<uint64_t> syscalls;
+    uint64_t flushes;
+    uint64_t taken_packets;  // counts at the last take_syscalls_per_packet
+    uint64_t taken_syscalls;
+
+    void flush();
+    void build_messages(size_t first);
+    size_t send_messages(size_t first);
+    void report_error(const message &m, const boost::system::error_code &ec);
+    void send_discovery(discovery &d);
+    void receive();
+    void on_receive(size_t transferred);
+};
+}  // namespace discord
+
+#endif
@@ -1,32 +1,95 @@
-#include <regex>
+#include <charconv>
 
 #include "net/uri.h"
 
-uri::parsed_uri uri::parse(const std::string &uri)
+static bool is_host_char(char c)
 {
-    static const auto re = std::regex{
-        R"(^(?:(\S+)://)?([A-Za-z0-9.-]{2,})(?::(\d+))?(/[/A-Za-z0-9-._~:/?#\[\]%@!$&'()*+,;=`]*)?$)"};
-    auto matcher = std::smatch{};
-    auto path = std::string{};
-    auto port = -1;
-
-    std::regex_match(uri, matcher, re);
-    if (matcher.empty())
-        return {"", "", "", -1};
-
-    auto scheme = matcher.str(1);
-    auto authority = matcher.str(2);
-    if (!matcher.str(3).empty()) {
-        port = std::stoi(matcher.str(3));
-    } else {
-        if (scheme == "http" || scheme == "ws")
-            port = 80;
-        else if (scheme == "https" || scheme == "wss")
-            port = 443;
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+           c == '.' || c == '-';
+}
+
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Unreserved and reserved characters of RFC 3986 and %, plus `
+static bool is_path_char(char c)
+{
+    constexpr auto others = std::string_view{"-._~:/?#[]@!$&'()*+,;=%`"};
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+           others.find(c) != std::string_view::npos;
+}
+
+static bool is_space(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// host[:port][/path], the host at least two characters
+static bool parse_after_scheme(std::string_view s, uri::parsed_uri_view &parsed)
+{
+    auto at = size_t{0};
+    while (at < s.size() && is_host_char(s[at]))
+        ++at;
+    if (at < 2)
+        return false;
+    parsed.authority = s.substr(0, at);
+
+    parsed.port = -1;
+    if (at < s.size() && s[at] == ':') {
+        auto digits = ++at;
+        while (at < s.size() && is_digit(s[at]))
+            ++at;
+        auto [end, ec] = std::from_chars(s.data() + digits, s.data() + at, parsed.port);
+        if (at == digits || ec != std::errc{})
+            return false;
     }
-    if (!matcher.str(4).empty())
-        path = matcher.str(4);
-    else
-        path = "/";
-    return {scheme, authority, path, port};
+
+    parsed.path = "/";
+    if (at < s.size()) {
+        if (s[at] != '/')
+            return false;
+        parsed.path = s.substr(at);
+        for (auto c : parsed.path)
+            if (!is_path_char(c))
+                return false;
+    }
+    return true;
+}
+
+uri::parsed_uri_view uri::parse_view(std::string_view uri)
+{
+    auto parsed = parsed_uri_view{};
+    auto found = false;
+    // The longest scheme that leaves a valid rest, a scheme is anything but whitespace
+    for (auto sep = uri.rfind("://"); !found && sep != std::string_view::npos && sep > 0;
+         sep = uri.rfind("://", sep - 1)) {
+        parsed.scheme = uri.substr(0, sep);
+        auto spaced = false;
+        for (auto c : parsed.scheme)
+            spaced = spaced || is_space(c);
+        found = !spaced && parse_after_scheme(uri.substr(sep + 3), parsed);
+    }
+    if (!found) {
+        parsed.scheme = {};
+        found = parse_after_scheme(uri, parsed);
+    }
+    if (!found)
+        return {{}, {}, {}, -1};
+
+    if (parsed.port == -1) {
+        if (parsed.scheme == "http" || parsed.scheme == "ws")
+            parsed.port = 80;
+        else if (parsed.scheme == "https" || parsed.scheme == "wss")
+            parsed.port = 443;
+    }
+    return parsed;
+}
+
+uri::parsed_uri uri::parse(std::string_view uri)
+{
+    auto parsed = parse_view(uri);
+    return {std::string{parsed.scheme}, std::string{parsed.authority}, std::string{parsed.path},
+            parsed.port};
 }
@@ -2,6 +2,7 @@
 #define NET_URI_H
 
 #include <string>
+#include <string_view>
 
 namespace uri
 {
@@ -12,7 +13,19 @@ struct parsed_uri {
     int port;
 };
 
-parsed_uri parse(const std::string &uri);
+// The same, pointing into the URI it was parsed from
+struct parsed_uri_view {
+    std::string_view scheme;
+    std::string_view authority;
+    std::string_view path;
+    int port;
+};
+
+// [scheme://]host[:port][/path], the port defaulting by scheme for http(s) and ws(s), -1 for any
+// other, and the path to "/". Everything empty and the port -1 if uri is not one. parse_view
+// doesn't allocate
+parsed_uri parse(std::string_view uri);
+parsed_uri_view parse_view(std::string_view uri);
 
 }  // namespace uri
 
@@ -0,0 +1,117 @@
+#include <sched.h>
+#include <stdexcept>
+
+#include "options.h"
+
+static size_t parse_size(const std::string &name, const std::string &value)
+{
+    try {
+        auto pos = size_t{0};
+        auto n = std::stoull(value, &pos, 10);
+        if (pos != value.size())
+            throw std::invalid_argument{value};
+        return static_cast<size_t>(n);
+    } catch (std::logic_error &) {
+        throw std::invalid_argument{"Invalid value for --" + name + ": " + value};
+    }
+}
+
+static int parse_int(const std::string &name, const std::string &value)
+{
+    try {
+        auto pos = size_t{0};
+        auto n = std::stoi(value, &pos, 10);
+        if (pos != value.size())
+            throw std::invalid_argument{value};
+        return n;
+    } catch (std::logic_error &) {
+        throw std::invalid_argument{"Invalid value for --" + name + ": " + value};
+    }
+}
+
+static bool parse_flag(const std::string &name, const std::string &value)
+{
+    if (value == "on" || value == "true" || value == "1")
+        return true;
+    if (value == "off" || value == "false" || value == "0")
+        return false;
+    throw std::invalid_argument{"Invalid value for --" + name + ": " + value};
+}
+
+discord::options discord::parse_options(int argc, char *argv[])
+{
+    auto opts = discord::options{};
+    if (argc > 1)
+        opts.token = argv[1];
+
+    for (auto i = 2; i < argc; ++i) {
+        auto arg = std::string{argv[i]};
+        auto eq = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+            throw std::invalid_argument{"Unrecognized argument: " + arg};
+
+        auto name = arg.substr(2, eq - 2);
+        auto value = arg.substr(eq + 1);
+        if (name == "gateway-url")
+            opts.gateway_url = value;
+        else if (name == "gateway-compression")
+            opts.gateway_compression = parse_flag(name, value);
+        else if (name == "gateway-encoding")
+            opts.gateway_encoding = value;
+        else if (name == "shards")
+            opts.shards = parse_size(name, value);
+        else if (name == "max-concurrency")
+            opts.max_concurrency = parse_size(name, value);
+        else if (name == "member-cache")
+            opts.member_cache = parse_size(name, value);
+        else if (name == "prebuffer-kb")
+            opts.prebuffer_bytes = parse_size(name, value) * 1024;
+        else if (name == "resolver-processes")
+            opts.resolver_processes = parse_size(name, value);
+        else if (name == "resolver-command")
+            opts.resolver_command = value;
+        else if (name == "resolver-cache-minutes")
+            opts.resolver_cache_minutes = parse_size(name, value);
+        else if (name == "input-buffer-kb")
+            opts.input_buffer_bytes = parse_size(name, value) * 1024;
+        else if (name == "audio-workers")
+            opts.audio_workers = parse_size(name, value);
+        else if (name == "batched-egress")
+            opts.batched_egress = parse_flag(name, value);
+        else if (name == "lookahead-ms")
+            opts.lookahead_ms = parse_size(name, value);
+        else if (name == "voice-threads")
+            opts.voice_threads = parse_size(name, value);
+        else if (name == "voice-priority")
+            opts.voice_priority = parse_int(name, value);
+        else if (name == "voice-cpu")
+            opts.voice_cpu = parse_int(name, value);
+        else
+            throw std::invalid_argument{"Unknown option: --" + name};
+    }
+
+    if (opts.gateway_encoding != "json" && opts.gateway_encoding != "etf")
+        throw std::invalid_argument{"--gateway-encoding must be json or etf"};
+    if (opts.shards == 0 || opts.max_concurrency == 0)
+        throw std::invalid_argument{"--shards and --max-concurrency must be at least 1"};
+    if (opts.input_buffer_bytes < 128 * 1024)
+        throw std::invalid_argument{"--input-buffer-kb must be at least 128"};
+    // The decoder probes only what is prebuffered, it would otherwise wait on the download from
+    // the io thread that does the downloading
+    if (opts.prebuffer_bytes < 64 * 1024)
+        throw std::invalid_argument{"--prebuffer-kb must be at least 64"};
+    if (opts.lookahead_ms > 160)
+        throw std::invalid_argument{"--lookahead-ms must be at most 160"};
+    if (opts.voice_threads == 0)
+        throw std::invalid_argument{"--voice-threads must be at least 1"};
+    auto min_priority = sched_get_priority_min(SCHED_FIFO);
+    auto max_priority = sched_get_priority_max(SCHED_FIFO);
+    if (opts.voice_priority != 0 &&
+        (opts.voice_priority < min_priority || opts.voice_priority > max_priority))
+        throw std::invalid_argument{"--voice-priority must be 0 or from " +
+                                    std::to_string(min_priority) + " to " +
+                                    std::to_string(max_priority)};
+    if (opts.voice_cpu < -1)
+        throw std::invalid_argument{"--voice-cpu must be a CPU number, or -1 for none"};
+    return opts;
+}
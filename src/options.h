@@ -0,0 +1,77 @@
+#ifndef DISCORD_OPTIONS_H
+#define DISCORD_OPTIONS_H
+
+#include <cstddef>
+#include <string>
+
+namespace discord
+{
+// Runtime settings given on the command line after the bot token, e.g. --prebuffer-kb=512
+struct options {
+    std::string token;
+
+    // Where the gateway is, a ws:// URL works too, e.g. for a local stand-in
+    std::string gateway_url = "wss://gateway.discord.gg/?v=6&encoding=json";
+    // Ask for the zlib-stream transport, every gateway message comes compressed on one zlib stream
+    // per connection. GUILD_CREATEs shrink several times over
+    bool gateway_compression = true;
+
+    // How gateway payloads are written, "json" or "etf" (the Erlang external term format, smaller
+    // and with snowflakes as integers)
+    std::string gateway_encoding = "json";
+
+    // Gateway sessions, each receiving the events of its share of the guilds, and how many of them
+    // may identify at once (max_concurrency from /gateway/bot), once every 5 seconds
+    size_t shards = 1;
+    size_t max_concurrency = 1;
+
+    // Guild members kept, the ones seen most recently in messages and voice, across the guilds of
+    // a shard. Members are then not kept from GUILD_CREATE but requested when needed. 0 keeps
+    // every member of every guild
+    size_t member_cache = 0;
+
+    // Bytes of a streamed source (youtube-dl) buffered before the decoder is opened and playback
+    // begins. The rest of the track keeps downloading while it plays. At least 64 KiB, the
+    // stream is probed within it
+    size_t prebuffer_bytes = 256 * 1024;
+
+    // youtube-dl processes kept running to resolve tracks into the URL of their audio, which is
+    // then fetched with curl, each one started by resolver_command. 0 runs a youtube-dl for every
+    // track instead, to resolve and download it. Off unless asked for, the script needs the
+    // youtube_dl Python module and is found relative to the working directory
+    size_t resolver_processes = 0;
+    std::string resolver_command = "python3 youtube_dl_resolver.py";
+
+    // How long a resolved audio URL is reused for the same track, YouTube's expire after hours
+    size_t resolver_cache_minutes = 60;
+
+    // Capacity of the ring each playing source is decoded from, bounding per-guild memory
+    size_t input_buffer_bytes = 1024 * 1024;
+
+    // Threads decoding and encoding audio for all guilds, 0 picks one per core besides the io
+    // thread
+    size_t audio_workers = 0;
+
+    // Send every guild's voice packets through one socket, batched per scheduler tick with
+    // sendmmsg (and UDP GSO where possible) instead of one send per packet
+    bool batched_egress = false;
+
+    // Audio sealed into finished RTP packets ahead of its send deadline, in 20 ms frames. 0 seals
+    // each packet on its tick
+    size_t lookahead_ms = 40;
+
+    // Threads running voice connections, each guild stays on one of them
+    size_t voice_threads = 1;
+
+    // Scheduling of the threads sending voice: a SCHED_FIFO priority from 1 to 99, 0 for the
+    // normal scheduler, and a CPU to pin the first one to, -1 for none. The others go on the CPUs
+    // after it
+    int voice_priority = 0;
+    int voice_cpu = -1;
+};
+
+// Throws std::invalid_argument on unknown or malformed options
+discord::options parse_options(int argc, char *argv[]);
+}  // namespace discord
+
+#endif
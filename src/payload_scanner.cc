@@ -0,0 +1,34 @@
+#include "json_reader.h"
+#include "payload_scanner.h"
+
+bool discord::scan_payload(std::string_view message, discord::payload_view &p)
+{
+    p = {};
+    p.sequence_num = -1;
+    auto has_op = false;
+
+    try {
+        auto reader = discord::json_reader{message};
+        reader.begin_object();
+        for (auto key = std::string_view{}; reader.next_key(key);) {
+            if (key == "op") {
+                p.op = static_cast<discord::gateway_op>(reader.integer());
+                has_op = true;
+            } else if (key == "s") {
+                p.sequence_num = reader.is_null() ? -1 : static_cast<int>(reader.integer());
+            } else if (key == "t") {
+                if (!reader.is_null()) {
+                    p.event_name = reader.string_view();
+                    p.event = discord::to_gateway_event(p.event_name);
+                }
+            } else if (key == "d") {
+                p.data = reader.raw();
+            } else {
+                reader.skip();
+            }
+        }
+        return has_op && !p.data.empty() && reader.done();
+    } catch (discord::json_error &) {
+        return false;
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef DISCORD_PAYLOAD_SCANNER_H
+#define DISCORD_PAYLOAD_SCANNER_H
+
+#include <string_view>
+
+#include "discord.h"
+
+namespace discord
+{
+// The envelope of a gateway payload, pointing into the message it was scanned from
+struct payload_view {
+    discord::gateway_op op;
+    int sequence_num;              // -1 if not a dispatch
+    std::string_view event_name;   // empty if not a dispatch
+    discord::gateway_event event;  // unknown if not a dispatch, or one nothing handles
+    std::string_view data;         // the raw JSON text of "d"
+};
+
+// Finds op, s, t and d in a gateway message without building a JSON document or allocating, "d"
+// is stepped over whatever its size, so an event nothing handles costs one pass over its text.
+// Returns false if the message is not a JSON object with at least op and d
+bool scan_payload(std::string_view message, discord::payload_view &p);
+}  // namespace discord
+
+#endif
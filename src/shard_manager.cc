@@ -0,0 +1,61 @@
+#include <algorithm>
+#include <iostream>
+
+#include "shard_manager.h"
+#include "voice/voice_connector.h"
+
+size_t discord::shard_for(discord::snowflake guild_id, size_t shard_count)
+{
+    // The formula from the gateway documentation, on the creation time part of the snowflake
+    return (guild_id >> 22) % shard_count;
+}
+
+discord::shard_manager::shard_manager(boost::asio::io_context &ctx, ssl::context &tls,
+                                      const discord::options &opts)
+    : ctx{ctx}
+    , opts{opts}
+    , voice{std::make_shared<discord::voice_connector>(tls, opts)}
+    , identify_timer{ctx}
+    , started{0}
+{
+    for (auto i = size_t{0}; i < opts.shards; ++i) {
+        connections.push_back(std::make_unique<discord::connection>(ctx, tls));
+        shards.push_back(std::make_shared<discord::gateway>(ctx, opts, *connections.back(), voice,
+                                                            i, opts.shards));
+    }
+}
+
+discord::shard_manager::~shard_manager()
+{
+    identify_timer.cancel();
+}
+
+void discord::shard_manager::run()
+{
+    start_batch();
+}
+
+void discord::shard_manager::disconnect()
+{
+    identify_timer.cancel();
+    for (auto &shard : shards)
+        shard->disconnect();
+}
+
+// Identifying happens right after connecting, so a batch is as many shards as may identify at once
+void discord::shard_manager::start_batch()
+{
+    auto end = std::min(started + opts.max_concurrency, shards.size());
+    for (; started < end; ++started) {
+        std::cout << "[shards] starting shard " << started << " of " << shards.size() << "\n";
+        shards[started]->run();
+    }
+    if (started == shards.size())
+        return;
+
+    identify_timer.expires_after(identify_interval);
+    identify_timer.async_wait([this](const auto &ec) {
+        if (!ec)
+            start_batch();
+    });
+}
@@ -0,0 +1,50 @@
+#ifndef DISCORD_SHARD_MANAGER_H
+#define DISCORD_SHARD_MANAGER_H
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "aliases.h"
+#include "discord.h"
+#include "gateway.h"
+#include "net/connection.h"
+#include "options.h"
+
+namespace discord
+{
+class voice_connector;
+
+// The shard Discord sends a guild's events to, out of shard_count
+size_t shard_for(discord::snowflake guild_id, size_t shard_count);
+
+// Runs one gateway session per shard, every one with its own connection and store, and the voice
+// connector they share. Discord lets max_concurrency sessions identify every 5 seconds, so shards
+// are started in batches that far apart
+class shard_manager
+{
+public:
+    static constexpr auto identify_interval = std::chrono::seconds(5);
+
+    shard_manager(boost::asio::io_context &ctx, ssl::context &tls, const discord::options &opts);
+    ~shard_manager();
+
+    void run();
+    void disconnect();
+
+private:
+    boost::asio::io_context &ctx;
+    const discord::options &opts;
+    std::shared_ptr<discord::voice_connector> voice;
+    std::vector<std::unique_ptr<discord::connection>> connections;
+    std::vector<std::shared_ptr<discord::gateway>> shards;
+    boost::asio::steady_timer identify_timer;
+    size_t started;
+
+    void start_batch();
+};
+}  // namespace discord
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef DISCORD_SNOWFLAKE_MAP_H
+#define DISCORD_SNOWFLAKE_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace discord
+{
+// A hash map from snowflakes, with open addressing and linear probing in one array: a lookup is a
+// multiply and, mostly, a single cache line. Key 0 marks an empty slot, no snowflake is 0
+template<typename V>
+class snowflake_map
+{
+public:
+    using key_type = uint64_t;
+
+    struct slot {
+        key_type key;
+        V value;
+    };
+
+    snowflake_map() : count{0} {}
+
+    V *find(key_type key)
+    {
+        if (slots.empty())
+            return nullptr;
+        for (auto i = index_of(key);; i = (i + 1) & mask()) {
+            if (slots[i].key == key)
+                return &slots[i].value;
+            if (slots[i].key == 0)
+                return nullptr;
+        }
+    }
+
+    const V *find(key_type key) const
+    {
+        return const_cast<snowflake_map *>(this)->find(key);
+    }
+
+    // The value for key, default constructed if it wasn't there
+    V &operator[](key_type key)
+    {
+        if ((count + 1) * 4 > slots.size() * 3)
+            rehash(slots.empty() ? 16 : slots.size() * 2);
+
+        auto i = index_of(key);
+        for (; slots[i].key != 0; i = (i + 1) & mask())
+            if (slots[i].key == key)
+                return slots[i].value;
+        slots[i].key = key;
+        ++count;
+        return slots[i].value;
+    }
+
+    bool erase(key_type key)
+    {
+        if (slots.empty())
+            return false;
+        auto i = index_of(key);
+        for (; slots[i].key != key; i = (i + 1) & mask())
+            if (slots[i].key == 0)
+                return false;
+
+        // Backward shift: later entries of the probe run move up into the hole, so no tombstones
+        // are needed and lookups stay as short as the load allows
+        for (auto j = (i + 1) & mask(); slots[j].key != 0; j = (j + 1) & mask()) {
+            auto home = index_of(slots[j].key);
+            if (((j - home) & mask()) >= ((j - i) & mask())) {
+                slots[i] = std::move(slots[j]);
+                i = j;
+            }
+        }
+        slots[i] = slot{0, V{}};
+        --count;
+        return true;
+    }
+
+    void reserve(size_t n)
+    {
+        auto size = size_t{16};
+        while (n * 4 > size * 3)
+            size *= 2;
+        if (size > slots.size())
+            rehash(size);
+    }
+
+    void clear()
+    {
+        slots.clear();
+        count = 0;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    template<typename F>
+    void for_each(F &&f) const
+    {
+        for (auto &s : slots)
+            if (s.key != 0)
+                f(s.key, s.value);
+    }
+
+private:
+    std::vector<slot> slots;
+    size_t count;
+
+    size_t mask() const
+    {
+        return slots.size() - 1;
+    }
+
+    // Fibonacci hashing, the multiply carries the varying low bits of a snowflake, its sequence
+    // number and worker, up into the bits the index is taken from
+    size_t index_of(key_type key) const
+    {
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & mask();
+    }
+
+    void rehash(size_t size)
+    {
+        auto old = std::move(slots);
+        slots = std::vector<slot>(size);
+        count = 0;
+        for (auto &s : old)
+            if (s.key != 0)
+                (*this)[s.key] = std::move(s.value);
+    }
+};
+}  // namespace discord
+
+#endif
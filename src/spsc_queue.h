@@ -0,0 +1,97 @@
+#ifndef DISCORD_SPSC_QUEUE_H
+#define DISCORD_SPSC_QUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace discord
+{
+// Bounded, lock-free queue for exactly one producer thread and one consumer thread. Slots are
+// preallocated and reused, items are moved in and out or filled in place
+template<typename T, size_t Capacity>
+class spsc_queue
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                  "capacity must be a power of two");
+
+public:
+    spsc_queue() : head{0}, tail{0} {}
+    spsc_queue(const spsc_queue &) = delete;
+    spsc_queue &operator=(const spsc_queue &) = delete;
+
+    // Producer side, returns false if the queue is full
+    bool push(T &&item)
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity)
+            return false;
+        slots[t & (Capacity - 1)] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer side, fills the next item in place: acquire() the slot, nullptr if the queue is
+    // full, then publish() it to the consumer
+    T *acquire()
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity)
+            return nullptr;
+        return &slots[t & (Capacity - 1)];
+    }
+
+    void publish()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool full() const
+    {
+        return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) ==
+               Capacity;
+    }
+
+    // Consumer side, front() is nullptr if the queue is empty
+    T *front()
+    {
+        return at(0);
+    }
+
+    // The item i places behind the front, nullptr if there are not that many
+    T *at(size_t i)
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        if (tail.load(std::memory_order_acquire) - h <= i)
+            return nullptr;
+        return &slots[(h + i) & (Capacity - 1)];
+    }
+
+    void pop()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Either side, only a snapshot
+    size_t size() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity()
+    {
+        return Capacity;
+    }
+
+private:
+    std::array<T, Capacity> slots;
+
+    // Ever increasing counts of items pushed and popped, kept on separate cache lines so the two
+    // threads don't contend on them
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+}  // namespace discord
+
+#endif
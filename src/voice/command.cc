@@ -0,0 +1,35 @@
+#include "voice/command.h"
+
+static bool is_space(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+bool discord::parse_command(std::string_view message, discord::command_view &c)
+{
+    c = {};
+    if (message.empty() || message[0] != ':')
+        return false;
+
+    auto name_end = size_t{1};
+    while (name_end < message.size() && !is_space(message[name_end]))
+        ++name_end;
+    if (name_end == 1)
+        return false;
+    c.name = message.substr(1, name_end - 1);
+    if (name_end == message.size())
+        return true;
+
+    auto rest = message.substr(name_end);
+    auto params = size_t{1};
+    while (params < rest.size() && is_space(rest[params]))
+        ++params;
+    if (params == rest.size()) {
+        // Parameters can't be empty, the last of the whitespace is taken as them
+        if (rest.size() < 2)
+            return false;
+        params = rest.size() - 1;
+    }
+    c.params = rest.substr(params);
+    return c.params.find_first_of("\r\n") == std::string_view::npos;
+}
@@ -0,0 +1,20 @@
+#ifndef DISCORD_VOICE_COMMAND_H
+#define DISCORD_VOICE_COMMAND_H
+
+#include <string_view>
+
+namespace discord
+{
+// A chat command, pointing into the message it was parsed from
+struct command_view {
+    std::string_view name;
+    std::string_view params;  // empty if none
+};
+
+// Splits ":name params" at the first whitespace after the name, without allocating. The
+// parameters start after the whitespace and run to the end, a line break in them makes message
+// no command. Returns false if it is none
+bool parse_command(std::string_view message, discord::command_view &c);
+}  // namespace discord
+
+#endif
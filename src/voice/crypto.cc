@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
 #include "voice/crypto.h"
 
 int discord::crypto::xsalsa20_poly1305_encrypt(const uint8_t *src, uint8_t *dest, uint64_t src_len,
@@ -5,3 +9,162 @@ int discord::crypto::xsalsa20_poly1305_encrypt(const uint8_t *src, uint8_t *dest
 {
     return crypto_secretbox_easy(dest, src, src_len, nonce, secret_key);
 }
+
+int discord::crypto::xsalsa20_poly1305_decrypt(const uint8_t *src, uint8_t *dest, uint64_t src_len,
+                                               uint8_t *secret_key, uint8_t *nonce)
+{
+    return crypto_secretbox_open_easy(dest, src, src_len, nonce, secret_key);
+}
+
+void discord::crypto::init()
+{
+    if (sodium_init() < 0)
+        throw std::runtime_error("Could not initialize libsodium");
+}
+
+const char *discord::crypto::mode_name(mode m)
+{
+    switch (m) {
+        case mode::xsalsa20_poly1305:
+            return "xsalsa20_poly1305";
+        case mode::xsalsa20_poly1305_suffix:
+            return "xsalsa20_poly1305_suffix";
+        case mode::xsalsa20_poly1305_lite:
+            return "xsalsa20_poly1305_lite";
+        case mode::aead_aes256_gcm:
+            return "aead_aes256_gcm";
+    }
+    return "";
+}
+
+bool discord::crypto::parse_mode(const std::string &name, mode &m)
+{
+    for (auto candidate : {mode::xsalsa20_poly1305, mode::xsalsa20_poly1305_suffix,
+                           mode::xsalsa20_poly1305_lite, mode::aead_aes256_gcm}) {
+        if (name == mode_name(candidate)) {
+            m = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+discord::crypto::mode discord::crypto::choose_mode(const std::vector<std::string> &offered)
+{
+    // Cheapest first. The suffix mode pays for 24 random bytes a packet
+    auto preferred = std::vector<mode>{};
+    if (crypto_aead_aes256gcm_is_available())
+        preferred.push_back(mode::aead_aes256_gcm);
+    preferred.push_back(mode::xsalsa20_poly1305_lite);
+    preferred.push_back(mode::xsalsa20_poly1305);
+    preferred.push_back(mode::xsalsa20_poly1305_suffix);
+
+    for (auto m : preferred) {
+        for (const auto &name : offered) {
+            if (name == mode_name(m))
+                return m;
+        }
+    }
+    return mode::xsalsa20_poly1305;  // what every server supports
+}
+
+discord::crypto::voice_cipher::voice_cipher() : m{mode::xsalsa20_poly1305}, key{}, counter{0} {}
+
+void discord::crypto::voice_cipher::set_key(mode m, const std::vector<uint8_t> &key)
+{
+    this->m = m;
+    std::memcpy(this->key.data(), key.data(), std::min(key.size(), this->key.size()));
+    randombytes_buf(&counter, sizeof(counter));
+
+    // Expands the key once instead of for every packet
+    if (m == mode::aead_aes256_gcm)
+        crypto_aead_aes256gcm_beforenm(&aes_state, this->key.data());
+}
+
+discord::crypto::mode discord::crypto::voice_cipher::get_mode() const
+{
+    return m;
+}
+
+void discord::crypto::voice_cipher::write_counter(uint8_t *dest, uint32_t value) const
+{
+    dest[0] = (value >> 24) & 0xFF;
+    dest[1] = (value >> 16) & 0xFF;
+    dest[2] = (value >> 8) & 0xFF;
+    dest[3] = (value >> 0) & 0xFF;
+}
+
+size_t discord::crypto::voice_cipher::seal(uint8_t *packet, size_t size)
+{
+    static_assert(crypto_secretbox_MACBYTES + crypto_secretbox_NONCEBYTES <= max_overhead);
+    static_assert(crypto_aead_aes256gcm_ABYTES + 4 <= max_overhead);
+
+    auto audio = packet + header_size;
+    auto nonce = std::array<uint8_t, 24>{};
+    auto error = 0;
+    auto sealed = header_size + size;
+
+    switch (m) {
+        case mode::xsalsa20_poly1305:
+            std::memcpy(&nonce[0], packet, header_size);
+            error = xsalsa20_poly1305_encrypt(audio, audio, size, key.data(), nonce.data());
+            sealed += crypto_secretbox_MACBYTES;
+            break;
+        case mode::xsalsa20_poly1305_suffix:
+            randombytes_buf(nonce.data(), nonce.size());
+            error = xsalsa20_poly1305_encrypt(audio, audio, size, key.data(), nonce.data());
+            sealed += crypto_secretbox_MACBYTES;
+            std::memcpy(packet + sealed, nonce.data(), nonce.size());
+            sealed += nonce.size();
+            break;
+        case mode::xsalsa20_poly1305_lite:
+            write_counter(&nonce[0], counter);
+            error = xsalsa20_poly1305_encrypt(audio, audio, size, key.data(), nonce.data());
+            sealed += crypto_secretbox_MACBYTES;
+            std::memcpy(packet + sealed, nonce.data(), 4);
+            sealed += 4;
+            counter++;
+            break;
+        case mode::aead_aes256_gcm: {
+            write_counter(&nonce[0], counter);
+            auto len = 0ULL;
+            error = crypto_aead_aes256gcm_encrypt_afternm(audio, &len, audio, size, packet,
+                                                          header_size, nullptr, nonce.data(),
+                                                          &aes_state);
+            sealed += crypto_aead_aes256gcm_ABYTES;
+            std::memcpy(packet + sealed, nonce.data(), 4);
+            sealed += 4;
+            counter++;
+            break;
+        }
+    }
+    return error ? 0 : sealed;
+}
+
+bool discord::crypto::voice_cipher::open(uint8_t *packet, size_t size)
+{
+    auto audio = packet + header_size;
+    auto nonce = std::array<uint8_t, 24>{};
+    auto box = size + crypto_secretbox_MACBYTES;
+
+    switch (m) {
+        case mode::xsalsa20_poly1305:
+            std::memcpy(&nonce[0], packet, header_size);
+            return xsalsa20_poly1305_decrypt(audio, audio, box, key.data(), nonce.data()) == 0;
+        case mode::xsalsa20_poly1305_suffix:
+            std::memcpy(nonce.data(), audio + box, nonce.size());
+            return xsalsa20_poly1305_decrypt(audio, audio, box, key.data(), nonce.data()) == 0;
+        case mode::xsalsa20_poly1305_lite:
+            std::memcpy(nonce.data(), audio + box, 4);
+            return xsalsa20_poly1305_decrypt(audio, audio, box, key.data(), nonce.data()) == 0;
+        case mode::aead_aes256_gcm: {
+            auto sealed = size + crypto_aead_aes256gcm_ABYTES;
+            std::memcpy(nonce.data(), audio + sealed, 4);
+            auto len = 0ULL;
+            return crypto_aead_aes256gcm_decrypt_afternm(audio, &len, nullptr, audio, sealed,
+                                                         packet, header_size, nonce.data(),
+                                                         &aes_state) == 0;
+        }
+    }
+    return false;
+}
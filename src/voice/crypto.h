@@ -2,7 +2,11 @@
 #define DISCORD_CRYPTO_H
 
 #include <sodium.h>
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <string>
+#include <vector>
 
 namespace discord
 {
@@ -10,7 +14,58 @@ namespace crypto
 {
 int xsalsa20_poly1305_encrypt(const uint8_t *src, uint8_t *dest, uint64_t src_len,
                               uint8_t *secret_key, uint8_t *nonce);
-}
+int xsalsa20_poly1305_decrypt(const uint8_t *src, uint8_t *dest, uint64_t src_len,
+                              uint8_t *secret_key, uint8_t *nonce);
+
+// Voice encryption modes, by the names the voice gateway uses for them
+enum class mode {
+    xsalsa20_poly1305,         // nonce is the RTP header
+    xsalsa20_poly1305_suffix,  // random 24 byte nonce sent after the audio
+    xsalsa20_poly1305_lite,    // 4 byte counter sent after the audio
+    aead_aes256_gcm            // 4 byte counter sent after the audio, RTP header authenticated
+};
+
+// Sets up libsodium, which picks the fastest implementations for this CPU. Throws
+// std::runtime_error if it can't
+void init();
+
+const char *mode_name(mode m);
+bool parse_mode(const std::string &name, mode &m);
+
+// The mode with the cheapest packets out of those the server offers. AES-GCM only where the CPU
+// has AES instructions, without them it is slower than XSalsa20
+mode choose_mode(const std::vector<std::string> &offered);
+
+// Encrypts the audio of RTP packets in place with one mode and key
+class voice_cipher
+{
+public:
+    static constexpr size_t header_size = 12;
+
+    // Most a packet grows by, a MAC and a nonce
+    static constexpr size_t max_overhead = 16 + 24;
+
+    voice_cipher();
+    void set_key(mode m, const std::vector<uint8_t> &key);
+    mode get_mode() const;
+
+    // packet holds an RTP header followed by size bytes of audio, with room for max_overhead more.
+    // Returns the size of the sealed packet, 0 on failure
+    size_t seal(uint8_t *packet, size_t size);
+
+    // Undoes seal(), size is that of the audio. Counter nonces are never given back, a nonce must
+    // not encrypt different audio twice
+    bool open(uint8_t *packet, size_t size);
+
+private:
+    mode m;
+    std::array<uint8_t, 32> key;
+    uint32_t counter;
+    crypto_aead_aes256gcm_state aes_state;
+
+    void write_counter(uint8_t *dest, uint32_t value) const;
+};
+}  // namespace crypto
 }  // namespace discord
 
 #endif
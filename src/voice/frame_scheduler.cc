@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <iostream>
+
+#include "voice/frame_scheduler.h"
+#include "voice/voice_connector.h"
+
+discord::frame_scheduler::frame_scheduler(boost::asio::io_context &ctx)
+    : timer{ctx}, epoch{clock::now()}, running{false}, peak_lateness{0}
+{
+}
+
+discord::frame_scheduler::~frame_scheduler()
+{
+    timer.cancel();
+}
+
+void discord::frame_scheduler::add(voice_context &context)
+{
+    auto active = std::any_of(entries.begin(), entries.end(), [&](const auto &e) {
+        return e.context == &context && !e.removed;
+    });
+    if (active)
+        return;
+
+    auto start = current_tick(clock::now()) + 1;
+    entries.push_back(entry{&context, start, false, false});
+    if (!running) {
+        running = true;
+        arm(start);
+    }
+}
+
+void discord::frame_scheduler::remove(voice_context &context)
+{
+    // Only marked here, this may be called while on_tick is walking the entries
+    for (auto &e : entries) {
+        if (e.context == &context)
+            e.removed = true;
+    }
+}
+
+void discord::frame_scheduler::forget(voice_context &context)
+{
+    remove(context);
+    // The guild may be the one being serviced, holding on to its stats
+    if (entries.empty())
+        stats.erase(context.get_guild_id());
+    else
+        forgotten.push_back(context.get_guild_id());
+}
+
+const discord::frame_scheduler::lateness_stats *
+discord::frame_scheduler::lateness(discord::snowflake guild_id) const
+{
+    auto it = stats.find(guild_id);
+    return it != stats.end() ? &it->second : nullptr;
+}
+
+discord::frame_scheduler::clock::duration discord::frame_scheduler::take_peak_lateness()
+{
+    return clock::duration{peak_lateness.exchange(0)};
+}
+
+uint64_t discord::frame_scheduler::current_tick(clock::time_point now) const
+{
+    return static_cast<uint64_t>((now - epoch) / frame_duration);
+}
+
+discord::frame_scheduler::clock::time_point discord::frame_scheduler::deadline(uint64_t tick) const
+{
+    return epoch + tick * frame_duration;
+}
+
+void discord::frame_scheduler::arm(uint64_t tick)
+{
+    timer.expires_at(deadline(tick));
+    timer.async_wait(make_custom_alloc_handler(timer_memory, [this](const auto &ec) {
+        if (!ec)
+            on_tick();
+    }));
+}
+
+void discord::frame_scheduler::on_tick()
+{
+    // Everything up to the tick we are in is due, even if this wakeup came late
+    auto due = current_tick(clock::now());
+
+    // Contexts may add themselves again while being serviced, so go by index
+    for (auto i = size_t{0}; i < entries.size(); ++i)
+        service(i, due);
+
+    auto removed = [](const auto &e) { return e.removed; };
+    entries.erase(std::remove_if(entries.begin(), entries.end(), removed), entries.end());
+    for (auto guild_id : forgotten)
+        stats.erase(guild_id);
+    forgotten.clear();
+    if (entries.empty()) {
+        running = false;
+        return;
+    }
+    arm(due + 1);
+}
+
+// Sends every frame a context owes up to due_tick
+void discord::frame_scheduler::service(size_t index, uint64_t due_tick)
+{
+    if (entries[index].removed || entries[index].next_tick > due_tick)
+        return;
+
+    auto *context = entries[index].context;
+    auto guild_id = context->get_guild_id();
+    auto &s = stats[guild_id];
+
+    if (due_tick - entries[index].next_tick > max_backlog) {
+        entries[index].next_tick = due_tick;
+        s.rebases++;
+    }
+
+    while (entries[index].next_tick <= due_tick) {
+        auto result = context->send_next_frame();
+
+        // send_next_frame may have added entries, don't hold on to a reference across it
+        auto &e = entries[index];
+        if (result == send_result::finished || e.removed) {
+            e.removed = true;
+            std::cout << "[scheduler] guild " << guild_id << ": " << s.frames << " frames, "
+                      << s.late_frames << " late, worst "
+                      << std::chrono::duration_cast<std::chrono::microseconds>(s.worst_lateness)
+                             .count()
+                      << " us, " << s.underruns << " underruns, " << s.rebases << " rebases\n";
+            return;
+        }
+        if (result == send_result::not_ready) {
+            // Until the first frame the worker is still filling up, start the schedule from
+            // whenever that is instead of bursting to catch up. Later, the frames of the ticks
+            // missed would only be late, the stream carries on from the next tick and its
+            // timestamps leave a gap for them
+            if (e.started) {
+                s.underruns++;
+                context->skip_frames(due_tick + 1 - e.next_tick);
+            }
+            e.next_tick = due_tick + 1;
+            return;
+        }
+
+        auto lateness = clock::now() - deadline(e.next_tick);
+        s.frames++;
+        s.total_lateness += lateness;
+        s.worst_lateness = std::max(s.worst_lateness, lateness);
+        if (lateness > late_threshold)
+            s.late_frames++;
+        if (lateness.count() > peak_lateness.load(std::memory_order_relaxed))
+            peak_lateness.store(lateness.count(), std::memory_order_relaxed);
+        e.started = true;
+        e.next_tick++;
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef DISCORD_FRAME_SCHEDULER_H
+#define DISCORD_FRAME_SCHEDULER_H
+
+#include <atomic>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "discord.h"
+#include "net/handler_memory.h"
+
+namespace discord
+{
+struct voice_context;
+
+// Paces the audio of every playing voice context off a single timer. Time is divided into 20 ms
+// ticks of the steady clock; a context added at tick s sends its nth frame at tick s + n, so the
+// schedule never drifts no matter how late a single wakeup is. A context that fell behind sends
+// the frames it owes in a burst, or starts over from the current tick if it is too far behind. One
+// that had no frame ready skips the ticks it missed, they are not made up for with stale audio.
+class frame_scheduler
+{
+public:
+    using clock = std::chrono::steady_clock;
+    static constexpr auto frame_duration = std::chrono::milliseconds(20);
+
+    enum class send_result {
+        sent,       // a frame went out
+        not_ready,  // nothing to send yet, try again on the next tick
+        finished    // stop scheduling this context
+    };
+
+    struct lateness_stats {
+        uint64_t frames = 0;
+        uint64_t late_frames = 0;  // sent more than late_threshold after their deadline
+        uint64_t underruns = 0;    // times the context had no frame ready, its missed ticks skipped
+        uint64_t rebases = 0;      // times the schedule was restarted after falling too far behind
+        clock::duration total_lateness{};
+        clock::duration worst_lateness{};
+    };
+
+    explicit frame_scheduler(boost::asio::io_context &ctx);
+    ~frame_scheduler();
+
+    // Frames start going out on the next tick. The context must be removed before it is destroyed
+    void add(voice_context &context);
+    void remove(voice_context &context);
+    // Removes the context and drops its guild's lateness stats, its connection is gone
+    void forget(voice_context &context);
+
+    // Totals over everything a guild played since it connected, nullptr if it played nothing
+    const lateness_stats *lateness(discord::snowflake guild_id) const;
+
+    // Worst lateness of any frame sent since the last call. Safe to call from any thread
+    clock::duration take_peak_lateness();
+
+private:
+    static constexpr auto late_threshold = std::chrono::milliseconds(2);
+
+    // Frames a context may owe before the schedule restarts instead of bursting them out
+    static constexpr uint64_t max_backlog = 10;
+
+    struct entry {
+        voice_context *context;
+        uint64_t next_tick;
+        bool started;  // has sent its first frame
+        bool removed;
+    };
+
+    boost::asio::steady_timer timer;
+    discord::handler_memory<128, 1> timer_memory;
+    clock::time_point epoch;
+    bool running;
+
+    std::vector<entry> entries;
+    std::unordered_map<discord::snowflake, lateness_stats> stats;
+    std::vector<discord::snowflake> forgotten;  // stats to drop once the running tick is over
+    std::atomic<clock::rep> peak_lateness;
+
+    uint64_t current_tick(clock::time_point now) const;
+    clock::time_point deadline(uint64_t tick) const;
+    void arm(uint64_t tick);
+    void on_tick();
+    void service(size_t index, uint64_t due_tick);
+};
+}  // namespace discord
+
+#endif
@@ -1,27 +1,32 @@
 #include <algorithm>
+#include <boost/asio/post.hpp>
 #include <iostream>
-#include <regex>
 #include <set>
 
 #include "audio/file_source.h"
 #include "audio/youtube_dl.h"
 #include "gateway.h"
 #include "net/uri.h"
+#include "shard_manager.h"
+#include "voice/command.h"
 #include "voice/voice_connector.h"
 #include "voice/voice_gateway.h"
 
-discord::voice_connector::voice_connector(boost::asio::io_context &ctx, ssl::context &tls,
-                                          discord::gateway &gateway)
-    : ctx{ctx}, tls{tls}, gateway{gateway}
+// With --voice-cpu, consecutive threads go on consecutive CPUs
+static int shard_cpu(const discord::options &opts, size_t index)
 {
+    return opts.voice_cpu < 0 ? -1 : opts.voice_cpu + static_cast<int>(index);
 }
 
-discord::voice_connector::~voice_connector()
+discord::voice_connector::voice_shard::voice_shard(const discord::options &opts, size_t index)
+    : thread{opts.voice_priority, shard_cpu(opts, index)}
+    , scheduler{thread.get_io_context()}
 {
-    disconnect();
+    if (opts.batched_egress)
+        egress = std::make_unique<discord::udp_egress>(thread.get_io_context());
 }
 
-void discord::voice_connector::disconnect()
+void discord::voice_connector::voice_shard::disconnect()
 {
     for (auto &it : voice_map) {
         it.second->disconnect();
@@ -29,37 +34,93 @@ void discord::voice_connector::disconnect()
     voice_map.clear();
 }
 
-void discord::voice_connector::on_voice_state_update(const nlohmann::json &data)
+discord::voice_connector::voice_connector(ssl::context &tls, const discord::options &opts)
+    : tls{tls}, opts{opts}, workers{opts.audio_workers}
+{
+    for (auto i = size_t{0}; i < opts.voice_threads; ++i)
+        shards.push_back(std::make_unique<voice_shard>(opts, i));
+    if (opts.resolver_processes > 0)
+        resolver = std::make_unique<stream_resolver>(
+            opts.resolver_command, opts.resolver_processes,
+            std::chrono::minutes(opts.resolver_cache_minutes));
+    std::cout << "[voice] started " << shards.size() << " voice threads\n";
+}
+
+discord::voice_connector::~voice_connector()
+{
+    // The contexts have to go while the voice threads still run their io objects
+    for (auto &shard : shards)
+        shard->thread.post([&shard = *shard] { shard.disconnect(); });
+    for (auto &shard : shards)
+        shard->thread.stop();
+}
+
+discord::voice_connector::voice_shard &
+discord::voice_connector::shard_for(discord::snowflake guild_id)
+{
+    // Spread like Discord spreads guilds over gateway shards
+    return *shards[discord::shard_for(guild_id, shards.size())];
+}
+
+std::chrono::steady_clock::duration discord::voice_connector::take_peak_lateness()
+{
+    auto peak = std::chrono::steady_clock::duration::zero();
+    for (auto &shard : shards)
+        peak = std::max(peak, shard->scheduler.take_peak_lateness());
+    return peak;
+}
+
+void discord::voice_connector::on_voice_state_update(const discord::gateway &from,
+                                                     const nlohmann::json &data)
 {
     auto state = data.get<discord::voice_state>();
 
     // We're looking for voice state update for this user_id
-    if (gateway.get_user_id() != state.user_id) {
+    if (from.get_user_id() != state.user_id) {
         return;
     }
 
-    // Create the context if it doesn't exist
-    if (voice_map.count(state.guild_id) == 0) {
-        voice_map[state.guild_id] =
-            std::make_shared<voice_context>(ctx, gateway.get_gateway_store());
+    // The channel's bitrate, from the store while on its thread
+    auto channel = discord::channel{};
+    channel.bitrate = 0;
+    if (const auto *guild = from.get_gateway_store().get_guild(state.guild_id)) {
+        if (const auto *c = guild->channels.find(state.channel_id))
+            channel = *c;
     }
 
-    voice_map[state.guild_id]->on_voice_state_update(std::move(state));
+    auto &shard = shard_for(state.guild_id);
+    auto create = [this, &shard, state = std::move(state), channel = std::move(channel)]() mutable {
+        // Create the context if it doesn't exist
+        auto &context = shard.voice_map[state.guild_id];
+        if (!context) {
+            context = std::make_shared<voice_context>(shard.thread.get_io_context(), opts,
+                                                      workers, shard.scheduler,
+                                                      shard.egress.get(), resolver.get());
+        }
+        context->on_voice_state_update(std::move(state), channel);
+    };
+    shard.thread.post(std::move(create));
 }
 
-void discord::voice_connector::on_voice_server_update(const nlohmann::json &data)
+void discord::voice_connector::on_voice_server_update(const discord::gateway &from,
+                                                      const nlohmann::json &data)
 {
     auto vsu = data.get<discord::event::voice_server_update>();
 
-    auto it = voice_map.find(vsu.guild_id);
-    if (it == voice_map.end()) {
-        return;
-    }
-    it->second->on_voice_server_update(std::move(vsu), gateway.get_user_id(), tls);
+    auto &shard = shard_for(vsu.guild_id);
+    auto user_id = from.get_user_id();
+    shard.thread.post([this, &shard, vsu = std::move(vsu), user_id]() mutable {
+        auto it = shard.voice_map.find(vsu.guild_id);
+        if (it == shard.voice_map.end()) {
+            return;
+        }
+        it->second->on_voice_server_update(std::move(vsu), user_id, tls);
+    });
 }
 
 // Listen for guild text messages indicating to join, leave, play, pause, etc.
-void discord::voice_connector::on_message_create(const nlohmann::json &data)
+void discord::voice_connector::on_message_create(discord::gateway &from,
+                                                 const nlohmann::json &data)
 {
     auto msg = data.get<discord::message>();
     if (msg.type != discord::message::message_type::default_)
@@ -69,38 +130,53 @@ void discord::voice_connector::on_message_create(const nlohmann::json &data)
         return;
 
     if (msg.content[0] == ':')
-        check_command(msg);
+        check_command(from, msg);
 }
 
-void discord::voice_connector::check_command(const discord::message &m)
+void discord::voice_connector::check_command(discord::gateway &from, const discord::message &m)
 {
-    static auto command_re = std::regex{R"(^:(\S+)(?:\s+(.+))?$)"};
-    auto matcher = std::smatch{};
-    std::regex_search(m.content, matcher, command_re);
-
-    if (matcher.empty())
+    auto parsed = discord::command_view{};
+    if (!discord::parse_command(m.content, parsed))
         return;
 
-    auto command = matcher.str(1);
-    auto params = matcher.str(2);
+    auto command = std::string{parsed.name};
+    auto params = std::string{parsed.params};
     std::transform(command.begin(), command.end(), command.begin(), ::tolower);
 
-    auto guild_id = gateway.get_gateway_store().lookup_channel(m.channel_id);
-    auto it = voice_map.find(guild_id);
-
+    auto guild_id = from.get_gateway_store().lookup_channel(m.channel_id);
     if (command == "join") {
-        join_channel(m, params);
-    } else if (it != voice_map.end()) {
+        join_channel(from, m, params);
+        return;
+    }
+
+    if (command == "leave") {
+        const auto *guild = from.get_gateway_store().get_guild(guild_id);
+        if (guild && own_voice_channel(from, *guild) != 0)
+            leave_voice_server(from, guild_id);
+    }
+    auto &shard = shard_for(guild_id);
+    shard.thread.post([this, &shard, guild_id, command, params] {
+        run_command(shard, guild_id, command, params);
+    });
+}
+
+// The playback commands, on the guild's voice thread
+void discord::voice_connector::run_command(voice_shard &shard, discord::snowflake guild_id,
+                                           const std::string &command, const std::string &params)
+{
+    auto it = shard.voice_map.find(guild_id);
+    if (it != shard.voice_map.end()) {
         auto &context = *it->second;
-        if (command == "leave") {
+        if (command == "leave")
             context.leave_channel();
-            leave_voice_server(guild_id);
-        } else if (command == "list" || command == "l")
+        else if (command == "list" || command == "l")
             context.list_queue();
         else if (command == "add" || command == "a")
             context.add_queue(params);
         else if (command == "skip" || command == "next")
             context.skip_current();
+        else if (command == "seek")
+            context.seek(params);
         else if (command == "play")
             context.play();
         else if (command == "pause")
@@ -108,6 +184,14 @@ void discord::voice_connector::check_command(const discord::message &m)
     }
 }
 
+// The voice channel the bot is in, 0 if none
+discord::snowflake discord::voice_connector::own_voice_channel(const discord::gateway &from,
+                                                               const discord::guild &guild) const
+{
+    const auto *state = guild.voice_states.find(from.get_user_id());
+    return state ? state->channel_id : 0;
+}
+
 static const discord::guild *get_guild_from_channel(discord::snowflake channel_id,
                                                     const discord::gateway_store &store)
 {
@@ -118,45 +202,37 @@ static const discord::guild *get_guild_from_channel(discord::snowflake channel_i
     return store.get_guild(guild_id);
 }
 
-void discord::voice_connector::join_channel(const discord::message &m,
+void discord::voice_connector::join_channel(discord::gateway &from, const discord::message &m,
                                             const std::string &channel_name)
 {
-    auto *guild = get_guild_from_channel(m.channel_id, gateway.get_gateway_store());
+    auto *guild = get_guild_from_channel(m.channel_id, from.get_gateway_store());
     if (!guild)
         return;
 
-    auto it = voice_map.find(guild->id);
-    auto connected = it != voice_map.end();
-    auto &context = it->second;
+    auto current_channel = own_voice_channel(from, *guild);
 
     // If the user does not specify a channel to join, join the channel the user is in
     if (channel_name.empty()) {
-        auto find = discord::voice_state{};
-        find.user_id = m.author.id;
-
-        if (const auto &user_voice_state = guild->voice_states.find(find);
-            user_voice_state != guild->voice_states.end()) {
-            join_voice_server(guild->id, user_voice_state->channel_id);
-        }
+        if (const auto *user_voice_state = guild->voice_states.find(m.author.id))
+            join_voice_server(from, guild->id, user_voice_state->channel_id);
 
     } else {
-        // Look through the guild's channels for matching channel name, if it exists, join, else
-        // fail silently
-        for (auto channel : guild->channels) {
-            if (channel.type == discord::channel::channel_type::guild_voice &&
-                channel.name == channel_name) {
-                // Found a matching voice channel name! Join it if it is different
-                // than the currently connected channel (if any)
-                if (!connected || (context && context->get_channel_id() != channel.id)) {
-                    join_voice_server(guild->id, channel.id);
-                    return;
-                }
+        // Look up the guild's voice channels by name, if one exists, join, else fail silently
+        auto [first, last] =
+            from.get_gateway_store().voice_channels_named(guild->id, channel_name);
+        for (auto it = first; it != last; ++it) {
+            // Found a matching voice channel name! Join it if it is different
+            // than the currently connected channel (if any)
+            if (current_channel != it->second) {
+                join_voice_server(from, guild->id, it->second);
+                return;
             }
         }
     }
 }
 
-void discord::voice_connector::join_voice_server(discord::snowflake guild_id,
+void discord::voice_connector::join_voice_server(discord::gateway &from,
+                                                 discord::snowflake guild_id,
                                                  discord::snowflake channel_id)
 {
     auto guild_str = std::to_string(guild_id);
@@ -169,10 +245,11 @@ void discord::voice_connector::join_voice_server(discord::snowflake guild_id,
                                  {"channel_id", channel_str},
                                  {"self_mute", false},
                                  {"self_deaf", false}}}};
-    gateway.send(json.dump(), print_transfer_info);
+    from.send(json.dump(), print_transfer_info);
 }
 
-void discord::voice_connector::leave_voice_server(discord::snowflake guild_id)
+void discord::voice_connector::leave_voice_server(discord::gateway &from,
+                                                  discord::snowflake guild_id)
 {
     // json serializer doesn't like being passed char* pointing to nullptr,
     // so I guess we need to double this method
@@ -183,18 +260,23 @@ void discord::voice_connector::leave_voice_server(discord::snowflake guild_id)
                                  {"channel_id", nullptr},
                                  {"self_mute", false},
                                  {"self_deaf", false}}}};
-    gateway.send(json.dump(), print_transfer_info);
-}
-
-const discord::gateway &discord::voice_connector::get_gateway() const
-{
-    return gateway;
+    from.send(json.dump(), print_transfer_info);
 }
 
-discord::voice_context::voice_context(boost::asio::io_context &ctx,
-                                      const discord::gateway_store &store)
-    : ctx{ctx}, timer{ctx}, store{store}
+discord::voice_context::voice_context(boost::asio::io_context &ctx, const discord::options &opts,
+                                      audio_worker_pool &workers,
+                                      discord::frame_scheduler &scheduler,
+                                      discord::udp_egress *egress, stream_resolver *resolver)
+    : ctx{ctx}
+    , opts{opts}
+    , workers{workers}
+    , scheduler{scheduler}
+    , egress{egress}
+    , resolver{resolver}
+    , lookahead_frames{opts.lookahead_ms / 20}
 {
+    // Sealed frames stay in the stream's queue until they are sent
+    static_assert(audio_stream::lookahead * 20 >= 160, "--lookahead-ms allows up to 160 ms");
 }
 
 discord::voice_context::~voice_context()
@@ -204,17 +286,34 @@ discord::voice_context::~voice_context()
 
 void discord::voice_context::disconnect()
 {
-    timer.cancel();
+    scheduler.forget(*this);
+    stop_stream();
     gateway.reset();
     source.reset();
 }
 
-void discord::voice_context::on_voice_state_update(discord::voice_state state)
+// Takes the current source away from its worker, without waiting for a frame it is encoding. The
+// worker drops the source, which only holds on to this context weakly
+void discord::voice_context::stop_stream()
+{
+    flush_sealed();
+    if (stream) {
+        stream->cancel();
+        stream.reset();
+    }
+}
+
+void discord::voice_context::on_voice_state_update(discord::voice_state state,
+                                                   const discord::channel &channel)
 {
     channel_id = state.channel_id;
     guild_id = state.guild_id;
     session_id = std::move(state.session_id);
-    update_bitrate();
+    if (channel.bitrate > 0) {
+        encoder->set_bitrate(channel.bitrate);
+        std::cout << "[voice] '" << channel.name << "' playing at " << (channel.bitrate / 1000)
+                  << "Kbps\n";
+    }
 }
 
 void discord::voice_context::on_voice_server_update(discord::event::voice_server_update v,
@@ -224,6 +323,9 @@ void discord::voice_context::on_voice_server_update(discord::event::voice_server
         token = std::move(v.token);
         endpoint = std::move(v.endpoint);
 
+        // Anything sealed was for the old session
+        flush_sealed();
+
         // We got all the information needed to connect to a voice gateway
         gateway = std::make_shared<discord::voice_gateway>(ctx, tls, *this, user_id);
 
@@ -244,29 +346,13 @@ void discord::voice_context::on_voice_server_update(discord::event::voice_server
     }
 }
 
-void discord::voice_context::update_bitrate()
-{
-    auto guild = get_guild_from_channel(channel_id, store);
-    if (!guild)
-        return;
-
-    // to_find contains channel_id to match with the desired channel to determine the audio
-    // bitrate
-    auto to_find = discord::channel{};
-    to_find.id = channel_id;
-    auto channel = guild->channels.find(to_find);
-    if (channel != guild->channels.end()) {
-        encoder.set_bitrate(channel->bitrate);
-        std::cout << "[voice] '" << channel->name << "' playing at " << (channel->bitrate / 1000)
-                  << "Kbps\n";
-    }
-}
-
 void discord::voice_context::leave_channel()
 {
     if (p_state != voice_context::state::disconnected) {
         p_state = voice_context::state::disconnected;
         music_queue.clear();
+        scheduler.forget(*this);
+        stop_stream();
         gateway->stop();
     }
 }
@@ -285,6 +371,8 @@ void discord::voice_context::skip_current()
 {
     if (p_state == voice_context::state::playing || p_state == voice_context::state::paused) {
         p_state = voice_context::state::connected;
+        scheduler.remove(*this);
+        stop_stream();
 
         if (!music_queue.empty())
             play();
@@ -293,6 +381,56 @@ void discord::voice_context::skip_current()
     }
 }
 
+static constexpr auto max_seek_seconds = 24.0 * 60 * 60;
+
+// Parses a position given as seconds, mm:ss or hh:mm:ss, with optional fractional seconds
+static bool parse_position(const std::string &s, std::chrono::milliseconds &position)
+{
+    auto seconds = 0.0;
+    auto fields = 0;
+    auto start = size_t{0};
+    while (start <= s.size()) {
+        auto end = std::min(s.find(':', start), s.size());
+        auto field = s.substr(start, end - start);
+        auto last = end == s.size();
+        auto digits = last ? "0123456789." : "0123456789";
+        if (field.empty() || field.find_first_not_of(digits) != std::string::npos ||
+            std::count(field.begin(), field.end(), '.') > 1 || ++fields > 3)
+            return false;
+        try {
+            auto parsed = size_t{0};
+            seconds = seconds * 60 + std::stod(field, &parsed);
+            if (parsed != field.size())
+                return false;
+        } catch (std::logic_error &) {
+            return false;
+        }
+        start = end + 1;
+    }
+    // Longer than any track, and the milliseconds fit in the cast
+    if (seconds > max_seek_seconds)
+        return false;
+    position = std::chrono::milliseconds{static_cast<int64_t>(seconds * 1000)};
+    return fields > 0;
+}
+
+void discord::voice_context::seek(const std::string &params)
+{
+    if (p_state != voice_context::state::playing && p_state != voice_context::state::paused)
+        return;
+
+    auto position = std::chrono::milliseconds{};
+    if (!parse_position(params, position)) {
+        std::cerr << "[voice] invalid seek position: " << params << "\n";
+        return;
+    }
+
+    // Only the source moves, the RTP timestamp keeps counting the samples actually sent, so
+    // listeners see an uninterrupted stream. The worker encoding the source does the seek
+    flush_sealed();
+    stream->seek(position);
+}
+
 void discord::voice_context::play()
 {
     if (p_state == voice_context::state::playing)
@@ -303,7 +441,7 @@ void discord::voice_context::play()
         next_audio_source();
     } else if (p_state == voice_context::state::paused) {
         p_state = voice_context::state::playing;  // Resume
-        send_next_frame();
+        scheduler.add(*this);
     }
 }
 
@@ -311,6 +449,8 @@ void discord::voice_context::pause()
 {
     if (p_state == voice_context::state::playing) {
         p_state = voice_context::state::paused;
+        scheduler.remove(*this);
+        flush_sealed();
         gateway->stop();
     }
 }
@@ -322,7 +462,8 @@ void discord::voice_context::notify_audio_source_ready(const boost::system::erro
         return;
     }
     p_state = voice_context::state::playing;
-    send_next_frame();
+    stream = workers.attach(source, ctx);
+    scheduler.add(*this);
 }
 
 void discord::voice_context::next_audio_source()
@@ -334,78 +475,120 @@ void discord::voice_context::next_audio_source()
     auto next = std::move(music_queue.front());
     music_queue.pop_front();
 
-    auto parsed = uri::parse(next);
+    stop_stream();
+    auto parsed = uri::parse_view(next);
     if (parsed.authority.empty()) {
         std::cerr << "[voice] invalid audio source\n";
         return;
     }
     static auto valid_youtube_dl_sources =
-        std::set<std::string>{"youtube.com", "youtu.be", "www.youtube.com"};
+        std::set<std::string, std::less<>>{"youtube.com", "youtu.be", "www.youtube.com"};
 
     if (valid_youtube_dl_sources.count(parsed.authority)) {
         source = std::make_shared<youtube_dl_source>(*this, next);
         source->prepare();
     } else if (parsed.scheme == "file") {
-        source = std::make_shared<file_source>(*this, parsed.path);
+        source = std::make_shared<file_source>(*this, std::string{parsed.path});
         source->prepare();
     }
 }
 
-void discord::voice_context::send_next_frame()
+// Called by the scheduler once per 20 ms tick while playing
+discord::frame_scheduler::send_result discord::voice_context::send_next_frame()
 {
+    using result = discord::frame_scheduler::send_result;
     if (p_state != voice_context::state::playing)
-        return;
-
-    assert(source);
-
-    using namespace std::chrono;
-    using namespace std::chrono;
-    static auto last_frame_time = high_resolution_clock::now();
-    static auto last_frame_size = 0;
-
-    auto start = high_resolution_clock::now();
-    auto frame = source->next();
-    auto retrieval_time_us =
-        duration_cast<microseconds>(high_resolution_clock::now() - start).count();
-    auto time_since_last_frame_us = duration_cast<microseconds>(start - last_frame_time).count();
-
-    // auto timer_done_cb = [weak = weak_from_this()](const auto &ec) {
-    auto timer_done_cb = [this](const auto &ec) {
-        if (!ec)
-            send_next_frame();
-    };
-
-    if (!frame.data.empty()) {
-        auto fc = frame.frame_count;
-        if (!(fc == 120 || fc == 240 || fc == 480 || fc == 960 || fc == 1920 || fc == 2880)) {
-            std::cerr << "[voice] invalid frame size: " << fc << "\n";
-            return;
-        }
-
-        auto expected_time_diff = last_frame_size * 1000 / 48;
-        auto time_offset = std::max<int64_t>(time_since_last_frame_us - expected_time_diff, 0);
-
-        // Next timer expires after frame_size / 48000 seconds, or frame size / 48 ms
-        auto expires_us = frame.frame_count * 1000 / 48 - retrieval_time_us - time_offset;
-        timer.expires_after(microseconds(expires_us));
-
-        // Play the frame
-        gateway->play(frame);
-    } else if (!frame.end_of_source) {
-        // Data from source not yet available... try again in a little
-        timer.expires_from_now(microseconds(500));
+        return result::finished;
+
+    assert(stream);
+
+    // Normally sealed after the previous tick. Only takes a frame the worker already encoded,
+    // nothing if it is behind
+    if (sealed_count == 0)
+        seal_ahead(1);
+    if (sealed_count == 0)
+        return result::not_ready;
+
+    auto packet = sealed[sealed_first];
+    sealed_first = (sealed_first + 1) % sealed.size();
+    sealed_count--;
+
+    auto *frame = packet.frame;
+    auto end_of_source = frame->end_of_source;
+    if (!frame->empty() && frame->frame_count != 960) {
+        // Every tick is one 20 ms frame, 960 samples at 48 kHz. The track ends like any other
+        std::cerr << "[voice] invalid frame size: " << frame->frame_count << "\n";
+        stream->release(frame);
+        end_of_source = true;
+    } else if (packet.size == 0) {
+        stream->release(frame);
+    } else {
+        // Sent from the stream's queue, the slot is given back once the socket is done with it.
+        // The handler keeps the stream alive in case playback stops before that
+        gateway->play(*frame, packet.size, [stream = stream, frame](const auto &, auto) {
+            stream->release(frame);
+        });
     }
-    if (frame.end_of_source) {
+    if (end_of_source) {
         // Done with the current source, play next entry
         std::cout << "[voice] sound clip finished\n";
-        timer.cancel();
+        scheduler.remove(*this);
+        stop_stream();
         gateway->stop();
         p_state = voice_context::state::connected;
         play();
+        return result::finished;
+    }
+    post_seal_ahead();
+    return result::sent;
+}
+
+void discord::voice_context::skip_frames(uint64_t count)
+{
+    if (gateway)
+        gateway->skip(static_cast<uint32_t>(count * 960));
+}
+
+// Seals frames the worker has ready until the look-ahead holds the given number
+void discord::voice_context::seal_ahead(size_t frames)
+{
+    while (sealed_count < frames) {
+        auto *frame = stream->next();
+        if (!frame)
+            return;
+        auto size = size_t{0};
+        if (!frame->empty() && frame->frame_count == 960)
+            size = gateway->seal(*frame);
+        sealed[(sealed_first + sealed_count) % sealed.size()] = sealed_packet{frame, size};
+        sealed_count++;
+    }
+}
+
+// Tops the look-ahead up once the running tick is over, after every guild's packets went out
+void discord::voice_context::post_seal_ahead()
+{
+    if (seal_posted || sealed_count >= lookahead_frames)
+        return;
+    seal_posted = true;
+    boost::asio::post(ctx, make_custom_alloc_handler(seal_memory, [self = shared_from_this()] {
+        self->seal_posted = false;
+        if (self->p_state == voice_context::state::playing)
+            self->seal_ahead(self->lookahead_frames);
+    }));
+}
+
+// Gives the sealed frames back to the stream unsent, newest first. Each is decrypted again and
+// hands its sequence number and timestamp back to the RTP session, so whatever is sent next
+// carries on where the last sent packet left off
+void discord::voice_context::flush_sealed()
+{
+    while (sealed_count > 0) {
+        sealed_count--;
+        auto &packet = sealed[(sealed_first + sealed_count) % sealed.size()];
+        if (packet.size > 0 && gateway)
+            gateway->unseal(*packet.frame);
+        stream->unget(packet.frame);
     }
-    last_frame_size = frame.frame_count;
-    last_frame_time = start;
-    timer.async_wait(timer_done_cb);
 }
 
 discord::snowflake discord::voice_context::get_channel_id() const
@@ -438,12 +621,27 @@ void discord::voice_context::set_endpoint(const std::string &s)
     endpoint = s;
 }
 
-discord::opus_encoder &discord::voice_context::get_encoder()
+std::shared_ptr<discord::opus_encoder> discord::voice_context::get_encoder()
 {
     return encoder;
 }
 
+discord::udp_egress *discord::voice_context::get_egress()
+{
+    return egress;
+}
+
+stream_resolver *discord::voice_context::get_resolver()
+{
+    return resolver;
+}
+
 boost::asio::io_context &discord::voice_context::get_io_context()
 {
     return ctx;
 }
+
+const discord::options &discord::voice_context::get_options() const
+{
+    return opts;
+}
@@ -1,16 +1,25 @@
 #ifndef DISCORD_VOICE_CONNECTOR_H
 #define DISCORD_VOICE_CONNECTOR_H
 
-#include <boost/asio/high_resolution_timer.hpp>
+#include <array>
 #include <boost/asio/io_context.hpp>
+#include <chrono>
 #include <deque>
 #include <memory>
+#include <vector>
 
 #include "aliases.h"
 #include "audio/opus_encoder.h"
 #include "audio/source.h"
+#include "audio/stream_resolver.h"
+#include "audio/worker_pool.h"
 #include "discord.h"
 #include "gateway_store.h"
+#include "net/handler_memory.h"
+#include "net/udp_egress.h"
+#include "options.h"
+#include "voice/frame_scheduler.h"
+#include "voice/voice_thread.h"
 
 namespace discord
 {
@@ -20,23 +29,29 @@ class voice_connector;
 
 struct voice_context : std::enable_shared_from_this<voice_context> {
 public:
-    voice_context(boost::asio::io_context &ctx, const discord::gateway_store &store);
+    voice_context(boost::asio::io_context &ctx, const discord::options &opts,
+                  audio_worker_pool &workers, discord::frame_scheduler &scheduler,
+                  discord::udp_egress *egress, stream_resolver *resolver);
     ~voice_context();
-    void on_voice_state_update(discord::voice_state s);
+
+    // channel is what the gateway store knows about the channel joined, if anything
+    void on_voice_state_update(discord::voice_state s, const discord::channel &channel);
     void on_voice_server_update(discord::event::voice_server_update v, discord::snowflake user_id,
                                 ssl::context &tls);
     void notify_audio_source_ready(const boost::system::error_code &ec);
     void disconnect();
 
-    void send_next_frame();
+    discord::frame_scheduler::send_result send_next_frame();
+    // Ticks that went by without a frame to send, nothing was sealed for them
+    void skip_frames(uint64_t count);
     void next_audio_source();
     void join_channel(const std::string &s);
     void leave_channel();
     void add_queue(const std::string &s);
     void list_queue();
     void skip_current();
+    void seek(const std::string &position);
     void play();
-    void play(const opus_frame &frame);
     void pause();
 
     discord::snowflake get_channel_id() const;
@@ -46,19 +61,28 @@ public:
     const std::string &get_endpoint() const;
     void set_endpoint(const std::string &s);
 
-    discord::opus_encoder &get_encoder();
+    std::shared_ptr<discord::opus_encoder> get_encoder();
+    discord::udp_egress *get_egress();
+    stream_resolver *get_resolver();
     boost::asio::io_context &get_io_context();
+    const discord::options &get_options() const;
 
 private:
     boost::asio::io_context &ctx;
-    boost::asio::high_resolution_timer timer;
 
     std::shared_ptr<audio_source> source;
+    std::shared_ptr<audio_stream> stream;  // frames of source, encoded ahead by a worker
     std::shared_ptr<discord::voice_gateway> gateway;
     std::deque<std::string> music_queue;
 
-    const discord::gateway_store &store;
-    discord::opus_encoder encoder{2, 48000};
+    const discord::options &opts;
+    audio_worker_pool &workers;
+    discord::frame_scheduler &scheduler;
+    discord::udp_egress *egress;
+    stream_resolver *resolver;  // null with --resolver-processes=0
+    // Shared with the sources, which keep encoding on a worker until it drops them
+    std::shared_ptr<discord::opus_encoder> encoder =
+        std::make_shared<discord::opus_encoder>(2, 48000);
     discord::snowflake channel_id;
     discord::snowflake guild_id;
 
@@ -67,33 +91,80 @@ private:
     std::string endpoint;
     enum class state { disconnected, connected, playing, paused } p_state;
 
-    void update_bitrate();
+    // Frames taken from the stream and sealed into RTP packets ahead of their tick, oldest first.
+    // Topped up after the tick's sends so the deadline only sends. A size of 0 is a frame that is
+    // not sent, the end of the source or one that could not be sealed
+    struct sealed_packet {
+        opus_frame *frame;
+        size_t size;
+    };
+    std::array<sealed_packet, audio_stream::lookahead> sealed;
+    size_t sealed_first = 0;
+    size_t sealed_count = 0;
+    size_t lookahead_frames;
+    bool seal_posted = false;
+    discord::handler_memory<128, 1> seal_memory;
+
+    void stop_stream();
+    void seal_ahead(size_t frames);
+    void post_seal_ahead();
+    void flush_sealed();
 };
 
+// Gateway events arrive on the gateway's thread, from the shard the guild is on, whose store can
+// be read there and which takes the replies. Voice connections live on voice threads, each guild
+// always on the same one; everything they need from the gateway side is looked up first and handed
+// over with the event
 class voice_connector : public std::enable_shared_from_this<voice_connector>
 {
 public:
-    voice_connector(boost::asio::io_context &ctx, ssl::context &tls, discord::gateway &gateway);
+    voice_connector(ssl::context &tls, const discord::options &opts);
     ~voice_connector();
 
-    void disconnect();
-    void on_voice_state_update(const nlohmann::json &data);
-    void on_voice_server_update(const nlohmann::json &data);
-    void on_message_create(const nlohmann::json &data);
-    const discord::gateway &get_gateway() const;
+    void on_voice_state_update(const discord::gateway &from, const nlohmann::json &data);
+    void on_voice_server_update(const discord::gateway &from, const nlohmann::json &data);
+    void on_message_create(discord::gateway &from, const nlohmann::json &data);
+
+    // Worst lateness of a voice frame since the last call, from any thread
+    std::chrono::steady_clock::duration take_peak_lateness();
 
 private:
-    boost::asio::io_context &ctx;
-    ssl::context &tls;
-    discord::gateway &gateway;
+    // A voice thread and what the connections on it share. The thread is the only one touching
+    // the rest, so they need no locking
+    struct voice_shard {
+        voice_shard(const discord::options &opts, size_t index);
+
+        discord::voice_thread thread;
+        discord::frame_scheduler scheduler;
+        std::unique_ptr<discord::udp_egress> egress;  // only with --batched-egress
 
-    // guild_id to voice_context (1 voice connection per guild)
-    std::map<discord::snowflake, std::shared_ptr<discord::voice_context>> voice_map;
+        // guild_id to voice_context (1 voice connection per guild)
+        std::map<discord::snowflake, std::shared_ptr<discord::voice_context>> voice_map;
 
-    void join_voice_server(discord::snowflake guild_id, discord::snowflake channel_id);
-    void leave_voice_server(discord::snowflake guild_id);
-    void check_command(const discord::message &m);
-    void join_channel(const discord::message &m, const std::string &s);
+        void disconnect();
+    };
+
+    ssl::context &tls;
+    const discord::options &opts;
+    std::vector<std::unique_ptr<voice_shard>> shards;
+
+    // Declared after the shards so their threads stop first, they hand sources and answers back
+    // to them
+    std::unique_ptr<stream_resolver> resolver;
+    audio_worker_pool workers;
+
+    voice_shard &shard_for(discord::snowflake guild_id);
+    void run_command(voice_shard &shard, discord::snowflake guild_id, const std::string &command,
+                     const std::string &params);
+
+    // Gateway thread
+    void join_voice_server(discord::gateway &from, discord::snowflake guild_id,
+                           discord::snowflake channel_id);
+    void leave_voice_server(discord::gateway &from, discord::snowflake guild_id);
+    void check_command(discord::gateway &from, const discord::message &m);
+    void join_channel(discord::gateway &from, const discord::message &m, const std::string &s);
+    discord::snowflake own_voice_channel(const discord::gateway &from,
+                                         const discord::guild &guild) const;
 };
 }  // namespace discord
 
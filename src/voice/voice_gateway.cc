@@ -14,11 +14,12 @@ discord::voice_gateway::voice_gateway(boost::asio::io_context &ctx, ssl::context
     : ctx{ctx}
     , voice_context{voice_context}
     , conn{ctx, tls}
-    , rtp{ctx}
+    , rtp{ctx, voice_context.get_egress()}
     , beater{ctx}
     , user_id{user_id}
     , state{connection_state::disconnected}
-    , is_speaking{false}
+    , speaking_requested{false}
+    , mode{discord::crypto::mode::xsalsa20_poly1305}
 {
     std::cout << "[voice] connecting to gateway " << voice_context.get_endpoint() << " session_id["
               << voice_context.get_session_id() << "] token[" << voice_context.get_token() << "]\n";
@@ -133,13 +134,14 @@ void discord::voice_gateway::heartbeat()
 {
     // TODO: save the nonce (rand()) and check if it is ACKed
     auto json = nlohmann::json{{"op", static_cast<int>(voice_op::heartbeat)}, {"d", rand()}};
-    send(json.dump(), ignore_transfer);
+    conn.send_heartbeat(json.dump(), ignore_transfer);
 }
 
 void discord::voice_gateway::extract_ready_info(nlohmann::json &data)
 {
     auto ready_info = data.get<discord::voice_ready>();
     rtp.set_ssrc(ready_info.ssrc);
+    mode = discord::crypto::choose_mode(ready_info.modes);
 
     auto connect_cb = [weak = weak_from_this()](const auto &ec) {
         if (auto self = weak.lock()) {
@@ -164,14 +166,16 @@ void discord::voice_gateway::extract_ready_info(nlohmann::json &data)
 void discord::voice_gateway::extract_session_info(nlohmann::json &data)
 {
     auto session_info = data.get<discord::voice_session>();
-    if (session_info.mode != "xsalsa20_poly1305")
+    auto session_mode = discord::crypto::mode{};
+    if (!discord::crypto::parse_mode(session_info.mode, session_mode))
         throw std::runtime_error("Unsupported voice mode: " + session_info.mode);
 
     if (session_info.secret_key.size() != 32)
         throw std::runtime_error("Expected 32 byte secret key but got " +
                                  std::to_string(session_info.secret_key.size()));
 
-    rtp.set_secret_key(std::move(session_info.secret_key));
+    std::cout << "[voice] encrypting with " << session_info.mode << "\n";
+    rtp.set_secret_key(session_mode, session_info.secret_key);
 
     // We are ready to start speaking!
     boost::asio::post(ctx, [&]() { voice_connect_callback({}); });
@@ -185,7 +189,7 @@ void discord::voice_gateway::select()
                                            {"data",
                                             {{"address", rtp.get_external_ip()},
                                              {"port", rtp.get_external_port()},
-                                             {"mode", "xsalsa20_poly1305"}}}}}};
+                                             {"mode", discord::crypto::mode_name(mode)}}}}}};
 
     send(select_payload.dump(), ignore_transfer);
 }
@@ -233,23 +237,23 @@ void discord::voice_gateway::stop_speaking(transfer_cb c)
     do_speak(this, c, false);
 }
 
-void discord::voice_gateway::play(const opus_frame &frame)
+size_t discord::voice_gateway::seal(opus_frame &frame)
 {
-    if (!is_speaking) {
-        auto speak_sent_cb = [=](const auto &ec, auto) {
-            if (!ec) {
-                is_speaking = true;
-                rtp.send(frame);
-            }
-        };
-        start_speaking(speak_sent_cb);
-    } else {
-        rtp.send(frame);
-    }
+    return rtp.seal(frame);
+}
+
+void discord::voice_gateway::unseal(opus_frame &frame)
+{
+    rtp.unseal(frame);
+}
+
+void discord::voice_gateway::skip(uint32_t samples)
+{
+    rtp.skip(samples);
 }
 
 void discord::voice_gateway::stop()
 {
-    is_speaking = false;
+    speaking_requested = false;
     stop_speaking(ignore_transfer);
 }
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "aliases.h"
@@ -14,6 +15,7 @@
 #include "heartbeater.h"
 #include "net/connection.h"
 #include "net/rtp.h"
+#include "voice/crypto.h"
 
 namespace discord
 {
@@ -27,7 +29,13 @@ public:
     void send(const std::string &s, transfer_cb c);
     void connect(error_cb c);
     void disconnect();
-    void play(const opus_frame &frame);
+
+    // Seals frames ahead of time and sends them from their own buffer, see rtp_session
+    size_t seal(opus_frame &frame);
+    void unseal(opus_frame &frame);
+    void skip(uint32_t samples);
+    template<typename Handler>
+    void play(opus_frame &frame, size_t size, Handler &&on_sent);
     void stop();
 
 private:
@@ -39,12 +47,12 @@ private:
     discord::snowflake user_id;
 
     enum class connection_state { disconnected, connected } state;
-    bool is_speaking;
+    bool speaking_requested;  // start_speaking is queued or sent, until stop
+    discord::crypto::mode mode;  // chosen from what the server offers in ready
     error_cb voice_connect_callback;
 
     void start_speaking(transfer_cb c);
     void stop_speaking(transfer_cb c);
-    void send_audio(opus_frame audio);
     void identify();
     void resume();
     void next_event();
@@ -56,4 +64,19 @@ private:
 };
 }  // namespace discord
 
+template<typename Handler>
+void discord::voice_gateway::play(opus_frame &frame, size_t size, Handler &&on_sent)
+{
+    // Queued once per track, frames don't wait for it to be written. A failed write asks again
+    // with the next frame
+    if (!speaking_requested) {
+        speaking_requested = true;
+        start_speaking([weak = weak_from_this()](const auto &ec, auto) {
+            if (auto self = weak.lock(); self && ec)
+                self->speaking_requested = false;
+        });
+    }
+    rtp.send_sealed(frame, size, std::forward<Handler>(on_sent));
+}
+
 #endif
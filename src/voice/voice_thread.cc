@@ -0,0 +1,81 @@
+#include <boost/asio/post.hpp>
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+
+#include "voice/voice_thread.h"
+
+discord::voice_thread::voice_thread(int priority, int cpu)
+    : work{ctx.get_executor()}, drain_posted{false}
+{
+    thread = std::thread{[this, priority, cpu] { run(priority, cpu); }};
+}
+
+discord::voice_thread::~voice_thread()
+{
+    stop();
+}
+
+boost::asio::io_context &discord::voice_thread::get_io_context()
+{
+    return ctx;
+}
+
+void discord::voice_thread::post(std::function<void()> task)
+{
+    // Only when the voice thread falls a whole queue behind, which it never should
+    while (!tasks.push(std::move(task)))
+        std::this_thread::yield();
+
+    if (!drain_posted.exchange(true))
+        boost::asio::post(ctx, [this] { drain(); });
+}
+
+void discord::voice_thread::stop()
+{
+    if (!thread.joinable())
+        return;
+    // Handlers that are ready by then run first, completions of what the tasks closed may hold
+    // on to objects that must go before the io_context does
+    post([this] { boost::asio::post(ctx, [this] { ctx.stop(); }); });
+    thread.join();
+}
+
+void discord::voice_thread::drain()
+{
+    // Cleared first, a task pushed from here on posts another drain
+    drain_posted = false;
+    while (auto *task = tasks.front()) {
+        auto run = std::move(*task);
+        *task = nullptr;
+        tasks.pop();
+        run();
+    }
+}
+
+void discord::voice_thread::run(int priority, int cpu)
+{
+    if (priority > 0) {
+        auto param = sched_param{};
+        param.sched_priority = priority;
+        if (auto error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param))
+            std::cerr << "[voice thread] could not use SCHED_FIFO priority " << priority << ": "
+                      << std::strerror(error) << "\n";
+        else
+            std::cout << "[voice thread] running with SCHED_FIFO priority " << priority << "\n";
+    }
+
+    if (cpu >= 0) {
+        auto set = cpu_set_t{};
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (auto error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+            std::cerr << "[voice thread] could not pin to CPU " << cpu << ": "
+                      << std::strerror(error) << "\n";
+        else
+            std::cout << "[voice thread] pinned to CPU " << cpu << "\n";
+    }
+
+    ctx.run();
+}
@@ -0,0 +1,52 @@
+#ifndef DISCORD_VOICE_THREAD_H
+#define DISCORD_VOICE_THREAD_H
+
+#include <atomic>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <functional>
+#include <thread>
+
+#include "spsc_queue.h"
+
+namespace discord
+{
+// The thread every voice connection runs on, with an io_context of its own, so a big gateway event
+// being parsed on the main thread can't hold up the 20 ms frame timers. Optionally runs with
+// SCHED_FIFO priority and pinned to one CPU.
+//
+// The gateway thread hands work over through a lock-free queue. The io_context is only woken up
+// once per batch of tasks, not for every task
+class voice_thread
+{
+public:
+    // priority 0 keeps the normal scheduler, cpu -1 lets the thread run anywhere
+    voice_thread(int priority, int cpu);
+    ~voice_thread();
+    voice_thread(const voice_thread &) = delete;
+    voice_thread &operator=(const voice_thread &) = delete;
+
+    boost::asio::io_context &get_io_context();
+
+    // Runs task on the voice thread, in the order posted. Only one other thread may post
+    void post(std::function<void()> task);
+
+    // Runs what was posted so far and the handlers that became ready meanwhile, then stops the
+    // thread and waits for it
+    void stop();
+
+private:
+    static constexpr size_t queue_size = 1024;
+
+    boost::asio::io_context ctx;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
+    discord::spsc_queue<std::function<void()>, queue_size> tasks;
+    std::atomic<bool> drain_posted;
+    std::thread thread;
+
+    void run(int priority, int cpu);
+    void drain();
+};
+}  // namespace discord
+
+#endif
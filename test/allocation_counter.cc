@@ -0,0 +1,32 @@
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+#include "allocation_counter.h"
+
+std::atomic<size_t> allocations{0};
+std::atomic<size_t> allocated_bytes{0};
+std::atomic<size_t> live_bytes{0};
+
+void *operator new(size_t size)
+{
+    allocations++;
+    allocated_bytes += size;
+    if (auto *p = std::malloc(size ? size : 1)) {
+        live_bytes += malloc_usable_size(p);
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *p) noexcept
+{
+    live_bytes -= malloc_usable_size(p);
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    live_bytes -= malloc_usable_size(p);
+    std::free(p);
+}
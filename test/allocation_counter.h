@@ -0,0 +1,14 @@
+#ifndef TEST_ALLOCATION_COUNTER_H
+#define TEST_ALLOCATION_COUNTER_H
+
+#include <atomic>
+#include <cstddef>
+
+// Counts what goes through operator new, on any thread, so a test or bench can check what a
+// stretch of code allocates. Linking allocation_counter.cc replaces the global operator new and
+// delete
+extern std::atomic<size_t> allocations;
+extern std::atomic<size_t> allocated_bytes;
+extern std::atomic<size_t> live_bytes;  // heap in use, allocator overhead included
+
+#endif
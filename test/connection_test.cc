@@ -0,0 +1,251 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <boost/asio/io_context.hpp>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+#include <zlib.h>
+
+#include "aliases.h"
+#include "errors.h"
+#include "net/connection.h"
+#include "websocket_stand_in.h"
+
+// Compresses payloads the way the gateway does for compress=zlib-stream: one deflate stream for
+// the whole connection, each payload ending in a sync flush
+static std::vector<std::string> deflate_payloads(const std::vector<std::string> &payloads)
+{
+    auto zs = z_stream{};
+    deflateInit(&zs, Z_DEFAULT_COMPRESSION);
+    auto compressed = std::vector<std::string>{};
+    for (auto &payload : payloads) {
+        auto out = std::string(deflateBound(&zs, payload.size()) + 16, '\0');
+        zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(payload.data()));
+        zs.avail_in = static_cast<uInt>(payload.size());
+        zs.next_out = reinterpret_cast<Bytef *>(&out[0]);
+        zs.avail_out = static_cast<uInt>(out.size());
+        deflate(&zs, Z_SYNC_FLUSH);
+        out.resize(out.size() - zs.avail_out);
+        compressed.push_back(std::move(out));
+    }
+    deflateEnd(&zs);
+    return compressed;
+}
+
+static std::vector<std::string> read_events(const char *path)
+{
+    auto file = std::ifstream{path};
+    auto events = std::vector<std::string>{};
+    for (auto line = std::string{}; std::getline(file, line);)
+        if (!line.empty())
+            events.push_back(std::move(line));
+    return events;
+}
+
+// What the client sent, once the stand-in has count messages
+static std::vector<std::string> wait_for_sent(websocket_stand_in &stand_in, size_t count)
+{
+    auto sent = std::vector<std::string>{};
+    for (auto &m : stand_in.wait_for_received(count))
+        sent.push_back(std::move(m.data));
+    return sent;
+}
+
+class Connection : public ::testing::Test
+{
+protected:
+    boost::asio::io_context ctx;
+    ssl::context tls{ssl::context::tls_client};
+    discord::connection conn{ctx, tls};
+    std::vector<std::string> received;
+    boost::system::error_code read_error;
+
+    // Connects and reads until count messages came or reading failed
+    void receive(const std::string &url, size_t count)
+    {
+        conn.connect(url, [this, count](const auto &ec) {
+            ASSERT_FALSE(ec) << ec.message();
+            read_next(count);
+        });
+        ctx.run_for(std::chrono::seconds(10));
+        conn.disconnect();
+    }
+
+    void connect(const std::string &url)
+    {
+        auto connected = false;
+        conn.connect(url, [&](const auto &ec) {
+            ASSERT_FALSE(ec) << ec.message();
+            connected = true;
+        });
+        while (!connected && ctx.run_one_for(std::chrono::seconds(5)))
+            ;
+        ASSERT_TRUE(connected);
+        // Running out of work stopped the context
+        ctx.restart();
+    }
+
+    void read_next(size_t count)
+    {
+        if (received.size() == count)
+            return;
+        conn.read_message([this, count](const auto &ec, auto message) {
+            if (ec) {
+                read_error = ec;
+                return;
+            }
+            received.emplace_back(message);
+            read_next(count);
+        });
+    }
+};
+
+TEST_F(Connection, InflatesAReplayedEventStream)
+{
+    auto events = read_events("./res/event_stream");
+    ASSERT_FALSE(events.empty());
+    auto stand_in = websocket_stand_in{deflate_payloads(events)};
+    receive(stand_in.url("&encoding=json&compress=zlib-stream"), events.size());
+
+    EXPECT_FALSE(read_error) << read_error.message();
+    ASSERT_EQ(received.size(), events.size());
+    EXPECT_EQ(received, events);
+
+    auto *inflater = conn.compression();
+    ASSERT_NE(inflater, nullptr);
+    auto bytes = size_t{0};
+    for (auto &e : events)
+        bytes += e.size();
+    EXPECT_EQ(inflater->inflated_bytes(), bytes);
+    EXPECT_LT(inflater->compressed_bytes() * 3, bytes);
+}
+
+TEST_F(Connection, JoinsLargePayloadsSplitOverMessages)
+{
+    auto events = read_events("./res/event_stream");
+    events.resize(50);
+    // Bigger than the inflate buffer starts out, which has to grow partway through
+    auto file = std::ifstream{"./res/guild_create1"};
+    auto guild = std::string{std::istreambuf_iterator<char>{file}, {}};
+    auto large = std::string{};
+    for (auto i = 0; i < 10; ++i)
+        large += guild;
+    events.push_back(large);
+    auto messages = std::vector<std::string>{};
+    for (auto &payload : deflate_payloads(events)) {
+        auto half = payload.size() / 2;
+        messages.push_back(payload.substr(0, half));
+        messages.push_back(payload.substr(half));
+    }
+    auto stand_in = websocket_stand_in{std::move(messages)};
+    receive(stand_in.url("&encoding=json&compress=zlib-stream"), events.size());
+
+    EXPECT_FALSE(read_error) << read_error.message();
+    EXPECT_EQ(received, events);
+}
+
+TEST_F(Connection, PassesMessagesThroughWithoutCompress)
+{
+    auto events = read_events("./res/event_stream");
+    events.resize(10);
+    auto stand_in = websocket_stand_in{events};
+    receive(stand_in.url("&encoding=json"), events.size());
+
+    EXPECT_EQ(conn.compression(), nullptr);
+    EXPECT_EQ(received, events);
+}
+
+TEST_F(Connection, FailsTheReadOnCorruptData)
+{
+    auto stand_in = websocket_stand_in{{std::string("not zlib\0\0\xff\xff", 12)}};
+    receive(stand_in.url("&encoding=json&compress=zlib-stream"), 1);
+
+    EXPECT_TRUE(received.empty());
+    EXPECT_EQ(read_error, make_error_code(gateway_errc::decode_error));
+}
+
+TEST_F(Connection, SendsInOrderWithoutBlocking)
+{
+    auto stand_in = websocket_stand_in{};
+    connect(stand_in.url("&encoding=json"));
+
+    auto sent = std::vector<std::string>{"a", "b", "c"};
+    auto completed = std::vector<boost::system::error_code>{};
+    for (auto &s : sent)
+        conn.send(s, [&](const auto &ec, size_t) { completed.push_back(ec); });
+    EXPECT_TRUE(completed.empty());
+    EXPECT_EQ(conn.send_queue_depth(), 3u);
+
+    ctx.run_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(completed, std::vector<boost::system::error_code>(3));
+    EXPECT_EQ(conn.send_queue_depth(), 0u);
+    EXPECT_EQ(wait_for_sent(stand_in, 3), sent);
+    conn.disconnect();
+}
+
+TEST_F(Connection, RateLimitHoldsCommandsBackButNotHeartbeats)
+{
+    auto stand_in = websocket_stand_in{};
+    conn.set_rate_limit(2, std::chrono::milliseconds(200));
+    connect(stand_in.url("&encoding=json"));
+
+    for (auto s : {"1", "2", "3", "4"})
+        conn.send(s, ignore_transfer);
+    conn.send_heartbeat("heartbeat", ignore_transfer);
+
+    // Two tokens to start with, the heartbeat goes right after the message already being written
+    ctx.run_for(std::chrono::milliseconds(100));
+    auto expected = std::vector<std::string>{"1", "heartbeat", "2"};
+    EXPECT_EQ(wait_for_sent(stand_in, 3), expected);
+    EXPECT_EQ(conn.send_queue_depth(), 2u);
+
+    // Then one every 200 ms
+    ctx.run_for(std::chrono::milliseconds(500));
+    expected.insert(expected.end(), {"3", "4"});
+    EXPECT_EQ(wait_for_sent(stand_in, 5), expected);
+    EXPECT_GE(conn.take_peak_send_wait(), std::chrono::milliseconds(350));
+    EXPECT_EQ(conn.take_peak_send_wait(), std::chrono::nanoseconds{0});
+    conn.disconnect();
+}
+
+TEST_F(Connection, NewerHeartbeatReplacesAQueuedOne)
+{
+    auto stand_in = websocket_stand_in{};
+    connect(stand_in.url("&encoding=json"));
+
+    auto first = boost::system::error_code{};
+    conn.send("command", ignore_transfer);
+    conn.send_heartbeat("heartbeat 1", [&](const auto &ec, size_t) { first = ec; });
+    conn.send_heartbeat("heartbeat 2", ignore_transfer);
+    ctx.run_for(std::chrono::milliseconds(100));
+
+    EXPECT_EQ(first, boost::asio::error::operation_aborted);
+    auto expected = std::vector<std::string>{"command", "heartbeat 2"};
+    EXPECT_EQ(wait_for_sent(stand_in, 2), expected);
+    conn.disconnect();
+}
+
+TEST_F(Connection, DisconnectDropsWhatIsQueued)
+{
+    auto stand_in = websocket_stand_in{};
+    connect(stand_in.url("&encoding=json"));
+
+    auto results = std::vector<boost::system::error_code>{};
+    for (auto s : {"1", "2", "3"})
+        conn.send(s, [&](const auto &ec, size_t) { results.push_back(ec); });
+    conn.disconnect();
+    ctx.run_for(std::chrono::milliseconds(100));
+
+    // The first was being written already
+    ASSERT_EQ(results.size(), 3u);
+    EXPECT_EQ(std::count(results.begin(), results.end(), boost::asio::error::operation_aborted), 2);
+    EXPECT_EQ(wait_for_sent(stand_in, 1), std::vector<std::string>{"1"});
+}
+
+int main(int argc, char *argv[])
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
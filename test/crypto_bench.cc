@@ -0,0 +1,50 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "audio/source.h"
+#include "voice/crypto.h"
+
+// Time to seal one packet of a 20 ms frame at 128 Kbps in every voice encryption mode
+int main(int argc, char *argv[])
+{
+    using discord::crypto::mode;
+    using clock = std::chrono::steady_clock;
+
+    auto packets = argc > 1 ? std::atoi(argv[1]) : 200000;
+    discord::crypto::init();
+    std::cout << "AES-GCM in hardware: " << (crypto_aead_aes256gcm_is_available() ? "yes" : "no")
+              << "\n";
+
+    auto key = std::vector<uint8_t>(32, 1);
+    auto frame = opus_frame{};
+    frame.size = 320;
+
+    for (auto m : {mode::xsalsa20_poly1305, mode::xsalsa20_poly1305_suffix,
+                   mode::xsalsa20_poly1305_lite, mode::aead_aes256_gcm}) {
+        if (m == mode::aead_aes256_gcm && !crypto_aead_aes256gcm_is_available()) {
+            std::cout << discord::crypto::mode_name(m) << ": unavailable\n";
+            continue;
+        }
+
+        auto cipher = discord::crypto::voice_cipher{};
+        cipher.set_key(m, key);
+
+        auto start = clock::now();
+        for (auto i = 0; i < packets; ++i) {
+            // Like rtp_session, a new header for every packet
+            frame.packet[2] = i >> 8;
+            frame.packet[3] = i;
+            if (cipher.seal(frame.packet.data(), frame.size) == 0) {
+                std::cerr << discord::crypto::mode_name(m) << ": encryption failed\n";
+                return EXIT_FAILURE;
+            }
+        }
+        auto elapsed = std::chrono::duration<double, std::nano>(clock::now() - start);
+        std::cout << discord::crypto::mode_name(m) << ": " << elapsed.count() / packets
+                  << " ns per packet\n";
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,295 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include "allocation_counter.h"
+#include "audio/worker_pool.h"
+#include "net/rtp.h"
+#include "net/udp_egress.h"
+#include "voice/crypto.h"
+#include "voice/voice_thread.h"
+
+// Endless silence-sized packets, stands in for the decoder and encoder
+struct test_source : audio_source {
+    void next(opus_frame &frame) override
+    {
+        frame.clear();
+        std::memset(frame.payload(), 0xF8, 120);
+        frame.size = 120;
+        frame.frame_count = 960;
+    }
+    void prepare() override {}
+    bool seek(std::chrono::milliseconds) override
+    {
+        return true;
+    }
+};
+
+// Sends frames the way voice_context does, from the worker's queue through RTP, from inside the
+// io_context like the scheduler. Counts allocations over the frames after the first warmup ones,
+// which fill the queue slots and the io_context's handler memory
+static size_t allocations_sending(boost::asio::io_context &ctx, discord::rtp_session &rtp,
+                                  audio_stream &stream, int warmup, int count)
+{
+    auto sent = 0;
+    auto before = size_t{0};
+    auto after = size_t{0};
+
+    std::function<void()> send_next = [&] {
+        if (sent == warmup)
+            before = allocations.load();
+        if (sent == warmup + count) {
+            after = allocations.load();
+            return;
+        }
+        if (auto *frame = stream.next()) {
+            rtp.send(*frame, [&stream, frame](const auto &, auto) { stream.release(frame); });
+            sent++;
+        } else {
+            std::this_thread::yield();
+        }
+        boost::asio::post(ctx, [&] { send_next(); });
+    };
+    boost::asio::post(ctx, [&] { send_next(); });
+    ctx.restart();
+    ctx.run();
+    return after - before;
+}
+
+TEST(FramePath, SteadyStateDoesNotAllocate)
+{
+    auto ctx = boost::asio::io_context{};
+
+    // Packets go to a local socket nobody reads from
+    auto receiver = udp::socket{ctx, udp::endpoint{boost::asio::ip::address_v4::loopback(), 0}};
+    auto rtp = discord::rtp_session{ctx};
+    rtp.set_ssrc(1);
+    rtp.set_secret_key(discord::crypto::mode::xsalsa20_poly1305, std::vector<uint8_t>(32, 1));
+
+    auto connected = false;
+    auto port = std::to_string(receiver.local_endpoint().port());
+    rtp.connect("127.0.0.1", port, [&](const auto &ec) { connected = !ec; });
+    ctx.run();
+    ASSERT_TRUE(connected);
+
+    auto workers = audio_worker_pool{1};
+    auto stream = workers.attach(std::make_shared<test_source>(), ctx);
+
+    EXPECT_EQ(0, allocations_sending(ctx, rtp, *stream, 50, 500));
+
+    stream->cancel();
+}
+
+// Three frames, then the end of the source
+struct short_source : test_source {
+    int left = 3;
+    void next(opus_frame &frame) override
+    {
+        test_source::next(frame);
+        if (left-- == 0) {
+            frame.clear();
+            frame.end_of_source = true;
+        }
+    }
+};
+
+TEST(FramePath, FramesReleasedOutOfOrder)
+{
+    auto ctx = boost::asio::io_context{};
+    auto workers = audio_worker_pool{1};
+    auto stream = workers.attach(std::make_shared<short_source>(), ctx);
+    while (stream->buffered() < 4)
+        std::this_thread::yield();
+
+    // Several sends in flight at once, completing in any order
+    auto *a = stream->next();
+    auto *b = stream->next();
+    auto *c = stream->next();
+    ASSERT_TRUE(a && b && c);
+    EXPECT_NE(a, b);
+    EXPECT_NE(b, c);
+
+    // b's slot can't be reused while a, in front of it, is still being sent
+    stream->release(b);
+    EXPECT_EQ(4, stream->buffered());
+    stream->release(a);
+    EXPECT_EQ(2, stream->buffered());
+    stream->release(c);
+    EXPECT_EQ(1, stream->buffered());
+
+    auto *end = stream->next();
+    ASSERT_TRUE(end);
+    EXPECT_TRUE(end->end_of_source);
+    stream->release(end);
+    stream->cancel();
+}
+
+// Keeps the worker inside next() until let go, like a stream waiting on its download
+struct stalled_source : test_source {
+    std::atomic<bool> reading{false};
+    std::atomic<bool> let_go{false};
+    void next(opus_frame &frame) override
+    {
+        reading = true;
+        while (!let_go)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        test_source::next(frame);
+    }
+};
+
+TEST(FramePath, CancelDoesNotWaitForTheWorker)
+{
+    using namespace std::chrono;
+    auto ctx = boost::asio::io_context{};
+    auto workers = audio_worker_pool{1};
+    auto source = std::make_shared<stalled_source>();
+    auto stream = workers.attach(source, ctx);
+    while (!source->reading)
+        std::this_thread::yield();
+
+    auto let_go = std::thread{[&] {
+        std::this_thread::sleep_for(milliseconds(500));
+        source->let_go = true;
+    }};
+    auto start = steady_clock::now();
+    stream->cancel();
+    EXPECT_LT(steady_clock::now() - start, milliseconds(100));
+    let_go.join();
+
+    // The frame read meanwhile isn't queued, and the source goes back to the io thread
+    while (source.use_count() > 1) {
+        ctx.restart();
+        ctx.run_for(milliseconds(10));
+    }
+    EXPECT_EQ(0, stream->buffered());
+}
+
+TEST(FramePath, UnsealedFrameIsSealedAgainInItsPlace)
+{
+    using discord::crypto::mode;
+    discord::crypto::init();
+    for (auto m : {mode::xsalsa20_poly1305, mode::xsalsa20_poly1305_suffix,
+                   mode::xsalsa20_poly1305_lite, mode::aead_aes256_gcm}) {
+        // Like choose_mode, AES-GCM only where the CPU does it in hardware
+        if (m == mode::aead_aes256_gcm && !crypto_aead_aes256gcm_is_available())
+            continue;
+        SCOPED_TRACE(discord::crypto::mode_name(m));
+        auto ctx = boost::asio::io_context{};
+        auto rtp = discord::rtp_session{ctx};
+        rtp.set_ssrc(1);
+        rtp.set_secret_key(m, std::vector<uint8_t>(32, 1));
+
+        auto source = test_source{};
+        auto a = opus_frame{};
+        auto b = opus_frame{};
+        source.next(a);
+        source.next(b);
+        auto plain = b.packet;
+
+        ASSERT_GT(rtp.seal(a), 0);
+        auto size = rtp.seal(b);
+        ASSERT_GT(size, 0);
+        auto sealed = b.packet;
+
+        // Flushed from the look-ahead: the audio is back and b gets the same sequence number and
+        // timestamp when it is sealed again
+        rtp.unseal(b);
+        EXPECT_TRUE(std::equal(b.payload(), b.payload() + b.size, plain.data() + 12));
+        EXPECT_EQ(size, rtp.seal(b));
+        EXPECT_TRUE(std::equal(sealed.begin(), sealed.begin() + 12, b.packet.begin()));
+    }
+}
+
+// Packets waiting on a socket, without blocking
+static int datagrams_waiting(udp::socket &sock)
+{
+    sock.non_blocking(true);
+    auto count = 0;
+    auto buf = std::array<uint8_t, 2048>{};
+    auto ec = boost::system::error_code{};
+    while (sock.receive(boost::asio::buffer(buf), 0, ec) > 0 || !ec)
+        count++;
+    return count;
+}
+
+TEST(FramePath, BatchedEgressSendsTickTogether)
+{
+    auto ctx = boost::asio::io_context{};
+    auto egress = discord::udp_egress{ctx};
+
+    auto loopback = udp::endpoint{boost::asio::ip::address_v4::loopback(), 0};
+    auto receiver1 = udp::socket{ctx, loopback};
+    auto receiver2 = udp::socket{ctx, loopback};
+    auto rtp1 = discord::rtp_session{ctx, &egress};
+    auto rtp2 = discord::rtp_session{ctx, &egress};
+    auto key = std::vector<uint8_t>(32, 1);
+    for (auto *rtp : {&rtp1, &rtp2})
+        rtp->set_secret_key(discord::crypto::mode::xsalsa20_poly1305, key);
+
+    auto connected = 0;
+    auto on_connect = [&](const auto &ec) { connected += !ec; };
+    rtp1.connect("127.0.0.1", std::to_string(receiver1.local_endpoint().port()), on_connect);
+    rtp2.connect("127.0.0.1", std::to_string(receiver2.local_endpoint().port()), on_connect);
+    ctx.run();
+    ASSERT_EQ(2, connected);
+
+    // One tick where the first guild catches up on a backlog of 4 frames
+    auto source = test_source{};
+    auto frame = opus_frame{};
+    auto completed = 0;
+    auto on_sent = [&](const auto &ec, auto) { completed += !ec; };
+    boost::asio::post(ctx, [&] {
+        for (auto i = 0; i < 4; ++i) {
+            source.next(frame);
+            rtp1.send(frame, on_sent);
+        }
+        source.next(frame);
+        rtp2.send(frame, on_sent);
+    });
+    ctx.restart();
+    ctx.run();
+
+    EXPECT_EQ(5, completed);
+    EXPECT_EQ(4, datagrams_waiting(receiver1));
+    EXPECT_EQ(1, datagrams_waiting(receiver2));
+
+    // A single sendmmsg, or one more if the kernel turned down GSO and it had to retry
+    EXPECT_LE(egress.take_syscalls_per_packet(), 2.0 / 5);
+    EXPECT_EQ(0.0, egress.take_syscalls_per_packet());
+}
+
+TEST(VoiceThread, RunsTasksInOrderOffTheCallingThread)
+{
+    auto voice = discord::voice_thread{0, -1};
+    auto order = std::vector<int>{};
+    auto elsewhere = true;
+    auto caller = std::this_thread::get_id();
+
+    // More than the queue holds, posting waits for the voice thread to catch up
+    for (auto i = 0; i < 5000; ++i) {
+        voice.post([&, i] {
+            order.push_back(i);
+            elsewhere &= std::this_thread::get_id() != caller;
+        });
+    }
+    voice.stop();
+
+    ASSERT_EQ(5000, order.size());
+    for (auto i = 0; i < 5000; ++i)
+        EXPECT_EQ(i, order[i]);
+    EXPECT_TRUE(elsewhere);
+}
+
+int main(int argc, char *argv[])
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,235 @@
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <zlib.h>
+
+#include "discord.h"
+#include "etf.h"
+#include "gateway_event.h"
+#include "net/inflate_stream.h"
+#include "payload_scanner.h"
+
+// Compressed like the gateway does it, one deflate stream with a sync flush after each event
+static std::vector<std::string> deflate_stream(const std::vector<std::string> &messages)
+{
+    auto zs = z_stream{};
+    deflateInit(&zs, Z_DEFAULT_COMPRESSION);
+    auto compressed = std::vector<std::string>{};
+    for (auto &m : messages) {
+        auto out = std::string(deflateBound(&zs, m.size()) + 16, '\0');
+        zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(m.data()));
+        zs.avail_in = static_cast<uInt>(m.size());
+        zs.next_out = reinterpret_cast<Bytef *>(&out[0]);
+        zs.avail_out = static_cast<uInt>(out.size());
+        deflate(&zs, Z_SYNC_FLUSH);
+        out.resize(out.size() - zs.avail_out);
+        compressed.push_back(std::move(out));
+    }
+    deflateEnd(&zs);
+    return compressed;
+}
+
+static size_t total_size(const std::vector<std::string> &messages)
+{
+    auto bytes = size_t{0};
+    for (auto &m : messages)
+        bytes += m.size();
+    return bytes;
+}
+
+// The event as the gateway sends it with encoding=etf, snowflakes are integers there
+static void integer_snowflakes(nlohmann::json &json)
+{
+    if (json.is_array()) {
+        for (auto &element : json)
+            integer_snowflakes(element);
+    } else if (json.is_object()) {
+        for (auto it = json.begin(); it != json.end(); ++it) {
+            auto key = it.key();
+            auto is_id = key == "id" || (key.size() > 3 && key.substr(key.size() - 3) == "_id");
+            if (is_id && it->is_string())
+                *it = std::stoull(it->get<std::string>());
+            else
+                integer_snowflakes(*it);
+        }
+    }
+}
+
+using event_cb = std::function<void(const nlohmann::json &)>;
+
+// The handlers gateway registers, by event
+static const std::vector<discord::gateway_event> registered = {
+    discord::gateway_event::ready,
+    discord::gateway_event::resumed,
+    discord::gateway_event::guild_create,
+    discord::gateway_event::channel_create,
+    discord::gateway_event::channel_update,
+    discord::gateway_event::channel_delete,
+    discord::gateway_event::voice_state_update,
+    discord::gateway_event::guild_members_chunk,
+    discord::gateway_event::guild_member_add,
+    discord::gateway_event::guild_member_update,
+    discord::gateway_event::guild_member_remove,
+    discord::gateway_event::message_create,
+    discord::gateway_event::voice_state_update,
+    discord::gateway_event::voice_server_update,
+    discord::gateway_event::message_create,
+    discord::gateway_event::message_create};
+
+// Time to find and call the handlers of every event in the stream, rounds times over, by looking
+// its name up in a multimap along with "ALL" like the gateway used to, and by interning it and
+// indexing a table of handler lists. Returns the nanoseconds per event of each
+static std::array<double, 2> time_dispatch(const std::vector<std::string_view> &names, int rounds)
+{
+    using clock = std::chrono::steady_clock;
+    auto calls = size_t{0};
+    auto count_call = [&calls](const nlohmann::json &) { ++calls; };
+    auto data = nlohmann::json{};
+
+    auto by_name = std::multimap<std::string, event_cb, std::less<>>{};
+    auto by_event = std::array<std::vector<event_cb>, discord::gateway_event_count>{};
+    for (auto event : registered) {
+        by_name.emplace(discord::to_string(event), count_call);
+        by_event[static_cast<size_t>(event)].push_back(count_call);
+    }
+
+    auto start = clock::now();
+    for (auto r = 0; r < rounds; ++r) {
+        for (auto name : names) {
+            using namespace std::string_view_literals;
+            auto events = {name, "ALL"sv};
+            for (auto &event : events) {
+                auto range = by_name.equal_range(event);
+                for (auto it = range.first; it != range.second; ++it)
+                    it->second(data);
+            }
+        }
+    }
+    auto multimap_time = std::chrono::duration<double, std::nano>(clock::now() - start);
+    auto multimap_calls = std::exchange(calls, 0);
+
+    start = clock::now();
+    for (auto r = 0; r < rounds; ++r) {
+        for (auto name : names) {
+            auto event = discord::to_gateway_event(name);
+            if (event != discord::gateway_event::unknown)
+                for (auto &handler : by_event[static_cast<size_t>(event)])
+                    handler(data);
+        }
+    }
+    auto table_time = std::chrono::duration<double, std::nano>(clock::now() - start);
+
+    if (calls != multimap_calls)
+        return {0, 0};
+    auto dispatched = static_cast<double>(names.size()) * rounds;
+    return {multimap_time.count() / dispatched, table_time.count() / dispatched};
+}
+
+// Time to decode a recorded stream of gateway events, one message per line, parsing every message
+// whole like the gateway used to, and scanning each one and parsing only the events the bot
+// handles, then dispatching them. Then the size of the stream on the zlib-stream transport and the
+// CPU time inflating it, and the same session in ETF: its size and the time to decode every event
+int main(int argc, char *argv[])
+{
+    using clock = std::chrono::steady_clock;
+
+    auto path = argc > 1 ? argv[1] : "./res/event_stream";
+    auto rounds = argc > 2 ? std::atoi(argv[2]) : 20;
+    auto file = std::ifstream{path};
+    auto messages = std::vector<std::string>{};
+    for (auto line = std::string{}; std::getline(file, line);)
+        if (!line.empty())
+            messages.push_back(std::move(line));
+    if (messages.empty()) {
+        std::cerr << "No events in " << path << "\n";
+        return EXIT_FAILURE;
+    }
+
+    auto bytes = total_size(messages);
+    std::cout << messages.size() << " events, " << bytes << " bytes\n";
+
+    auto parsed = size_t{0};
+    auto start = clock::now();
+    for (auto r = 0; r < rounds; ++r) {
+        for (auto &m : messages) {
+            auto payload = nlohmann::json::parse(m).get<discord::payload>();
+            parsed += payload.data.size();
+        }
+    }
+    auto whole = std::chrono::duration<double, std::micro>(clock::now() - start) / rounds;
+
+    auto scanned = size_t{0};
+    auto names = std::vector<std::string_view>{};
+    start = clock::now();
+    for (auto r = 0; r < rounds; ++r) {
+        for (auto &m : messages) {
+            auto payload = discord::payload_view{};
+            if (!discord::scan_payload(m, payload)) {
+                std::cerr << "Could not scan: " << m.substr(0, 100) << "\n";
+                return EXIT_FAILURE;
+            }
+            auto dispatch = payload.op == discord::gateway_op::dispatch;
+            if (!dispatch || payload.event != discord::gateway_event::unknown)
+                scanned += nlohmann::json::parse(payload.data.begin(), payload.data.end()).size();
+            if (dispatch && r == 0)
+                names.push_back(payload.event_name);
+        }
+    }
+    auto selective = std::chrono::duration<double, std::micro>(clock::now() - start) / rounds;
+    auto [multimap_ns, table_ns] = time_dispatch(names, rounds * 100);
+
+    std::cout << "parse every event: " << whole.count() << " us per stream\n"
+              << "scan, parse handled: " << selective.count() << " us per stream\n"
+              << "dispatch by name: " << multimap_ns << " ns per event, by event table: "
+              << table_ns << " ns per event\n";
+
+    auto compressed = deflate_stream(messages);
+    auto inflated = size_t{0};
+    auto inflate_time = std::chrono::nanoseconds{0};
+    auto compressed_bytes = size_t{0};
+    for (auto r = 0; r < rounds; ++r) {
+        auto inflater = discord::inflate_stream{};
+        for (auto &c : compressed)
+            if (inflater.feed(c))
+                inflated += inflater.payload().size();
+        inflate_time += inflater.inflate_time();
+        compressed_bytes = inflater.compressed_bytes();
+    }
+    std::cout << "zlib-stream: " << compressed_bytes << " bytes, ratio "
+              << static_cast<double>(bytes) / compressed_bytes << ", inflate "
+              << std::chrono::duration<double, std::micro>(inflate_time).count() / rounds
+              << " us CPU per stream\n";
+
+    auto etf_messages = std::vector<std::string>{};
+    for (auto &m : messages) {
+        auto json = nlohmann::json::parse(m);
+        integer_snowflakes(json);
+        etf_messages.push_back(discord::etf_encode(json));
+    }
+    auto etf_bytes = total_size(etf_messages);
+    auto etf_compressed = total_size(deflate_stream(etf_messages));
+
+    auto decoded = size_t{0};
+    start = clock::now();
+    for (auto r = 0; r < rounds; ++r) {
+        for (auto &m : etf_messages) {
+            auto payload = discord::etf_decode(m).get<discord::payload>();
+            decoded += payload.data.size();
+        }
+    }
+    auto etf_time = std::chrono::duration<double, std::micro>(clock::now() - start) / rounds;
+
+    std::cout << "etf: " << etf_bytes << " bytes, " << etf_compressed
+              << " on zlib-stream, decode every event: " << etf_time.count() << " us per stream\n";
+    auto ok = parsed > 0 && scanned > 0 && table_ns > 0 && inflated == bytes * rounds &&
+              decoded == parsed;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,9 +1,16 @@
 #include <gtest/gtest.h>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <random>
 
 #include "discord.h"
+#include "etf.h"
+#include "gateway_event.h"
 #include "gateway_store.h"
+#include "member_cache.h"
+#include "payload_scanner.h"
+#include "snowflake_map.h"
 
 std::string read_file(std::string file_path)
 {
@@ -74,6 +81,405 @@ TEST(GatewayStore, LoadStore)
     }
 }
 
+TEST(GatewayStore, StreamedGuildCreate)
+{
+    for (auto file : {"./res/guild_create1", "./res/guild_create2"}) {
+        auto text = read_file(file);
+        ASSERT_FALSE(text.empty());
+        auto json = nlohmann::json::parse(text)["d"];
+        auto data = json.dump();
+
+        discord::gateway_store parsed, streamed;
+        parsed.guild_create(json);
+        streamed.guild_create(std::string_view{data});
+
+        auto id = discord::snowflake{std::stoull(json["id"].get<std::string>())};
+        const auto *expected = parsed.get_guild(id);
+        const auto *guild = streamed.get_guild(id);
+        ASSERT_NE(nullptr, expected);
+        ASSERT_NE(nullptr, guild);
+        EXPECT_EQ(expected->name, guild->name);
+        EXPECT_EQ(expected->owner, guild->owner);
+        EXPECT_EQ(expected->region, guild->region);
+
+        ASSERT_EQ(expected->members.size(), guild->members.size());
+        for (auto a = expected->members.begin(), b = guild->members.begin();
+             a != expected->members.end(); ++a, ++b) {
+            EXPECT_EQ(a->user.id, b->user.id);
+            EXPECT_EQ(a->user.name, b->user.name);
+            EXPECT_EQ(a->user.discriminator, b->user.discriminator);
+            EXPECT_EQ(a->nick, b->nick);
+        }
+
+        ASSERT_EQ(expected->channels.size(), guild->channels.size());
+        for (auto a = expected->channels.begin(), b = guild->channels.begin();
+             a != expected->channels.end(); ++a, ++b) {
+            EXPECT_EQ(a->id, b->id);
+            EXPECT_EQ(a->name, b->name);
+            EXPECT_EQ(a->type, b->type);
+            EXPECT_EQ(a->bitrate, b->bitrate);
+            EXPECT_EQ(id, streamed.lookup_channel(b->id));
+        }
+        EXPECT_EQ(expected->voice_states.size(), guild->voice_states.size());
+    }
+}
+
+TEST(GatewayStore, StreamedGuildCreateUnescapesNames)
+{
+    auto data = std::string{
+        R"({"voice_states":null,"members":[{"user":{"id":"2","username":"caf\u00e9 \"q\"",)"
+        R"("discriminator":"0001"},"nick":null}],"channels":[],"id":"1","name":"\ud83c\udfb5",)"
+        R"("owner_id":"2","region":"eu","unavailable":false})"};
+    discord::gateway_store store;
+    store.guild_create(std::string_view{data});
+
+    const auto *guild = store.get_guild(1);
+    ASSERT_NE(nullptr, guild);
+    EXPECT_EQ("\xF0\x9F\x8E\xB5", guild->name);
+    ASSERT_EQ(1u, guild->members.size());
+    EXPECT_EQ("caf\xC3\xA9 \"q\"", guild->members.begin()->user.name);
+    EXPECT_TRUE(guild->members.begin()->nick.empty());
+}
+
+TEST(GatewayStore, ChannelUpdates)
+{
+    auto g1 = read_file("./res/guild_create1");
+    ASSERT_FALSE(g1.empty());
+    discord::gateway_store store;
+    store.guild_create(nlohmann::json::parse(g1)["d"]);
+    const auto guild_id = discord::snowflake{179378178601517056};
+
+    auto voice_channel = [](std::string id, std::string name) {
+        return nlohmann::json{{"id", id},     {"guild_id", "179378178601517056"}, {"type", 2},
+                              {"name", name}, {"bitrate", 64000}, {"user_limit", 0}};
+    };
+    store.channel_create(voice_channel("2", "Music"));
+    store.channel_create(voice_channel("1", "Music"));
+    EXPECT_EQ(guild_id, store.lookup_channel(1));
+    EXPECT_EQ(64000, store.get_guild(guild_id)->channels.find(2)->bitrate);
+
+    auto [first, last] = store.voice_channels_named(guild_id, "Music");
+    ASSERT_EQ(2, last - first);
+    EXPECT_EQ(1u, first->second);
+    EXPECT_EQ(2u, (first + 1)->second);
+
+    store.channel_update(voice_channel("1", "Radio"));
+    std::tie(first, last) = store.voice_channels_named(guild_id, "Music");
+    ASSERT_EQ(1, last - first);
+    EXPECT_EQ(2u, first->second);
+
+    store.channel_delete(voice_channel("2", "Music"));
+    std::tie(first, last) = store.voice_channels_named(guild_id, "Music");
+    EXPECT_EQ(first, last);
+    EXPECT_EQ(0u, store.lookup_channel(2));
+    EXPECT_EQ(nullptr, store.get_guild(guild_id)->channels.find(2));
+
+    // A guild sent again replaces the old one and its channels
+    store.guild_create(nlohmann::json::parse(g1)["d"]);
+    EXPECT_EQ(0u, store.lookup_channel(1));
+    EXPECT_EQ(nullptr, store.get_guild(guild_id)->channels.find(1));
+}
+
+static discord::member make_member(discord::snowflake id, std::string nick = "")
+{
+    auto m = discord::member{};
+    m.user.id = id;
+    m.user.name = "user" + std::to_string(id);
+    m.nick = std::move(nick);
+    return m;
+}
+
+TEST(MemberCache, EvictsLeastRecent)
+{
+    discord::member_cache cache{3};
+    cache.insert(10, make_member(1));
+    cache.insert(10, make_member(2));
+    cache.insert(20, make_member(1));
+    EXPECT_EQ(3u, cache.size());
+
+    // Touching 10/1 leaves 10/2 the least recent
+    ASSERT_NE(nullptr, cache.find(10, 1));
+    cache.insert(20, make_member(3));
+    EXPECT_EQ(3u, cache.size());
+    EXPECT_EQ(nullptr, cache.find(10, 2));
+    EXPECT_NE(nullptr, cache.find(10, 1));
+    EXPECT_NE(nullptr, cache.find(20, 1));
+    EXPECT_NE(nullptr, cache.find(20, 3));
+
+    cache.insert(20, make_member(3, "renamed"));
+    EXPECT_EQ("renamed", cache.find(20, 3)->nick);
+    EXPECT_EQ(3u, cache.size());
+
+    cache.erase(20, 1);
+    EXPECT_EQ(nullptr, cache.find(20, 1));
+    EXPECT_EQ(2u, cache.size());
+    cache.insert(30, make_member(4));
+    cache.insert(30, make_member(5));
+    EXPECT_EQ(3u, cache.size());
+    EXPECT_EQ(nullptr, cache.find(10, 1));
+    EXPECT_NE(nullptr, cache.find(30, 4));
+}
+
+TEST(GatewayStore, LazyMembers)
+{
+    auto g1 = read_file("./res/guild_create1");
+    ASSERT_FALSE(g1.empty());
+    auto data = nlohmann::json::parse(g1)["d"];
+    data["voice_states"] = {{{"user_id", "2000"}, {"channel_id", "312472384026181634"},
+                             {"session_id", "s"}}};
+    const auto guild_id = discord::snowflake{179378178601517056};
+
+    discord::gateway_store store{2};
+    EXPECT_TRUE(store.lazy_members());
+    EXPECT_EQ(guild_id, store.guild_create(std::string_view{data.dump()}));
+    EXPECT_TRUE(store.get_guild(guild_id)->members.empty());
+    EXPECT_EQ(std::vector<discord::snowflake>{2000}, store.uncached_voice_members(guild_id));
+
+    store.guild_members_chunk(
+        {{"guild_id", "179378178601517056"},
+         {"members", {{{"user", {{"id", "2000"}, {"username", "a"}}}, {"nick", "voice"}}}}});
+    EXPECT_TRUE(store.uncached_voice_members(guild_id).empty());
+    ASSERT_NE(nullptr, store.get_member(guild_id, 2000));
+    EXPECT_EQ("voice", store.get_member(guild_id, 2000)->nick);
+
+    store.message_create({{"id", "1"},
+                          {"channel_id", "312472384026181633"},
+                          {"guild_id", "179378178601517056"},
+                          {"author", {{"id", "3000"}, {"username", "b"}}},
+                          {"member", {{"nick", "talker"}}},
+                          {"content", ":join"},
+                          {"type", 0}});
+    ASSERT_NE(nullptr, store.get_member(guild_id, 3000));
+    EXPECT_EQ("talker", store.get_member(guild_id, 3000)->nick);
+
+    store.guild_member_update({{"guild_id", "179378178601517056"},
+                               {"user", {{"id", "3000"}, {"username", "b"}}},
+                               {"nick", "renamed"}});
+    EXPECT_EQ("renamed", store.get_member(guild_id, 3000)->nick);
+
+    // Members not cached stay out, a third one pushes out the least recent
+    store.guild_member_add({{"guild_id", "179378178601517056"},
+                            {"user", {{"id", "4000"}, {"username", "c"}}}});
+    EXPECT_EQ(nullptr, store.get_member(guild_id, 4000));
+    store.guild_members_chunk({{"guild_id", "179378178601517056"},
+                               {"members", {{{"user", {{"id", "5000"}, {"username", "d"}}}}}}});
+    EXPECT_EQ(nullptr, store.get_member(guild_id, 2000));
+    EXPECT_NE(nullptr, store.get_member(guild_id, 5000));
+
+    store.guild_member_remove(
+        {{"guild_id", "179378178601517056"}, {"user", {{"id", "5000"}, {"username", "d"}}}});
+    EXPECT_EQ(nullptr, store.get_member(guild_id, 5000));
+}
+
+TEST(GatewayStore, EagerMemberEvents)
+{
+    auto g1 = read_file("./res/guild_create1");
+    ASSERT_FALSE(g1.empty());
+    discord::gateway_store store;
+    store.guild_create(nlohmann::json::parse(g1)["d"]);
+    const auto guild_id = discord::snowflake{179378178601517056};
+    auto members = store.get_guild(guild_id)->members.size();
+
+    store.guild_member_add({{"guild_id", "179378178601517056"},
+                            {"user", {{"id", "4000"}, {"username", "c"}}}});
+    EXPECT_EQ(members + 1, store.get_guild(guild_id)->members.size());
+    ASSERT_NE(nullptr, store.get_member(guild_id, 4000));
+
+    store.guild_member_remove(
+        {{"guild_id", "179378178601517056"}, {"user", {{"id", "4000"}, {"username", "c"}}}});
+    EXPECT_EQ(members, store.get_guild(guild_id)->members.size());
+    EXPECT_EQ(nullptr, store.get_member(guild_id, 4000));
+}
+
+TEST(SnowflakeMap, MatchesStdMap)
+{
+    discord::snowflake_map<int> map;
+    std::map<discord::snowflake, int> expected;
+    auto rng = std::mt19937_64{1};
+
+    // Few distinct keys so that inserts and erases hit the same probe runs
+    for (auto i = 0; i < 200000; ++i) {
+        auto key = (rng() % 512 + 1) << 22 | (rng() % 4);
+        if (rng() % 3 == 0) {
+            EXPECT_EQ(expected.erase(key) == 1, map.erase(key));
+        } else {
+            map[key] = i;
+            expected[key] = i;
+        }
+    }
+
+    EXPECT_EQ(expected.size(), map.size());
+    for (auto &[key, value] : expected) {
+        ASSERT_NE(nullptr, map.find(key));
+        EXPECT_EQ(value, *map.find(key));
+    }
+    auto visited = size_t{0};
+    map.for_each([&](auto key, auto value) {
+        ++visited;
+        EXPECT_EQ(expected.at(key), value);
+    });
+    EXPECT_EQ(expected.size(), visited);
+}
+
+TEST(PayloadScanner, FindsEnvelopeFields)
+{
+    auto message = std::string{
+        R"({"t":"MESSAGE_CREATE","s":42,"op":0,"d":{"content":"} \"{[","id":"1","e":[{}]}})"};
+    auto payload = discord::payload_view{};
+    ASSERT_TRUE(discord::scan_payload(message, payload));
+    EXPECT_EQ(discord::gateway_op::dispatch, payload.op);
+    EXPECT_EQ(42, payload.sequence_num);
+    EXPECT_EQ("MESSAGE_CREATE", payload.event_name);
+    EXPECT_EQ(discord::gateway_event::message_create, payload.event);
+
+    auto data = nlohmann::json::parse(payload.data.begin(), payload.data.end());
+    EXPECT_EQ("} \"{[", data["content"]);
+    EXPECT_EQ("1", data["id"]);
+}
+
+TEST(PayloadScanner, NonDispatch)
+{
+    auto payload = discord::payload_view{};
+    ASSERT_TRUE(discord::scan_payload(R"({"t":null,"s":null,"op":11,"d":null})", payload));
+    EXPECT_EQ(discord::gateway_op::heartbeat_ack, payload.op);
+    EXPECT_EQ(-1, payload.sequence_num);
+    EXPECT_TRUE(payload.event_name.empty());
+    EXPECT_EQ(discord::gateway_event::unknown, payload.event);
+    EXPECT_EQ("null", payload.data);
+
+    ASSERT_TRUE(discord::scan_payload(
+        " { \"op\" : 10 ,\n \"d\" : { \"heartbeat_interval\" : 41250 } } ", payload));
+    EXPECT_EQ(discord::gateway_op::hello, payload.op);
+    EXPECT_EQ(41250, nlohmann::json::parse(payload.data.begin(), payload.data.end())
+                         .at("heartbeat_interval")
+                         .get<int>());
+}
+
+TEST(PayloadScanner, Malformed)
+{
+    auto payload = discord::payload_view{};
+    EXPECT_FALSE(discord::scan_payload("", payload));
+    EXPECT_FALSE(discord::scan_payload("[]", payload));
+    EXPECT_FALSE(discord::scan_payload(R"({"op":0})", payload));
+    EXPECT_FALSE(discord::scan_payload(R"({"op":"x","d":1})", payload));
+    EXPECT_FALSE(discord::scan_payload(R"({"op":0,"d":{"a":"})", payload));
+    EXPECT_FALSE(discord::scan_payload(R"({"op":0,"d":{"a":[1,2})", payload));
+}
+
+TEST(PayloadScanner, RecordedGuildCreate)
+{
+    auto message = read_file("./res/guild_create1");
+    ASSERT_FALSE(message.empty());
+    auto payload = discord::payload_view{};
+    ASSERT_TRUE(discord::scan_payload(message, payload));
+    EXPECT_EQ("GUILD_CREATE", payload.event_name);
+    EXPECT_EQ(nlohmann::json::parse(message)["d"],
+              nlohmann::json::parse(payload.data.begin(), payload.data.end()));
+}
+
+TEST(GatewayEvent, InternsNames)
+{
+    static_assert(discord::to_gateway_event("READY") == discord::gateway_event::ready);
+    for (auto i = size_t{0}; i < discord::gateway_event_count; ++i) {
+        auto event = static_cast<discord::gateway_event>(i);
+        EXPECT_EQ(event, discord::to_gateway_event(discord::to_string(event)));
+    }
+    // Unhandled, or close to a handled name
+    for (auto name : {"TYPING_START", "PRESENCE_UPDATE", "READ", "READY_", "ready", "RESUME", ""})
+        EXPECT_EQ(discord::gateway_event::unknown, discord::to_gateway_event(name)) << name;
+
+    auto payload = discord::payload_view{};
+    ASSERT_TRUE(discord::scan_payload(R"({"t":"TYPING_START","s":3,"op":0,"d":{}})", payload));
+    EXPECT_EQ(discord::gateway_event::unknown, payload.event);
+    auto decoded = nlohmann::json::parse(R"({"t":"GUILD_MEMBER_ADD","s":4,"op":0,"d":{}})")
+                       .get<discord::payload>();
+    EXPECT_EQ(discord::gateway_event::guild_member_add, decoded.event);
+}
+
+// Snowflakes the way ETF has them, integers where JSON has decimal strings
+static void integer_snowflakes(nlohmann::json &json)
+{
+    if (json.is_array()) {
+        for (auto &element : json)
+            integer_snowflakes(element);
+    } else if (json.is_object()) {
+        for (auto it = json.begin(); it != json.end(); ++it) {
+            auto key = it.key();
+            auto is_id = key == "id" || (key.size() > 3 && key.substr(key.size() - 3) == "_id");
+            if (is_id && it->is_string())
+                *it = std::stoull(it->get<std::string>());
+            else
+                integer_snowflakes(*it);
+        }
+    }
+}
+
+TEST(Etf, DecodesTerms)
+{
+    // #{<<"op">> => 0, <<"t">> => <<"READY">>,
+    //   <<"d">> => #{id => 312472384026181632, nick => nil, a => [-1, 2.5]}}
+    auto data = std::string{
+        "\x83\x74\x00\x00\x00\x03"
+        "\x6d\x00\x00\x00\x02" "op" "\x61\x00"
+        "\x6d\x00\x00\x00\x01" "t" "\x6d\x00\x00\x00\x05" "READY"
+        "\x6d\x00\x00\x00\x01" "d" "\x74\x00\x00\x00\x03"
+        "\x64\x00\x02" "id" "\x6e\x08\x00\x00\x00\x00\x4c\xfa\x1f\x56\x04"
+        "\x73\x04" "nick" "\x77\x03" "nil"
+        "\x77\x01" "a" "\x6c\x00\x00\x00\x02\x62\xff\xff\xff\xff"
+        "\x46\x40\x04\x00\x00\x00\x00\x00\x00\x6a",
+        92};
+    auto json = discord::etf_decode(data);
+    EXPECT_EQ(0, json["op"]);
+    EXPECT_EQ("READY", json["t"]);
+    EXPECT_EQ(312472384026181632u, json["d"]["id"].get<uint64_t>());
+    EXPECT_TRUE(json["d"]["nick"].is_null());
+    EXPECT_EQ(nlohmann::json::parse("[-1, 2.5]"), json["d"]["a"]);
+    EXPECT_EQ(312472384026181632u, discord::make_snowflake(json["d"]["id"]));
+}
+
+TEST(Etf, RoundTripsRecordedEvents)
+{
+    auto file = std::ifstream{"./res/event_stream"};
+    auto events = 0;
+    for (auto line = std::string{}; std::getline(file, line); ++events) {
+        auto json = nlohmann::json::parse(line);
+        integer_snowflakes(json);
+        EXPECT_EQ(json, discord::etf_decode(discord::etf_encode(json)));
+    }
+    EXPECT_GT(events, 0);
+}
+
+TEST(Etf, GuildWithIntegerSnowflakes)
+{
+    auto json = nlohmann::json::parse(read_file("./res/guild_create1"))["d"];
+    auto etf_json = json;
+    integer_snowflakes(etf_json);
+    etf_json = discord::etf_decode(discord::etf_encode(etf_json));
+
+    auto expected = json.get<discord::guild>();
+    auto guild = etf_json.get<discord::guild>();
+    EXPECT_EQ(expected.id, guild.id);
+    EXPECT_EQ(expected.owner, guild.owner);
+    EXPECT_EQ(expected.name, guild.name);
+    ASSERT_EQ(expected.members.size(), guild.members.size());
+    for (auto a = expected.members.begin(), b = guild.members.begin(); a != expected.members.end();
+         ++a, ++b)
+        EXPECT_EQ(a->user.id, b->user.id);
+
+    discord::gateway_store store;
+    EXPECT_EQ(expected.id, store.guild_create(etf_json));
+    EXPECT_EQ(expected.id, store.lookup_channel(expected.channels.begin()->id));
+}
+
+TEST(Etf, Malformed)
+{
+    EXPECT_THROW(discord::etf_decode(""), discord::etf_error);
+    EXPECT_THROW(discord::etf_decode(std::string{"\x82\x61\x01", 3}), discord::etf_error);
+    EXPECT_THROW(discord::etf_decode(std::string{"\x83\x6d\x00\x00\x00\x09" "abc", 9}),
+                 discord::etf_error);
+    EXPECT_THROW(discord::etf_decode(std::string{"\x83\x61\x01\x61", 4}), discord::etf_error);
+}
+
 int main(int argc, char *argv[])
 {
     ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,69 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "net/uri.h"
+#include "voice/command.h"
+
+// Nanoseconds per input of calling f on every one of them, rounds times over
+template<typename F>
+static double time_per_input(const std::vector<std::string> &inputs, int rounds, F &&f)
+{
+    using clock = std::chrono::steady_clock;
+    auto accepted = size_t{0};
+    auto start = clock::now();
+    for (auto r = 0; r < rounds; ++r)
+        for (auto &s : inputs)
+            accepted += f(s);
+    auto elapsed = std::chrono::duration<double, std::nano>(clock::now() - start);
+    // Keeps the calls from being optimized out
+    if (accepted == 0)
+        std::cerr << "Nothing accepted\n";
+    return elapsed.count() / (static_cast<double>(inputs.size()) * rounds);
+}
+
+// Time to split chat commands and parse URIs with the regexes voice_connector and uri used, and
+// with the parsers that replaced them
+int main(int argc, char *argv[])
+{
+    auto rounds = argc > 1 ? std::atoi(argv[1]) : 20000;
+
+    auto commands = std::vector<std::string>{
+        ":join",        ":join General",     ":add https://www.youtube.com/watch?v=dQw4w9WgXcQ",
+        ":skip",        ":seek 1:30",        ":list",
+        ":pause",       ":play",             ":leave",
+        ":) nice one",  ":thinking: hmm ok", ":add file:///home/music/a long song name.opus"};
+    auto uris = std::vector<std::string>{"https://www.youtube.com/watch?v=dQw4w9WgXcQ",
+                                         "https://youtu.be/dQw4w9WgXcQ",
+                                         "wss://gateway.discord.gg/?v=6&encoding=json",
+                                         "eu-west123.discord.media:80",
+                                         "file:///home/music/song.opus",
+                                         "not a url"};
+
+    static const auto command_re = std::regex{R"(^:(\S+)(?:\s+(.+))?$)"};
+    auto command_regex = time_per_input(commands, rounds, [](const std::string &s) {
+        auto matcher = std::smatch{};
+        return std::regex_search(s, matcher, command_re) && matcher.length(1) > 0;
+    });
+    auto command_parser = time_per_input(commands, rounds, [](const std::string &s) {
+        auto c = discord::command_view{};
+        return discord::parse_command(s, c) && !c.name.empty();
+    });
+
+    static const auto uri_re = std::regex{
+        R"(^(?:(\S+)://)?([A-Za-z0-9.-]{2,})(?::(\d+))?(/[/A-Za-z0-9-._~:/?#\[\]%@!$&'()*+,;=`]*)?$)"};
+    auto uri_regex = time_per_input(uris, rounds, [](const std::string &s) {
+        auto matcher = std::smatch{};
+        return std::regex_match(s, matcher, uri_re) && matcher.length(2) > 0;
+    });
+    auto uri_parser = time_per_input(
+        uris, rounds, [](const std::string &s) { return !uri::parse_view(s).authority.empty(); });
+
+    std::cout << "command: regex " << command_regex << " ns, parser " << command_parser
+              << " ns per message\n"
+              << "uri: regex " << uri_regex << " ns, parser " << uri_parser << " ns per uri\n";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "net/uri.h"
+#include "voice/command.h"
+
+// The regexes the parsers replaced, which they have to agree with
+static uri::parsed_uri regex_parse_uri(const std::string &uri)
+{
+    static const auto re = std::regex{
+        R"(^(?:(\S+)://)?([A-Za-z0-9.-]{2,})(?::(\d+))?(/[/A-Za-z0-9-._~:/?#\[\]%@!$&'()*+,;=`]*)?$)"};
+    auto matcher = std::smatch{};
+    if (!std::regex_match(uri, matcher, re))
+        return {"", "", "", -1};
+
+    auto scheme = matcher.str(1);
+    auto port = -1;
+    if (matcher[3].matched) {
+        // Used to throw, the parser rejects the URI instead
+        try {
+            port = std::stoi(matcher.str(3));
+        } catch (const std::out_of_range &) {
+            return {"", "", "", -1};
+        }
+    } else if (scheme == "http" || scheme == "ws") {
+        port = 80;
+    } else if (scheme == "https" || scheme == "wss") {
+        port = 443;
+    }
+    auto path = matcher[4].matched ? matcher.str(4) : "/";
+    return {scheme, matcher.str(2), path, port};
+}
+
+static bool regex_parse_command(const std::string &message, std::string &name, std::string &params)
+{
+    static const auto re = std::regex{R"(^:(\S+)(?:\s+(.+))?$)"};
+    auto matcher = std::smatch{};
+    if (!std::regex_search(message, matcher, re))
+        return false;
+    name = matcher.str(1);
+    params = matcher.str(2);
+    return true;
+}
+
+static void expect_same_uri(const std::string &s)
+{
+    auto expected = regex_parse_uri(s);
+    auto parsed = uri::parse(s);
+    EXPECT_EQ(expected.scheme, parsed.scheme) << s;
+    EXPECT_EQ(expected.authority, parsed.authority) << s;
+    EXPECT_EQ(expected.path, parsed.path) << s;
+    EXPECT_EQ(expected.port, parsed.port) << s;
+}
+
+static void expect_same_command(const std::string &s)
+{
+    auto name = std::string{};
+    auto params = std::string{};
+    auto expected = regex_parse_command(s, name, params);
+    auto parsed = discord::command_view{};
+    ASSERT_EQ(expected, discord::parse_command(s, parsed)) << s;
+    if (expected) {
+        EXPECT_EQ(name, parsed.name) << s;
+        EXPECT_EQ(params, parsed.params) << s;
+    }
+}
+
+// Random strings put together from pieces that decide between accepting and rejecting
+static std::vector<std::string> random_inputs(const std::vector<std::string> &pieces, size_t count)
+{
+    auto rng = std::mt19937{42};
+    auto length = std::uniform_int_distribution<size_t>{0, 10};
+    auto pick = std::uniform_int_distribution<size_t>{0, pieces.size() - 1};
+    auto inputs = std::vector<std::string>{};
+    for (auto i = size_t{0}; i < count; ++i) {
+        auto s = std::string{};
+        for (auto n = length(rng); n > 0; --n)
+            s += pieces[pick(rng)];
+        inputs.push_back(std::move(s));
+    }
+    return inputs;
+}
+
+TEST(Uri, ParsesLikeTheRegex)
+{
+    for (auto s : {"wss://gateway.discord.gg/?v=6&encoding=json",
+                   "wss://gateway.discord.gg",
+                   "ws://127.0.0.1:38211/?v=6&encoding=json&compress=zlib-stream",
+                   "eu-west123.discord.media:80",
+                   "https://www.youtube.com/watch?v=dQw4w9WgXcQ",
+                   "https://youtu.be/dQw4w9WgXcQ?t=42",
+                   "file:///home/music/song.opus",
+                   "file://localhost/home/music/song.opus",
+                   "a://b://host.name/path",
+                   "a b://host",
+                   "://host",
+                   "host:",
+                   "host:0080/",
+                   "host:99999999999/",
+                   "x",
+                   "",
+                   "http://host/pa th",
+                   "http://host/\\",
+                   "http://host/%20`~"})
+        expect_same_uri(s);
+}
+
+TEST(Uri, ParsesRandomInputLikeTheRegex)
+{
+    auto pieces = std::vector<std::string>{"ws", "https", "://", "ab", "a", ".", "-", ":", "80",
+                                           "/", "?", "%", "`", " ", "\t", "^", "\\"};
+    for (auto &s : random_inputs(pieces, 20000))
+        expect_same_uri(s);
+}
+
+TEST(Uri, ViewPointsIntoTheInput)
+{
+    auto s = std::string{"wss://gateway.discord.gg:443/?v=6"};
+    auto parsed = uri::parse_view(s);
+    EXPECT_EQ(s.data(), parsed.scheme.data());
+    EXPECT_EQ("gateway.discord.gg", parsed.authority);
+    EXPECT_EQ("/?v=6", parsed.path);
+    EXPECT_EQ(443, parsed.port);
+}
+
+TEST(Command, ParsesLikeTheRegex)
+{
+    for (auto s : {":join", ":join General", ":JOIN  General voice ", ":add https://youtu.be/x",
+                   ":seek 1:30", ":join ", ":join  ", ":join \t", ":join \n", ":join  \n",
+                   ":join x\ny", ":join x\r", ":", "::", ": x", "join", "", ":j\x80 \xff"})
+        expect_same_command(s);
+}
+
+TEST(Command, ParsesRandomInputLikeTheRegex)
+{
+    auto pieces = std::vector<std::string>{":", "a", "b", " ", "\t", "\n", "\r", "\v", "\f"};
+    for (auto &s : random_inputs(pieces, 20000))
+        expect_same_command(":" + s);
+}
+
+int main(int argc, char *argv[])
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,23 @@
+# Stands in for youtube_dl_resolver.py in the resolver tests. Answers every page with a made-up
+# media URL and, as the format, how many requests this process has had. A page with "error" in it
+# gets an error, "dash" a manifest in place of the media, "crash" makes the process exit and "hang"
+# leaves the request unanswered
+import json
+import sys
+
+requests = 0
+for line in sys.stdin:
+    requests += 1
+    url = json.loads(line)['url']
+    if 'crash' in url:
+        sys.exit(1)
+    if 'hang' in url:
+        continue
+    if 'error' in url:
+        reply = {'error': 'ERROR: Unsupported URL: ' + url}
+    else:
+        reply = {'url': 'https://media.invalid/' + url, 'format': str(requests),
+                 'protocol': 'http_dash_segments' if 'dash' in url else 'https',
+                 'headers': {'User-Agent': 'stub'}}
+    sys.stdout.write(json.dumps(reply) + '\n')
+    sys.stdout.flush()
@@ -0,0 +1,148 @@
+#include <gtest/gtest.h>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <chrono>
+#include <signal.h>
+#include <string>
+#include <vector>
+
+#include "audio/stream_resolver.h"
+
+// Every test runs the stub in place of youtube-dl, from the test directory like the other tests
+static const auto stub = std::string{"python3 ./res/resolver_stub.py"};
+
+class StreamResolver : public ::testing::Test
+{
+protected:
+    struct answer {
+        boost::system::error_code ec;
+        stream_resolver::stream s;
+    };
+
+    boost::asio::io_context ctx;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work =
+        boost::asio::make_work_guard(ctx);
+
+    // Resolves every page at once and waits for all of the answers, in the order they came
+    std::vector<answer> resolve(stream_resolver &resolver, const std::vector<std::string> &pages)
+    {
+        auto answers = std::vector<answer>{};
+        for (auto &page : pages)
+            resolver.resolve(page, ctx, [&answers](const auto &ec, const auto &s) {
+                answers.push_back({ec, s});
+            });
+        while (answers.size() < pages.size() && ctx.run_one_for(std::chrono::seconds(10)))
+            ;
+        return answers;
+    }
+
+    answer resolve(stream_resolver &resolver, const std::string &page)
+    {
+        auto answers = resolve(resolver, std::vector<std::string>{page});
+        return answers.empty() ? answer{boost::asio::error::timed_out, {}} : answers[0];
+    }
+};
+
+TEST_F(StreamResolver, ResolvesThroughAProcess)
+{
+    auto resolver = stream_resolver{stub, 1, std::chrono::seconds(60)};
+    auto a = resolve(resolver, "https://youtu.be/a");
+
+    EXPECT_FALSE(a.ec) << a.ec.message();
+    EXPECT_EQ(a.s.url, "https://media.invalid/https://youtu.be/a");
+    EXPECT_EQ(a.s.format, "1");
+    EXPECT_EQ(a.s.headers.at("User-Agent"), "stub");
+    EXPECT_EQ(resolver.resolutions(), 1u);
+}
+
+TEST_F(StreamResolver, AnswersAgainFromTheCache)
+{
+    auto resolver = stream_resolver{stub, 1, std::chrono::seconds(60)};
+    auto first = resolve(resolver, "https://youtu.be/a");
+    auto again = resolve(resolver, "https://youtu.be/a");
+
+    EXPECT_FALSE(again.ec);
+    EXPECT_EQ(again.s.url, first.s.url);
+    EXPECT_EQ(resolver.resolutions(), 1u);
+    EXPECT_EQ(resolver.cache_hits(), 1u);
+
+    // A result that stopped working is resolved anew
+    resolver.forget("https://youtu.be/a");
+    EXPECT_EQ(resolve(resolver, "https://youtu.be/a").s.format, "2");
+    EXPECT_EQ(resolver.resolutions(), 2u);
+}
+
+TEST_F(StreamResolver, ResolvesExpiredResultsAgain)
+{
+    auto resolver = stream_resolver{stub, 1, std::chrono::seconds(0)};
+    resolve(resolver, "https://youtu.be/a");
+    auto again = resolve(resolver, "https://youtu.be/a");
+
+    EXPECT_EQ(again.s.format, "2");
+    EXPECT_EQ(resolver.cache_hits(), 0u);
+}
+
+TEST_F(StreamResolver, ResolvesAPageAskedForAtOnceOnlyOnce)
+{
+    auto resolver = stream_resolver{stub, 2, std::chrono::seconds(60)};
+    auto answers = resolve(resolver, {"https://youtu.be/a", "https://youtu.be/b",
+                                      "https://youtu.be/a", "https://youtu.be/a"});
+
+    ASSERT_EQ(answers.size(), 4u);
+    for (auto &a : answers)
+        EXPECT_FALSE(a.ec) << a.ec.message();
+    EXPECT_EQ(resolver.resolutions(), 2u);
+}
+
+TEST_F(StreamResolver, PassesErrorsOnWithoutCachingThem)
+{
+    auto resolver = stream_resolver{stub, 1, std::chrono::seconds(60)};
+    EXPECT_TRUE(resolve(resolver, "https://youtu.be/error").ec);
+    EXPECT_TRUE(resolve(resolver, "https://youtu.be/error").ec);
+    EXPECT_EQ(resolver.resolutions(), 2u);
+
+    // The process is still the same one
+    EXPECT_EQ(resolve(resolver, "https://youtu.be/a").s.format, "3");
+}
+
+TEST_F(StreamResolver, RejectsWhatCurlCannotFetch)
+{
+    auto resolver = stream_resolver{stub, 1, std::chrono::seconds(60)};
+    EXPECT_EQ(resolve(resolver, "https://youtu.be/dash").ec,
+              boost::system::errc::protocol_not_supported);
+}
+
+TEST_F(StreamResolver, ReplacesAProcessThatExits)
+{
+    auto resolver = stream_resolver{stub, 1, std::chrono::seconds(60)};
+    EXPECT_TRUE(resolve(resolver, "https://youtu.be/crash").ec);
+
+    auto a = resolve(resolver, "https://youtu.be/a");
+    EXPECT_FALSE(a.ec) << a.ec.message();
+    EXPECT_EQ(a.s.format, "1");
+}
+
+TEST_F(StreamResolver, ReplacesAProcessThatTakesTooLong)
+{
+    auto resolver =
+        stream_resolver{stub, 1, std::chrono::seconds(60), std::chrono::milliseconds(500)};
+    EXPECT_EQ(resolve(resolver, "https://youtu.be/hang").ec, boost::asio::error::timed_out);
+
+    auto a = resolve(resolver, "https://youtu.be/a");
+    EXPECT_FALSE(a.ec) << a.ec.message();
+    EXPECT_EQ(a.s.format, "1");
+}
+
+TEST_F(StreamResolver, FailsRequestsWhenTheCommandDoesNotRun)
+{
+    auto resolver = stream_resolver{"./res/no_such_resolver", 1, std::chrono::seconds(60)};
+    EXPECT_TRUE(resolve(resolver, "https://youtu.be/a").ec);
+}
+
+int main(int argc, char *argv[])
+{
+    // Like the bot, a write to a process that is gone fails instead of ending the program
+    signal(SIGPIPE, SIG_IGN);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <boost/asio/io_context.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "aliases.h"
+#include "etf.h"
+#include "gateway.h"
+#include "net/connection.h"
+#include "options.h"
+#include "shard_manager.h"
+#include "voice/voice_connector.h"
+#include "websocket_stand_in.h"
+
+// The "shard" field of every identify the stand-in got, null where it was left out
+static std::vector<nlohmann::json> identified_shards(websocket_stand_in &stand_in)
+{
+    auto shards = std::vector<nlohmann::json>{};
+    for (auto &m : stand_in.get_received()) {
+        auto json = m.binary ? discord::etf_decode(m.data) : nlohmann::json::parse(m.data);
+        if (json["op"] == 2)
+            shards.push_back(json["d"].value("shard", nlohmann::json{}));
+    }
+    return shards;
+}
+
+class ShardManager : public ::testing::Test
+{
+protected:
+    boost::asio::io_context ctx;
+    ssl::context tls{ssl::context::tls_client};
+    websocket_stand_in stand_in;
+    discord::options opts;
+
+    void SetUp() override
+    {
+        opts.token = std::string(59, 'x');
+        opts.gateway_url = stand_in.url("&encoding=json");
+    }
+
+    // Runs the shards against the stand-in for a while, well short of the identify interval
+    void run_shards(discord::shard_manager &manager)
+    {
+        manager.run();
+        ctx.run_for(std::chrono::milliseconds(500));
+        manager.disconnect();
+    }
+};
+
+TEST_F(ShardManager, EveryShardIdentifiesAsItself)
+{
+    opts.shards = 2;
+    opts.max_concurrency = 2;
+    auto manager = discord::shard_manager{ctx, tls, opts};
+    run_shards(manager);
+
+    auto identified = identified_shards(stand_in);
+    ASSERT_EQ(identified.size(), 2u);
+    auto expected = std::vector<nlohmann::json>{{0, 2}, {1, 2}};
+    std::sort(identified.begin(), identified.end());
+    EXPECT_EQ(identified, expected);
+}
+
+TEST_F(ShardManager, SingleShardLeavesOutTheShardField)
+{
+    auto manager = discord::shard_manager{ctx, tls, opts};
+    run_shards(manager);
+
+    auto identified = identified_shards(stand_in);
+    ASSERT_EQ(identified.size(), 1u);
+    EXPECT_TRUE(identified[0].is_null());
+}
+
+TEST_F(ShardManager, IdentifiesInEtfWhenAsked)
+{
+    opts.gateway_encoding = "etf";
+    opts.shards = 2;
+    opts.max_concurrency = 2;
+    auto manager = discord::shard_manager{ctx, tls, opts};
+    run_shards(manager);
+
+    auto identified = identified_shards(stand_in);
+    ASSERT_EQ(identified.size(), 2u);
+    auto expected = std::vector<nlohmann::json>{{0, 2}, {1, 2}};
+    std::sort(identified.begin(), identified.end());
+    EXPECT_EQ(identified, expected);
+    for (auto &m : stand_in.get_received())
+        EXPECT_TRUE(m.binary);
+}
+
+TEST_F(ShardManager, IdentifiesNoMoreThanMaxConcurrencyAtOnce)
+{
+    opts.shards = 3;
+    opts.max_concurrency = 2;
+    auto manager = discord::shard_manager{ctx, tls, opts};
+    run_shards(manager);
+
+    EXPECT_EQ(identified_shards(stand_in).size(), 2u);
+}
+
+TEST(ShardFor, MapsGuildsLikeDiscord)
+{
+    EXPECT_EQ(discord::shard_for(0, 4), 0u);
+    EXPECT_EQ(discord::shard_for(41771983423143937, 4), 41771983423143937u >> 22 & 3);
+    EXPECT_EQ(discord::shard_for(uint64_t{5} << 22, 4), 1u);
+    EXPECT_EQ(discord::shard_for(uint64_t{5} << 22, 1), 0u);
+}
+
+// A guild's events come in on the shard Discord puts it on, and land in that shard's store
+TEST(ShardFor, VoiceStateReachesTheStoreOfItsShard)
+{
+    auto guild_id = discord::snowflake{5} << 22;
+    ASSERT_EQ(discord::shard_for(guild_id, 2), 1u);
+    auto id = std::to_string(guild_id);
+    auto stand_in = websocket_stand_in{{
+        R"({"op":0,"s":1,"t":"GUILD_CREATE","d":{"id":")" + id + R"(","voice_states":[]}})",
+        R"({"op":0,"s":2,"t":"VOICE_STATE_UPDATE","d":{"guild_id":")" + id +
+            R"(","channel_id":"7","user_id":"9","session_id":"x"}})"}};
+
+    auto ctx = boost::asio::io_context{};
+    auto tls = ssl::context{ssl::context::tls_client};
+    auto opts = discord::options{};
+    opts.token = std::string(59, 'x');
+    opts.gateway_url = stand_in.url("&encoding=json");
+    opts.gateway_compression = false;
+    auto voice = std::make_shared<discord::voice_connector>(tls, opts);
+    auto conn = discord::connection{ctx, tls};
+    auto shard = std::make_shared<discord::gateway>(ctx, opts, conn, voice, 1, 2);
+    shard->run();
+    ctx.run_for(std::chrono::milliseconds(500));
+    shard->disconnect();
+
+    const auto *guild = shard->get_gateway_store().get_guild(guild_id);
+    ASSERT_NE(guild, nullptr);
+    EXPECT_NE(guild->voice_states.find(9), nullptr);
+}
+
+int main(int argc, char *argv[])
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
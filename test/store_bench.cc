@@ -0,0 +1,98 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "allocation_counter.h"
+#include "gateway_store.h"
+
+// The fixture's guild with its members repeated under new ids up to the count wanted
+static std::string scaled_guild(const std::string &path, size_t members)
+{
+    auto file = std::ifstream{path};
+    auto contents = std::stringstream{};
+    contents << file.rdbuf();
+    auto json = nlohmann::json::parse(contents.str()).at("d");
+
+    auto &list = json.at("members");
+    auto originals = list;
+    for (auto i = list.size(); i < members; ++i) {
+        auto member = originals[i % originals.size()];
+        member["user"]["id"] = std::to_string(100000000000000000 + i);
+        member["user"]["username"] = "member " + std::to_string(i);
+        list.push_back(std::move(member));
+    }
+    return json.dump();
+}
+
+template<typename F>
+static void measure(const char *name, int rounds, F &&load)
+{
+    using clock = std::chrono::steady_clock;
+    auto start_allocations = allocations.load();
+    auto start_bytes = allocated_bytes.load();
+    auto start = clock::now();
+    for (auto i = 0; i < rounds; ++i) {
+        auto store = discord::gateway_store{};
+        load(store);
+    }
+    auto elapsed = std::chrono::duration<double, std::milli>(clock::now() - start) / rounds;
+    std::cout << name << ": " << elapsed.count() << " ms, "
+              << (allocations - start_allocations) / rounds << " allocations, "
+              << (allocated_bytes - start_bytes) / rounds / 1024 << " KiB allocated\n";
+}
+
+// Time and allocations to load one GUILD_CREATE into the store, through a JSON document and
+// straight from the text, then the memory the store keeps for it and the time of a channel lookup
+int main(int argc, char *argv[])
+{
+    auto path = argc > 1 ? argv[1] : "./res/guild_create1";
+    auto members = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100000;
+    auto rounds = argc > 3 ? std::atoi(argv[3]) : 5;
+
+    auto text = scaled_guild(path, members);
+    std::cout << members << " members, " << text.size() / 1024 << " KiB\n";
+
+    measure("document", rounds, [&](auto &store) {
+        auto json = nlohmann::json::parse(text);
+        store.guild_create(json);
+    });
+    measure("streamed", rounds, [&](auto &store) { store.guild_create(std::string_view{text}); });
+
+    auto before = live_bytes.load();
+    auto store = discord::gateway_store{};
+    store.guild_create(std::string_view{text});
+    std::cout << "store holds " << (live_bytes - before) / 1024 << " KiB, "
+              << (live_bytes - before) / members << " bytes per member\n";
+
+    // The same guild with --member-cache, no members are kept from it at all
+    before = live_bytes.load();
+    {
+        auto lazy = discord::gateway_store{10000};
+        lazy.guild_create(std::string_view{text});
+        std::cout << "lazy store holds " << (live_bytes - before) / 1024 << " KiB\n";
+    }
+
+    // The lookup every MESSAGE_CREATE does, over every channel
+    auto channels = std::vector<discord::snowflake>{};
+    for (auto &channel : store.get_guild(179378178601517056)->channels)
+        channels.push_back(channel.id);
+    auto lookups = 10000000;
+    auto found = discord::snowflake{0};
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    for (auto i = 0; i < lookups; ++i)
+        found += store.lookup_channel(channels[i % channels.size()]);
+    auto elapsed = std::chrono::duration<double, std::nano>(clock::now() - start);
+    std::cout << "lookup_channel: " << elapsed.count() / lookups << " ns\n";
+
+    auto *guild = store.get_guild(179378178601517056);
+    if (!guild || guild->members.size() != members || found == 0) {
+        std::cerr << "Streamed guild is missing members\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,84 @@
+#include <boost/beast/core/buffers_to_string.hpp>
+#include <chrono>
+#include <utility>
+
+#include "websocket_stand_in.h"
+
+websocket_stand_in::websocket_stand_in(std::vector<std::string> replay)
+    : acceptor{ctx, tcp::endpoint{boost::asio::ip::make_address("127.0.0.1"), 0}}
+    , replay{std::move(replay)}
+{
+    accept();
+    thread = std::thread{[this] { ctx.run(); }};
+}
+
+websocket_stand_in::~websocket_stand_in()
+{
+    ctx.stop();
+    thread.join();
+}
+
+std::string websocket_stand_in::url(const std::string &query) const
+{
+    return "ws://127.0.0.1:" + std::to_string(acceptor.local_endpoint().port()) + "/?v=6" + query;
+}
+
+std::vector<websocket_stand_in::message> websocket_stand_in::get_received()
+{
+    auto lock = std::lock_guard<std::mutex>{received_mutex};
+    return received;
+}
+
+std::vector<websocket_stand_in::message> websocket_stand_in::wait_for_received(size_t count)
+{
+    auto lock = std::unique_lock<std::mutex>{received_mutex};
+    received_changed.wait_for(lock, std::chrono::seconds(5),
+                              [&] { return received.size() >= count; });
+    return received;
+}
+
+void websocket_stand_in::accept()
+{
+    acceptor.async_accept([this](const auto &ec, tcp::socket socket) {
+        if (ec)
+            return;
+        sessions.push_back(std::make_unique<session>(std::move(socket)));
+        auto &s = *sessions.back();
+        s.ws.async_accept([this, &s](const auto &ec) {
+            if (ec)
+                return;
+            s.ws.binary(true);
+            write(s, 0);
+        });
+        accept();
+    });
+}
+
+void websocket_stand_in::write(session &s, size_t next)
+{
+    if (next == replay.size()) {
+        read(s);
+        return;
+    }
+    s.ws.async_write(boost::asio::buffer(replay[next]), [this, &s, next](const auto &ec, size_t) {
+        if (!ec)
+            write(s, next + 1);
+    });
+}
+
+// Reads on until the client closes the connection, the close handshake needs a read going
+void websocket_stand_in::read(session &s)
+{
+    s.ws.async_read(s.buffer, [this, &s](const auto &ec, size_t) {
+        if (ec)
+            return;
+        {
+            auto lock = std::lock_guard<std::mutex>{received_mutex};
+            received.push_back(
+                {boost::beast::buffers_to_string(s.buffer.data()), s.ws.got_binary()});
+            received_changed.notify_all();
+        }
+        s.buffer.consume(s.buffer.size());
+        read(s);
+    });
+}
@@ -0,0 +1,60 @@
+#ifndef TEST_WEBSOCKET_STAND_IN_H
+#define TEST_WEBSOCKET_STAND_IN_H
+
+#include <boost/asio/io_context.hpp>
+#include <boost/beast/core/multi_buffer.hpp>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "aliases.h"
+
+// Stands in for the Discord gateway on a local port: accepts websocket connections over plain TCP,
+// sends each of them the given messages, binary and in order, and keeps whatever comes back until
+// the client closes. Runs on a thread of its own, a client closing its connection waits for this
+// end to answer
+class websocket_stand_in
+{
+public:
+    struct message {
+        std::string data;
+        bool binary;
+    };
+
+    explicit websocket_stand_in(std::vector<std::string> replay = {});
+    ~websocket_stand_in();
+
+    std::string url(const std::string &query) const;
+
+    // What clients sent so far
+    std::vector<message> get_received();
+
+    // What clients sent, once there are count messages or a few seconds have passed
+    std::vector<message> wait_for_received(size_t count);
+
+private:
+    struct session {
+        plain_websocket ws;
+        boost::beast::multi_buffer buffer;
+
+        explicit session(tcp::socket socket) : ws{std::move(socket)} {}
+    };
+
+    boost::asio::io_context ctx;
+    tcp::acceptor acceptor;
+    std::vector<std::string> replay;
+    std::vector<std::unique_ptr<session>> sessions;
+    std::mutex received_mutex;
+    std::condition_variable received_changed;
+    std::vector<message> received;
+    std::thread thread;
+
+    void accept();
+    void write(session &s, size_t next);
+    void read(session &s);
+};
+
+#endif